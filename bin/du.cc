@@ -19,21 +19,18 @@ du(int fd)
 
   int size = st.st_size;
   if (S_ISDIR(st.st_mode)) {
-    struct dirent de;
-    while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-      if (de.inum == 0)
-        continue;
-
-      char buf[DIRSIZ+1];
-      memmove(buf, de.name, DIRSIZ);
-      buf[DIRSIZ] = 0;
-
-      if (!strcmp(buf, ".") || !strcmp(buf, ".."))
-        continue;
-
-      int nfd = openat(fd, buf, 0);
-      if (nfd >= 0)
-        size += du(nfd);  // should go into work queue
+    struct dirent64 des[64];
+    ssize_t r;
+    while ((r = getdents(fd, des, sizeof(des))) > 0) {
+      for (size_t i = 0; i < r / sizeof(des[0]); i++) {
+        const char *buf = des[i].d_name;
+        if (!strcmp(buf, ".") || !strcmp(buf, ".."))
+          continue;
+
+        int nfd = openat(fd, buf, 0);
+        if (nfd >= 0)
+          size += du(nfd);  // should go into work queue
+      }
     }
   }
 
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include "sockutil.h"
 
@@ -127,11 +128,26 @@ content_type(int s)
 }
 
 static int
-content(int s, int fd)
+content(int s, int fd, const struct stat *st)
 {
   char buf[256];
   int n;
 
+  if (S_ISREG(st->st_mode)) {
+    // Send regular files straight from the page cache.
+    off_t off = 0;
+    while (off < st->st_size) {
+      ssize_t r = sendfile(s, fd, &off, st->st_size - off);
+      if (r < 0) {
+        fprintf(stderr, "httpd content: sendfile failed %ld\n", r);
+        return -1;
+      }
+      if (r == 0)
+        break;
+    }
+    return 0;
+  }
+
   for (;;) {
     n = read(fd, buf, sizeof(buf));
     if (n < 0) {
@@ -189,7 +205,7 @@ resp_get(int s, const char *url)
   if (r < 0)
     goto error;
 
-  r = content(s, fd);
+  r = content(s, fd, &stat);
   if (r < 0)
     goto error;
   
@@ -217,20 +233,16 @@ resp_put(int s, const char *url, int content_length)
     return;
   }
 
-  char buf[1024];
-  while (content_length && (r = read(s, buf, NELEM(buf))) != 0) {
+  while (content_length) {
+    r = splice(s, NULL, fd, NULL, content_length, 0);
     if (r < 0) {
-      fprintf(stderr, "httpd client: read %d\n", r);
+      fprintf(stderr, "httpd client: splice %d\n", r);
       r = -400;
       goto error;
     }
+    if (r == 0)
+      break;
     content_length -= r;
-    r = xwrite(fd, buf, r);
-    if (r < 0) {
-      fprintf(stderr, "httpd client: write %d\n", r);
-      r = -400;
-      goto error;
-    }
   }
 
   r = header(s);
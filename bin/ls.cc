@@ -70,11 +70,11 @@ ls(const std::string &path)
   case S_IFDIR:
     std::vector<std::string> names;
 #ifdef XV6_USER
-    char namebuf[DIRSIZ+1];
-    char *prev = nullptr;
-    while(readdir(fd, prev, namebuf) > 0) {
-      prev = namebuf;
-      names.push_back(path + '/' + namebuf);
+    struct dirent64 des[64];
+    ssize_t r;
+    while((r = getdents(fd, des, sizeof(des))) > 0) {
+      for (size_t i = 0; i < r / sizeof(des[0]); i++)
+        names.push_back(path + '/' + des[i].d_name);
     }
 #else
     DIR *dir = fdopendir(fd);
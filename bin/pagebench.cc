@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#if defined(XV6_USER)
+#include "user.h"
+#endif
+#include "amd64.h"
+#include "libutil.h"
+#include "pageops.hh"
+
+// Compare the page zero and copy implementations in pageops.  Each
+// pass walks npages pages, so a small npages measures cached
+// bandwidth and a large one measures memory bandwidth.
+
+static char *src, *dst;
+static int npages;
+
+static uint64_t
+time_zero(const pageops_impl &impl, int npass)
+{
+  uint64_t t0 = rdtsc();
+  for (int pass = 0; pass < npass; pass++)
+    for (int i = 0; i < npages; i++)
+      impl.zero(dst + (uint64_t)i * PAGEOPS_BYTES);
+  return rdtsc() - t0;
+}
+
+static uint64_t
+time_copy(const pageops_impl &impl, int npass)
+{
+  uint64_t t0 = rdtsc();
+  for (int pass = 0; pass < npass; pass++)
+    for (int i = 0; i < npages; i++)
+      impl.copy(dst + (uint64_t)i * PAGEOPS_BYTES,
+                src + (uint64_t)i * PAGEOPS_BYTES);
+  return rdtsc() - t0;
+}
+
+int
+main(int ac, char **av)
+{
+  npages = 16;
+  int npass = 1000;
+  if (ac > 1)
+    npages = atoi(av[1]);
+  if (ac > 2)
+    npass = atoi(av[2]);
+  if (ac > 3 || npages <= 0 || npass <= 0)
+    die("usage: %s [npages] [npass]", av[0]);
+
+  size_t len = (size_t)npages * PAGEOPS_BYTES;
+  src = (char*)mmap(0, len, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  dst = (char*)mmap(0, len, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (src == MAP_FAILED || dst == MAP_FAILED)
+    die("mmap failed");
+  for (size_t i = 0; i < len; i++)
+    src[i] = i;
+
+  printf("%d pages x %d passes, cycles per page\n", npages, npass);
+  printf("%-12s %10s %10s\n", "impl", "zero", "copy");
+  uint64_t n = (uint64_t)npages * npass;
+  for (int i = 0; i < pageops_nimpls; i++) {
+    const pageops_impl &impl = pageops_impls[i];
+    if (!impl.supported()) {
+      printf("%-12s %10s %10s\n", impl.name, "-", "-");
+      continue;
+    }
+    // Warm up, so the first implementation doesn't pay for faulting
+    // in dst.
+    time_zero(impl, 1);
+    uint64_t z = time_zero(impl, npass);
+    uint64_t c = time_copy(impl, npass);
+    printf("%-12s %10lu %10lu\n", impl.name, z / n, c / n);
+  }
+
+  munmap(src, len);
+  munmap(dst, len);
+  return 0;
+}
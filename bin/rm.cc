@@ -25,18 +25,19 @@ rmtree(const char *base)
     int fd = open(base, O_RDONLY);
     if (fd < 0)
       edie("rm: failed to open %s", base);
-    char buf[DIRSIZ];
-    char *prev = nullptr;
+    struct dirent64 des[64];
     while (true) {
-      int r = readdir(fd, prev, buf);
-      prev = buf;
+      ssize_t r = getdents(fd, des, sizeof(des));
       if (r < 0)
-        edie("rm: failed to readdir %s", base);
+        edie("rm: failed to getdents %s", base);
       if (r == 0)
         break;
-      if (strcmp(buf, ".") == 0 || strcmp(buf, "..") == 0)
-        continue;
-      names.push_back(string(base).append("/").append(buf));
+      for (size_t i = 0; i < r / sizeof(des[0]); i++) {
+        const char *name = des[i].d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+          continue;
+        names.push_back(string(base).append("/").append(name));
+      }
     }
     close(fd);
     // Delete children
@@ -4,6 +4,7 @@
 #include "traps.h"
 #include "pthread.h"
 #include "rnd.hh"
+#include "pageops.hh"
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -14,6 +15,12 @@
 #include <setjmp.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sched.h>
+#include <uk/uring.h>
+#include <xv6/ring.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include <utility>
 
@@ -989,6 +996,125 @@ renametest(void)
   printf("rename ok\n");
 }
 
+// Read all of directory fd with getdents, nper entries per call, and
+// return the number of entries seen.  seen[i] counts the times file
+// "f<i>" came back.
+static int
+getdents_all(int fd, size_t nper, int *seen, int nseen)
+{
+  struct dirent64 des[64];
+  int total = 0;
+  ssize_t r;
+  assert(nper <= 64);
+  while ((r = getdents(fd, des, nper * sizeof(des[0]))) > 0) {
+    if (r % sizeof(des[0]) || r / sizeof(des[0]) > nper)
+      die("getdents: returned %ld bytes", r);
+    for (size_t i = 0; i < r / sizeof(des[0]); i++) {
+      struct dirent64 *de = &des[i];
+      total++;
+      if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+        if (de->d_type != T_DIR)
+          die("getdents: %s has type %d", de->d_name, de->d_type);
+        continue;
+      }
+      int n = de->d_name[0] == 'f' ? atoi(de->d_name + 1) : -1;
+      if (n < 0 || n >= nseen)
+        die("getdents: unexpected name %s", de->d_name);
+      if (de->d_type != T_FILE)
+        die("getdents: %s has type %d", de->d_name, de->d_type);
+      seen[n]++;
+    }
+  }
+  if (r < 0)
+    die("getdents: failed");
+  return total;
+}
+
+void
+getdentstest(void)
+{
+  enum { NFILES = 150 };
+  static int seen[NFILES];
+  char name[32];
+
+  printf("getdentstest\n");
+
+  if (mkdir("gdents", 0777) < 0)
+    die("getdentstest: mkdir");
+  for (int i = 0; i < NFILES; i++) {
+    snprintf(name, sizeof(name), "gdents/f%d", i);
+    int fd = open(name, O_CREAT|O_RDWR, 0666);
+    if (fd < 0)
+      die("getdentstest: create %s", name);
+    close(fd);
+  }
+
+  int fd = open("gdents", O_RDONLY);
+  if (fd < 0)
+    die("getdentstest: open");
+
+  // Batch sizes that do and don't line up with the directory's
+  // buckets should all see every name exactly once.
+  size_t sizes[] = { 1, 3, 16, 64 };
+  for (size_t s : sizes) {
+    memset(seen, 0, sizeof(seen));
+    if (lseek(fd, 0, SEEK_SET) != 0)
+      die("getdentstest: rewind");
+    int total = getdents_all(fd, s, seen, NFILES);
+    if (total != NFILES + 2)
+      die("getdentstest: batch %lu saw %d entries", s, total);
+    for (int i = 0; i < NFILES; i++)
+      if (seen[i] != 1)
+        die("getdentstest: batch %lu saw f%d %d times", s, i, seen[i]);
+  }
+
+  // Names removed in the middle of a listing must not break the
+  // cursor, and names that stay must still come back exactly once.
+  struct dirent64 de;
+  if (lseek(fd, 0, SEEK_SET) != 0)
+    die("getdentstest: rewind");
+  memset(seen, 0, sizeof(seen));
+  for (int k = 0; k < 10; k++) {
+    if (getdents(fd, &de, sizeof(de)) != sizeof(de))
+      die("getdentstest: getdents one");
+    if (de.d_name[0] == 'f')
+      seen[atoi(de.d_name + 1)]++;
+  }
+  for (int i = 0; i < NFILES; i += 2) {
+    snprintf(name, sizeof(name), "gdents/f%d", i);
+    if (!seen[i] && unlink(name) < 0)
+      die("getdentstest: unlink %s", name);
+  }
+  getdents_all(fd, 7, seen, NFILES);
+  for (int i = 0; i < NFILES; i++) {
+    snprintf(name, sizeof(name), "gdents/f%d", i);
+    struct stat st;
+    bool exists = stat(name, &st) == 0;
+    if (seen[i] > 1 || (exists && seen[i] != 1))
+      die("getdentstest: f%d seen %d times", i, seen[i]);
+  }
+
+  if (getdents(fd, &de, sizeof(de) - 1) != -1)
+    die("getdentstest: short buffer accepted");
+  if (lseek(fd, 1, SEEK_SET) != -1)
+    die("getdentstest: seek into a directory");
+  close(fd);
+
+  fd = open("gdents/f1", O_RDONLY);
+  if (getdents(fd, &de, sizeof(de)) != -1)
+    die("getdentstest: getdents on a file");
+  close(fd);
+
+  for (int i = 0; i < NFILES; i++) {
+    snprintf(name, sizeof(name), "gdents/f%d", i);
+    unlink(name);
+  }
+  if (unlink("gdents") < 0)
+    die("getdentstest: rmdir");
+
+  printf("getdentstest ok\n");
+}
+
 void
 bigfile(void)
 {
@@ -1443,6 +1569,70 @@ sigtest(void)
   fprintf(stderr, "sigtest ok\n");
 }
 
+static volatile char *sigsysptr;
+
+static void
+sigsyshand(int signo)
+{
+  if (mmap((void*) sigsysptr, 4096, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+           -1, 0) != sigsysptr)
+    die("sigsyshand: cannot mmap");
+}
+
+// Make a raw getpid system call with known values in the registers
+// it must preserve, and check that they and the result come back.
+static void
+checksysregs(const char *when)
+{
+  u64 regs[5];
+  long r;
+
+  __asm volatile("movabsq $0x1111111111111111, %%rbx\n"
+                 "movabsq $0x2222222222222222, %%r12\n"
+                 "movabsq $0x3333333333333333, %%r13\n"
+                 "movq %%rsp, 24(%2)\n"
+                 "syscall\n"
+                 "movq %%rbx, 0(%2)\n"
+                 "movq %%r12, 8(%2)\n"
+                 "movq %%r13, 16(%2)\n"
+                 "movq %%rsp, 32(%2)\n"
+                 : "=a" (r), "=m" (regs)
+                 : "r" (regs), "a" ((long)SYS_getpid)
+                 : "rbx", "r12", "r13", "rcx", "r11", "rdi", "rsi", "rdx",
+                   "r8", "r9", "r10", "memory", "cc");
+  if (r != getpid())
+    die("sigsystest: getpid returned %ld %s", r, when);
+  if (regs[0] != 0x1111111111111111ull || regs[1] != 0x2222222222222222ull ||
+      regs[2] != 0x3333333333333333ull || regs[3] != regs[4])
+    die("sigsystest: registers changed %s", when);
+}
+
+// Taking a signal from a fault makes the kernel restore the whole
+// trap frame; make sure that doesn't leak into later system calls.
+void
+sigsystest(void)
+{
+  printf("sigsys test\n");
+
+  checksysregs("before a signal");
+  sigsysptr = (volatile char*) 0xdeadbeee000;
+  if (signal(SIGSEGV, sigsyshand) == SIG_ERR)
+    die("sigsystest: failed to set SIGSEGV handler");
+  for (int i = 0; i < 3; i++) {
+    *sigsysptr = i;
+    checksysregs("after a signal");
+    checksysregs("after a signal and a syscall");
+    if (*sigsysptr != i)
+      die("sigsystest: wrong value in sigsysptr");
+    munmap((void*) sigsysptr, 4096);
+  }
+  if (signal(SIGSEGV, SIG_DFL) == SIG_ERR)
+    die("sigsystest: failed to reset SIGSEGV");
+
+  printf("sigsys test ok\n");
+}
+
 // does unintialized data start out zero?
 char uninit[10000];
 void
@@ -1938,6 +2128,159 @@ floattest(void)
   printf("floattest ok\n");
 }
 
+// Put tag in xmm8 and xmm15, yield the CPU with a raw system call,
+// and check that both registers still hold it.  Going through the
+// yield() wrapper could let the compiler keep the values on the stack.
+static void
+fpu_yield_check(u64 tag)
+{
+  u64 out[4];
+  long r;
+
+  __asm volatile("movq %3, %%xmm8\n"
+                 "punpcklqdq %%xmm8, %%xmm8\n"
+                 "movdqa %%xmm8, %%xmm15\n"
+                 "syscall\n"
+                 "movdqu %%xmm8, 0(%2)\n"
+                 "movdqu %%xmm15, 16(%2)\n"
+                 : "=a" (r), "=m" (out)
+                 : "r" (out), "r" (tag), "a" ((long)SYS_yield)
+                 : "xmm8", "xmm15", "rcx", "r11", "rdi", "rsi", "rdx",
+                   "r8", "r9", "r10", "memory", "cc");
+  for (int i = 0; i < 4; i++)
+    if (out[i] != tag)
+      die("fputest: pid %d xmm word %d is %lx, want %lx",
+          getpid(), i, out[i], tag);
+}
+
+// Procs that use the FPU in every time slice get their state loaded
+// eagerly on switch-in, and ones that use it now and then get it
+// through the #NM trap.  Run both kinds on one CPU so they keep
+// switching among each other, and move them to another CPU and back
+// partway so the saved state has to follow them.
+void
+fputest(void)
+{
+  enum { NPROCS = 4, ITERS = 300 };
+
+  printf("fputest\n");
+
+  for (int p = 0; p < NPROCS; p++) {
+    int pid = fork();
+    if (pid < 0)
+      die("fputest: fork");
+    if (pid)
+      continue;
+
+    bool eager = p % 2 == 0;
+    double x = p + 1;
+    setaffinity(0);
+    for (int i = 0; i < ITERS; i++) {
+      if (i == ITERS / 3)
+        setaffinity(1);         // Fails harmlessly on one CPU
+      else if (i == 2 * ITERS / 3)
+        setaffinity(0);
+
+      if (eager || i % 10 == 0) {
+        fpu_yield_check(((u64)getpid() << 32) | i);
+        x = x * 1.5 + 1;
+      } else {
+        yield();
+      }
+    }
+
+    // x followed x = 1.5x + 1 once per FPU slice from p + 1.
+    double want = p + 1;
+    for (int i = 0; i < ITERS; i++)
+      if (eager || i % 10 == 0)
+        want = want * 1.5 + 1;
+    exit(x == want ? 0 : 1);
+  }
+
+  for (int p = 0; p < NPROCS; p++) {
+    int status;
+    if (wait(&status) < 0)
+      die("fputest: wait");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      die("fputest: child failed with status %d", status);
+  }
+
+  printf("fputest ok\n");
+}
+
+static std::atomic<int> sched_turn;
+
+void*
+sched_thr(void *arg)
+{
+  int me = (int)(uintptr_t)arg;
+  setaffinity(0);
+
+  // Both threads share CPU 0, so each handoff needs a yield to
+  // actually switch to the other thread.
+  for (int i = 0; i < 200; ++i) {
+    while (sched_turn != me)
+      yield();
+    sched_turn = !me;
+  }
+  return nullptr;
+}
+
+void
+schedtest(void)
+{
+  printf("schedtest\n");
+
+  sched_turn = 0;
+  for (int i = 0; i < 2; i++) {
+    pthread_t tid;
+    pthread_create(&tid, 0, &sched_thr, (void*)(uintptr_t)i);
+  }
+  for (int i = 0; i < 2; i++)
+    wait(NULL);
+
+  if (setscheduler(0, SCHED_OTHER, NICE_MAX + 1) != -1)
+    die("setscheduler: bad nice accepted");
+  if (setscheduler(0, 7, 0) != -1)
+    die("setscheduler: bad policy accepted");
+  // Only init and real-time procs may make a proc real-time.
+  if (setscheduler(0, SCHED_FIFO, 0) != -1)
+    die("setscheduler: SCHED_FIFO allowed");
+
+  // A proc may change its children, but not its parent.  The child
+  // waits on the pipe so it's still around when we change it.
+  int parent = getpid(), fds[2];
+  if (pipe(fds) < 0)
+    die("schedtest: pipe");
+  int pid = fork();
+  if (pid < 0)
+    die("schedtest: fork");
+  if (pid == 0) {
+    char c;
+    close(fds[1]);
+    if (setscheduler(0, SCHED_OTHER, 5) != 0)
+      exit(1);
+    if (setscheduler(parent, SCHED_OTHER, 5) != -1)
+      exit(2);
+    read(fds[0], &c, 1);
+    exit(0);
+  }
+  close(fds[0]);
+  if (setscheduler(pid, SCHED_OTHER, -5) != 0)
+    die("setscheduler: child");
+  if (setscheduler(pid, SCHED_FIFO, 0) != -1)
+    die("setscheduler: SCHED_FIFO child allowed");
+  close(fds[1]);
+  int status;
+  wait(&status);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    die("schedtest: child status %d", status);
+  if (setscheduler(0, SCHED_OTHER, 0) != 0)
+    die("setscheduler: reset");
+
+  printf("schedtest ok\n");
+}
+
 void
 writeprotecttest(void)
 {
@@ -2038,6 +2381,1161 @@ cloexec(void)
   printf("cloexec ok\n");
 }
 
+void
+sparsetest(void)
+{
+  static char data[4096];
+  struct stat st;
+
+  printf("sparse file test\n");
+
+  unlink("sparse.x");
+  int fd = open("sparse.x", O_CREAT|O_RDWR, 0666);
+  if (fd < 0)
+    die("sparsetest: open failed");
+
+  // Writing past EOF leaves a hole that reads as zeroes.
+  memset(data, 'a', sizeof(data));
+  if (pwrite(fd, data, 10, 3*4096 + 100) != 10)
+    die("sparsetest: pwrite failed");
+  if (fstat(fd, &st) < 0 || st.st_size != 3*4096 + 110)
+    die("sparsetest: size %d after pwrite", (int)st.st_size);
+  memset(data, 'x', sizeof(data));
+  if (pread(fd, data, 4096, 4096) != 4096)
+    die("sparsetest: pread of hole failed");
+  for (int i = 0; i < 4096; i++)
+    if (data[i] != 0)
+      die("sparsetest: hole byte %d is %d", i, data[i]);
+
+  // Shrinking drops the tail of the last page, so growing the file
+  // again exposes zeroes rather than the old data.
+  if (ftruncate(fd, 3*4096 + 105) < 0 || ftruncate(fd, 4*4096) < 0)
+    die("sparsetest: ftruncate failed");
+  if (fstat(fd, &st) < 0 || st.st_size != 4*4096)
+    die("sparsetest: size %d after ftruncate", (int)st.st_size);
+  if (pread(fd, data, 10, 3*4096 + 100) != 10)
+    die("sparsetest: pread after ftruncate failed");
+  for (int i = 0; i < 10; i++)
+    if (data[i] != (i < 5 ? 'a' : 0))
+      die("sparsetest: byte %d is %d after ftruncate", i, data[i]);
+
+  // fallocate grows the file, unless asked to keep its size.
+  if (fallocate(fd, 0, 4*4096, 4096) < 0)
+    die("sparsetest: fallocate failed");
+  if (fstat(fd, &st) < 0 || st.st_size != 5*4096)
+    die("sparsetest: size %d after fallocate", (int)st.st_size);
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 5*4096, 4096) < 0)
+    die("sparsetest: fallocate KEEP_SIZE failed");
+  if (fstat(fd, &st) < 0 || st.st_size != 5*4096)
+    die("sparsetest: size %d after fallocate KEEP_SIZE", (int)st.st_size);
+
+  // Ranges that run off the end of any file fail without resizing.
+  off_t big = (off_t)(~0ull >> 1);
+  if (fallocate(fd, 0, 4096, big) == 0 || fallocate(fd, 0, big, 1) == 0)
+    die("sparsetest: fallocate of huge range succeeded");
+  if (fallocate(fd, 0, -1, 1) == 0 || fallocate(fd, 0, 0, 0) == 0)
+    die("sparsetest: fallocate of bad range succeeded");
+  if (fstat(fd, &st) < 0 || st.st_size != 5*4096)
+    die("sparsetest: size %d after bad fallocate", (int)st.st_size);
+
+  if (ftruncate(fd, 0) < 0)
+    die("sparsetest: ftruncate to 0 failed");
+  if (pread(fd, data, 1, 0) != 0)
+    die("sparsetest: pread past EOF returned data");
+  close(fd);
+  unlink("sparse.x");
+
+  printf("sparse file test ok\n");
+}
+
+// Check that fd holds nothing but whole reclen-byte records, each one
+// byte repeated, and count them by byte in counts.
+static void
+checkrecords(int fd, int reclen, int *counts, int ncounts)
+{
+  char rec[256];
+  struct stat st;
+
+  if (fstat(fd, &st) < 0)
+    die("appendtest: fstat failed");
+  if (st.st_size % reclen)
+    die("appendtest: size %d isn't whole records", (int)st.st_size);
+  for (off_t off = 0; off < st.st_size; off += reclen) {
+    if (pread(fd, rec, reclen, off) != reclen)
+      die("appendtest: pread at %d failed", (int)off);
+    for (int i = 1; i < reclen; i++)
+      if (rec[i] != rec[0])
+        die("appendtest: record at %d is torn", (int)off);
+    if (rec[0] < 'A' || rec[0] >= 'A' + ncounts)
+      die("appendtest: bad record at %d", (int)off);
+    counts[rec[0] - 'A']++;
+  }
+}
+
+void
+appendtest(void)
+{
+  // Records cross page boundaries, since 4096 isn't a multiple of 100.
+  enum { nprocs = 4, nrecs = 200, reclen = 100 };
+  char rec[reclen];
+  int counts[nprocs];
+  int fd;
+
+  printf("concurrent append test\n");
+
+  unlink("append.x");
+  fd = open("append.x", O_CREAT|O_RDWR, 0666);
+  if (fd < 0)
+    die("appendtest: create failed");
+  close(fd);
+
+  for (int p = 0; p < nprocs; p++) {
+    int pid = fork();
+    if (pid < 0)
+      die("appendtest: fork failed");
+    if (pid == 0) {
+      fd = open("append.x", O_WRONLY|O_APPEND);
+      if (fd < 0)
+        die("appendtest: open failed");
+      memset(rec, 'A' + p, reclen);
+      for (int i = 0; i < nrecs; i++)
+        if (write(fd, rec, reclen) != reclen)
+          die("appendtest: write failed");
+      exit(0);
+    }
+  }
+  for (int p = 0; p < nprocs; p++)
+    wait(NULL);
+
+  fd = open("append.x", O_RDWR);
+  if (fd < 0)
+    die("appendtest: open failed");
+  memset(counts, 0, sizeof(counts));
+  checkrecords(fd, reclen, counts, nprocs);
+  for (int p = 0; p < nprocs; p++)
+    if (counts[p] != nrecs)
+      die("appendtest: %d records from %d, wanted %d",
+          counts[p], p, nrecs);
+
+  // Truncates wait for appends in flight, so appends racing with them
+  // leave whole records.
+  int pid = fork();
+  if (pid < 0)
+    die("appendtest: fork failed");
+  if (pid == 0) {
+    for (int i = 0; i < 100; i++)
+      if (ftruncate(fd, 0) < 0)
+        die("appendtest: ftruncate failed");
+    exit(0);
+  }
+  int afd = open("append.x", O_WRONLY|O_APPEND);
+  if (afd < 0)
+    die("appendtest: open failed");
+  memset(rec, 'A', reclen);
+  for (int i = 0; i < nrecs; i++)
+    if (write(afd, rec, reclen) != reclen)
+      die("appendtest: write during truncates failed");
+  wait(NULL);
+  close(afd);
+  memset(counts, 0, sizeof(counts));
+  checkrecords(fd, reclen, counts, nprocs);
+  close(fd);
+  unlink("append.x");
+
+  printf("concurrent append test ok\n");
+}
+
+void
+pagingtest(void)
+{
+  struct stat st;
+  int status;
+
+  printf("paging test\n");
+
+  // echo comes from the disk, so its pages are read in on demand and
+  // clean ones can be evicted.  Keep a copy so we can put it back.
+  int fd = open("/echo", O_RDWR);
+  if (fd < 0 || fstat(fd, &st) < 0)
+    die("pagingtest: open failed");
+  size_t size = st.st_size;
+  if (size < 3*4096)
+    die("pagingtest: /echo is only %lu bytes", size);
+  char *orig = (char*)malloc(size), *got = (char*)malloc(size);
+  if (!orig || !got)
+    die("pagingtest: malloc failed");
+  if (pread(fd, orig, size, 0) != size)
+    die("pagingtest: read failed");
+
+  // A private mapping sees the file's pages, keeps them across an
+  // eviction, and doesn't write its changes back.
+  char *p = (char*)mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    die("pagingtest: mmap failed");
+  if (memcmp(p, orig, 3*4096) != 0)
+    die("pagingtest: mapping differs from read");
+  if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) < 0)
+    die("pagingtest: DONTNEED failed");
+  if (memcmp(p, orig, 3*4096) != 0)
+    die("pagingtest: mapping changed after eviction");
+  p[4096 + 7] ^= 0xff;
+  if (pread(fd, got, size, 0) != size || memcmp(got, orig, size) != 0)
+    die("pagingtest: private write reached the file");
+  munmap(p, 3*4096);
+
+  // A written page is dirty, so eviction keeps it.
+  char c = orig[5000] ^ 0xff;
+  if (pwrite(fd, &c, 1, 5000) != 1)
+    die("pagingtest: pwrite failed");
+  if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) < 0)
+    die("pagingtest: DONTNEED failed");
+  if (pread(fd, got, 1, 5000) != 1 || got[0] != c)
+    die("pagingtest: dirty page lost");
+
+  // Truncating lowers what comes from the disk.  Growing again must
+  // expose zeroes, even once the pages are evicted and read back.
+  size_t cut = 4096 + 123;
+  if (ftruncate(fd, cut) < 0 || ftruncate(fd, size) < 0)
+    die("pagingtest: ftruncate failed");
+  if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) < 0)
+    die("pagingtest: DONTNEED failed");
+  if (pread(fd, got, size, 0) != size)
+    die("pagingtest: read after ftruncate failed");
+  if (memcmp(got, orig, cut) != 0)
+    die("pagingtest: data before the cut changed");
+  for (size_t i = cut; i < size; i++)
+    if (got[i] != 0)
+      die("pagingtest: byte %lu is %d after ftruncate", i, got[i]);
+
+  // Put echo back and make sure it still runs.
+  if (pwrite(fd, orig, size, 0) != size)
+    die("pagingtest: restore failed");
+  if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) < 0)
+    die("pagingtest: DONTNEED failed");
+  if (pread(fd, got, size, 0) != size || memcmp(got, orig, size) != 0)
+    die("pagingtest: restore differs");
+  close(fd);
+
+  if (fork() == 0) {
+    close(1);
+    const char *args[] = {"echo", "paging", nullptr};
+    execv("echo", const_cast<char * const *>(args));
+    die("pagingtest: exec echo failed");
+  }
+  wait(&status);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    die("pagingtest: echo exited with status %d", status);
+
+  free(orig);
+  free(got);
+  printf("paging test ok\n");
+}
+
+// Sum the bytes of fd from off to EOF, reading n bytes at a time.
+static u64
+filesum(int fd, off_t off, int n)
+{
+  static char buf[8192];
+  u64 sum = 0;
+  int r;
+
+  while ((r = pread(fd, buf, n, off)) > 0) {
+    for (int i = 0; i < r; i++)
+      sum = sum * 31 + (unsigned char)buf[i];
+    off += r;
+  }
+  if (r < 0)
+    die("filesum: pread at %d failed", (int)off);
+  return sum;
+}
+
+void
+fadvisetest(void)
+{
+  struct stat st;
+  int fds[2];
+
+  printf("fadvise test\n");
+
+  // usertests itself comes from the disk, so its pages can be evicted
+  // and read back in.
+  int fd = open("/usertests", O_RDONLY);
+  if (fd < 0)
+    die("fadvisetest: open failed");
+  if (fstat(fd, &st) < 0 || st.st_size < 8*4096)
+    die("fadvisetest: fstat failed");
+
+  u64 sum = filesum(fd, 0, 4096);
+  if (filesum(fd, 0, 1000) != sum)
+    die("fadvisetest: unaligned reads differ");
+
+  // Each advice leaves the contents alone.
+  static const int advice[] = {
+    POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, POSIX_FADV_WILLNEED,
+    POSIX_FADV_DONTNEED, POSIX_FADV_NOREUSE, POSIX_FADV_NORMAL,
+  };
+  for (int i = 0; i < sizeof(advice) / sizeof(advice[0]); i++) {
+    if (posix_fadvise(fd, 0, 0, advice[i]) < 0)
+      die("fadvisetest: advice %d failed", advice[i]);
+    if (filesum(fd, 0, 4096) != sum)
+      die("fadvisetest: contents changed after advice %d", advice[i]);
+  }
+
+  // Dropping part of the file and reading across it.
+  if (posix_fadvise(fd, 4096, 3*4096, POSIX_FADV_DONTNEED) < 0)
+    die("fadvisetest: partial DONTNEED failed");
+  if (filesum(fd, 0, 8192) != sum)
+    die("fadvisetest: contents changed after partial DONTNEED");
+
+  // Huge ranges are clipped to EOF, so these return right away.
+  off_t huge = (off_t)1 << 62;
+  if (posix_fadvise(fd, 0, huge, POSIX_FADV_WILLNEED) < 0 ||
+      posix_fadvise(fd, 0, huge, POSIX_FADV_DONTNEED) < 0 ||
+      posix_fadvise(fd, huge, huge - 1, POSIX_FADV_DONTNEED) < 0)
+    die("fadvisetest: huge range failed");
+  if (filesum(fd, 0, 4096) != sum)
+    die("fadvisetest: contents changed after huge DONTNEED");
+
+  // Bad ranges and advice fail.
+  if (posix_fadvise(fd, -1, 0, POSIX_FADV_DONTNEED) == 0 ||
+      posix_fadvise(fd, 0, -1, POSIX_FADV_DONTNEED) == 0 ||
+      posix_fadvise(fd, huge, huge, POSIX_FADV_DONTNEED) == 0 ||
+      posix_fadvise(fd, 0, 0, 100) == 0)
+    die("fadvisetest: bad arguments succeeded");
+  close(fd);
+
+  if (pipe(fds) < 0)
+    die("fadvisetest: pipe failed");
+  if (posix_fadvise(fds[0], 0, 0, POSIX_FADV_DONTNEED) == 0)
+    die("fadvisetest: fadvise of a pipe succeeded");
+  close(fds[0]);
+  close(fds[1]);
+
+  printf("fadvise test ok\n");
+}
+
+void
+splicetest(void)
+{
+  enum { fsize = 3*4096 + 500 };
+  static char data[fsize], got[fsize];
+  int fds[2];
+  off_t off;
+
+  printf("sendfile/splice test\n");
+
+  for (int i = 0; i < fsize; i++)
+    data[i] = i % 251;
+  unlink("splice.in");
+  unlink("splice.out");
+  int in = open("splice.in", O_CREAT|O_RDWR, 0666);
+  int out = open("splice.out", O_CREAT|O_RDWR, 0666);
+  if (in < 0 || out < 0)
+    die("splicetest: open failed");
+  if (write(in, data, fsize) != fsize)
+    die("splicetest: write failed");
+
+  // File to pipe at an explicit offset, which doesn't move the file
+  // offset.  The pipe holds all of it, so this doesn't need a reader.
+  if (pipe(fds) < 0)
+    die("splicetest: pipe failed");
+  off = 100;
+  if (sendfile(fds[1], in, &off, fsize - 100) != fsize - 100)
+    die("splicetest: sendfile to pipe failed");
+  if (off != fsize)
+    die("splicetest: sendfile left offset at %d", (int)off);
+  for (int n = 0; n < fsize - 100; ) {
+    int r = read(fds[0], got + n, fsize - 100 - n);
+    if (r <= 0)
+      die("splicetest: read from pipe failed");
+    n += r;
+  }
+  if (memcmp(got, data + 100, fsize - 100))
+    die("splicetest: pipe got wrong data");
+
+  // File to file at the file offsets, which stops at EOF.
+  if (lseek(in, 0, SEEK_SET) != 0)
+    die("splicetest: lseek failed");
+  if (sendfile(out, in, nullptr, fsize + 1000) != fsize)
+    die("splicetest: sendfile to file failed");
+  if (lseek(in, 0, SEEK_CUR) != fsize || lseek(out, 0, SEEK_CUR) != fsize)
+    die("splicetest: sendfile didn't advance file offsets");
+  if (pread(out, got, fsize, 0) != fsize || memcmp(got, data, fsize))
+    die("splicetest: file got wrong data");
+
+  // Pipe to an explicit offset in a file.
+  if (write(fds[1], "spliced", 7) != 7)
+    die("splicetest: write to pipe failed");
+  off = 10;
+  if (splice(fds[0], nullptr, out, &off, 7, SPLICE_F_MOVE) != 7 || off != 17)
+    die("splicetest: splice from pipe failed");
+  if (pread(out, got, 7, 10) != 7 || memcmp(got, "spliced", 7))
+    die("splicetest: splice wrote wrong data");
+
+  // Data spliced out of a pipe is gone even if the destination
+  // fails, and the count includes it.
+  int dead[2];
+  if (pipe(dead) < 0)
+    die("splicetest: pipe failed");
+  close(dead[0]);
+  if (write(fds[1], "lost", 4) != 4)
+    die("splicetest: write to pipe failed");
+  if (splice(fds[0], nullptr, dead[1], nullptr, 4, 0) != 4)
+    die("splicetest: splice to a closed pipe miscounted");
+  close(dead[1]);
+
+  // A file can't be spliced to itself, and unknown flags fail.
+  if (splice(in, nullptr, in, nullptr, 10, 0) >= 0)
+    die("splicetest: splice to self succeeded");
+  if (splice(in, nullptr, out, nullptr, 10, 0x100) >= 0)
+    die("splicetest: splice with bad flags succeeded");
+
+  close(fds[0]);
+  close(fds[1]);
+  close(in);
+  close(out);
+  unlink("splice.in");
+  unlink("splice.out");
+
+  printf("sendfile/splice test ok\n");
+}
+
+void
+pipeatomic(void)
+{
+  // The kernel's PIPE_BUF, the largest write that goes in whole.
+  enum { pipebuf = 4096, nprocs = 4, nrecs = 50 };
+  static char rec[pipebuf];
+  int fds[2];
+  int counts[nprocs];
+
+  printf("pipe atomicity test\n");
+
+  // Writes of up to PIPE_BUF bytes don't interleave, even when the
+  // pipe is full and several writers are waiting.
+  if (pipe(fds) < 0)
+    die("pipeatomic: pipe failed");
+  for (int p = 0; p < nprocs; p++) {
+    int pid = fork();
+    if (pid < 0)
+      die("pipeatomic: fork failed");
+    if (pid == 0) {
+      close(fds[0]);
+      memset(rec, 'A' + p, pipebuf);
+      for (int i = 0; i < nrecs; i++)
+        if (write(fds[1], rec, pipebuf) != pipebuf)
+          die("pipeatomic: write failed");
+      exit(0);
+    }
+  }
+  close(fds[1]);
+
+  memset(counts, 0, sizeof(counts));
+  for (;;) {
+    int n = 0, r = 0;
+    while (n < pipebuf && (r = read(fds[0], rec + n, pipebuf - n)) > 0)
+      n += r;
+    if (r < 0)
+      die("pipeatomic: read failed");
+    // Once every writer is gone, read returns EOF.
+    if (n == 0)
+      break;
+    if (n != pipebuf)
+      die("pipeatomic: partial record at EOF");
+    for (int i = 1; i < pipebuf; i++)
+      if (rec[i] != rec[0])
+        die("pipeatomic: writes interleaved");
+    if (rec[0] < 'A' || rec[0] >= 'A' + nprocs)
+      die("pipeatomic: bad record");
+    counts[rec[0] - 'A']++;
+  }
+  for (int p = 0; p < nprocs; p++) {
+    wait(NULL);
+    if (counts[p] != nrecs)
+      die("pipeatomic: %d records from %d, wanted %d", counts[p], p, nrecs);
+  }
+  close(fds[0]);
+
+  // Non-blocking pipes fail instead of waiting when they're empty or
+  // full, and writes fail once the reader is gone.
+  if (pipe2(fds, O_NONBLOCK) < 0)
+    die("pipeatomic: pipe2 failed");
+  if (read(fds[0], rec, 1) != -1)
+    die("pipeatomic: read of empty non-blocking pipe succeeded");
+  int total = 0, r;
+  while ((r = write(fds[1], rec, pipebuf)) > 0)
+    total += r;
+  if (total == 0)
+    die("pipeatomic: non-blocking pipe took nothing");
+  for (int n = 0; n < total; n += r)
+    if ((r = read(fds[0], rec, pipebuf)) <= 0)
+      die("pipeatomic: read of full pipe failed");
+  if (read(fds[0], rec, 1) != -1)
+    die("pipeatomic: read of drained pipe succeeded");
+  close(fds[0]);
+  if (write(fds[1], rec, 1) != -1)
+    die("pipeatomic: write without a reader succeeded");
+  close(fds[1]);
+
+  printf("pipe atomicity test ok\n");
+}
+
+void
+pipeanyorder(void)
+{
+  enum { reclen = 512, nprocs = 4, nrecs = 100 };
+  char rec[reclen];
+  int fds[2];
+  int counts[nprocs];
+
+  printf("unordered pipe test\n");
+
+  if (pipe2(fds, O_ANYORDER) < 0)
+    die("pipeanyorder: pipe2 failed");
+  for (int p = 0; p < nprocs; p++) {
+    int pid = fork();
+    if (pid < 0)
+      die("pipeanyorder: fork failed");
+    if (pid == 0) {
+      close(fds[0]);
+      memset(rec, 'A' + p, reclen);
+      for (int i = 0; i < nrecs; i++)
+        if (write(fds[1], rec, reclen) != reclen)
+          die("pipeanyorder: write failed");
+      exit(0);
+    }
+  }
+  close(fds[1]);
+
+  // Records may come in any order, but a reader with room for a whole
+  // write gets exactly that write.
+  memset(counts, 0, sizeof(counts));
+  int r;
+  while ((r = read(fds[0], rec, reclen)) > 0) {
+    if (r != reclen)
+      die("pipeanyorder: read %d bytes, wanted %d", r, reclen);
+    for (int i = 1; i < reclen; i++)
+      if (rec[i] != rec[0])
+        die("pipeanyorder: writes interleaved");
+    if (rec[0] < 'A' || rec[0] >= 'A' + nprocs)
+      die("pipeanyorder: bad record");
+    counts[rec[0] - 'A']++;
+  }
+  if (r < 0)
+    die("pipeanyorder: read failed");
+  for (int p = 0; p < nprocs; p++) {
+    wait(NULL);
+    if (counts[p] != nrecs)
+      die("pipeanyorder: %d records from %d, wanted %d",
+          counts[p], p, nrecs);
+  }
+  close(fds[0]);
+
+  // Non-blocking reads of an empty unordered pipe fail.
+  if (pipe2(fds, O_ANYORDER|O_NONBLOCK) < 0)
+    die("pipeanyorder: pipe2 failed");
+  if (read(fds[0], rec, 1) != -1)
+    die("pipeanyorder: read of empty pipe succeeded");
+  if (write(fds[1], "x", 1) != 1 || read(fds[0], rec, reclen) != 1)
+    die("pipeanyorder: non-blocking write/read failed");
+  close(fds[0]);
+  close(fds[1]);
+
+  printf("unordered pipe test ok\n");
+}
+
+// Make a connected pair of UNIX sockets of the given type through a
+// listener bound to path.  Returns the listener.
+static int
+unixpair(int type, const char *path, int *client, int *server)
+{
+  struct sockaddr_un addr;
+
+  unlink(path);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int l = socket(AF_UNIX, type, 0);
+  if (l < 0)
+    die("unixpair: socket failed");
+  if (bind(l, (struct sockaddr*)&addr, SUN_LEN(&addr)) < 0)
+    die("unixpair: bind failed");
+  if (listen(l, 4) < 0)
+    die("unixpair: listen failed");
+  *client = socket(AF_UNIX, type, 0);
+  if (*client < 0)
+    die("unixpair: socket failed");
+  // Connections queue until they're accepted, so this doesn't wait.
+  if (connect(*client, (struct sockaddr*)&addr, SUN_LEN(&addr)) < 0)
+    die("unixpair: connect failed");
+  *server = accept(l, nullptr, nullptr);
+  if (*server < 0)
+    die("unixpair: accept failed");
+  return l;
+}
+
+void
+unixstream(void)
+{
+  enum { len = 3*4096 + 100 };
+  static char data[len], got[len];
+  struct sockaddr_un addr;
+  struct stat st;
+  int c, s, l;
+
+  printf("unix stream socket test\n");
+
+  // Streams keep bytes in order across page-sized segments, and read
+  // returns EOF once the peer closes.
+  l = unixpair(SOCK_STREAM, "ustream.sock", &c, &s);
+  for (int i = 0; i < len; i++)
+    data[i] = i % 253;
+  if (write(c, data, len) != len)
+    die("unixstream: write failed");
+  close(c);
+  int n = 0, r;
+  while ((r = read(s, got + n, len - n)) > 0)
+    n += r;
+  if (r < 0 || n != len || memcmp(got, data, len))
+    die("unixstream: got %d bytes, wanted %d", n, len);
+  close(s);
+
+  // A second bind fails without leaving its path behind.
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, "ustream2.sock");
+  unlink("ustream2.sock");
+  if (bind(l, (struct sockaddr*)&addr, SUN_LEN(&addr)) == 0)
+    die("unixstream: second bind succeeded");
+  if (stat("ustream2.sock", &st) == 0)
+    die("unixstream: failed bind created its path");
+
+  // Once the listener closes, connects to its path fail.
+  close(l);
+  strcpy(addr.sun_path, "ustream.sock");
+  int bad = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(bad, (struct sockaddr*)&addr, SUN_LEN(&addr)) == 0)
+    die("unixstream: connect to closed listener succeeded");
+  close(bad);
+
+  // A seqpacket listener doesn't take stream connections.
+  strcpy(addr.sun_path, "useqpkt.sock");
+  int l2 = unixpair(SOCK_SEQPACKET, "useqpkt.sock", &c, &s);
+  bad = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(bad, (struct sockaddr*)&addr, SUN_LEN(&addr)) == 0)
+    die("unixstream: stream connect to seqpacket listener succeeded");
+  close(bad);
+
+  // Seqpackets keep message boundaries, and a short read drops the
+  // rest of its message.
+  if (send(c, "abc", 3, 0) != 3 || send(c, "defgh", 5, 0) != 5 ||
+      send(c, "0123456789", 10, 0) != 10 || send(c, "z", 1, 0) != 1)
+    die("unixstream: seqpacket send failed");
+  if (recv(s, got, sizeof(got), 0) != 3 || memcmp(got, "abc", 3))
+    die("unixstream: first seqpacket wrong");
+  if (recv(s, got, sizeof(got), 0) != 5 || memcmp(got, "defgh", 5))
+    die("unixstream: second seqpacket wrong");
+  if (recv(s, got, 4, 0) != 4 || memcmp(got, "0123", 4))
+    die("unixstream: truncated seqpacket wrong");
+  if (recv(s, got, sizeof(got), 0) != 1 || got[0] != 'z')
+    die("unixstream: seqpacket after truncation wrong");
+  close(c);
+  if (recv(s, got, sizeof(got), 0) != 0)
+    die("unixstream: no EOF after peer closed");
+
+  close(s);
+  close(l2);
+  unlink("ustream.sock");
+  unlink("useqpkt.sock");
+
+  printf("unix stream socket test ok\n");
+}
+
+// Send fd over sock with one byte of data.  Returns sendmsg's result.
+static ssize_t
+sendfd(int sock, int fd)
+{
+  char ctl[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { (void*)"f", 1 };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = sizeof(ctl);
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_len = CMSG_LEN(sizeof(int));
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  memmove(CMSG_DATA(c), &fd, sizeof(int));
+  return sendmsg(sock, &msg, 0);
+}
+
+void
+scmrights(void)
+{
+  char got[16];
+  char ctl[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { got, sizeof(got) };
+  struct msghdr msg;
+  int c, s, l;
+
+  printf("SCM_RIGHTS test\n");
+
+  l = unixpair(SOCK_STREAM, "uscm.sock", &c, &s);
+
+  // A passed file shares its open file description with the sender's.
+  unlink("scm.x");
+  int fd = open("scm.x", O_CREAT|O_RDWR, 0666);
+  if (fd < 0 || write(fd, "passed", 6) != 6)
+    die("scmrights: create failed");
+  if (sendfd(c, fd) != 1)
+    die("scmrights: sendmsg failed");
+  close(fd);
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = sizeof(ctl);
+  if (recvmsg(s, &msg, 0) != 1 || got[0] != 'f')
+    die("scmrights: recvmsg failed");
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS ||
+      cm->cmsg_len != CMSG_LEN(sizeof(int)) || (msg.msg_flags & MSG_CTRUNC))
+    die("scmrights: no file received");
+  memmove(&fd, CMSG_DATA(cm), sizeof(int));
+  if (write(fd, "!", 1) != 1)
+    die("scmrights: write to passed file failed");
+  if (pread(fd, got, 7, 0) != 7 || memcmp(got, "passed!", 7))
+    die("scmrights: passed file has wrong data");
+  close(fd);
+
+  // A socket can't be passed, since it could end up holding itself.
+  if (sendfd(c, c) >= 0 || sendfd(c, s) >= 0 || sendfd(c, l) >= 0)
+    die("scmrights: passing a socket succeeded");
+
+  // Bad descriptors fail the whole send.
+  if (sendfd(c, 1000) >= 0)
+    die("scmrights: passing a bad fd succeeded");
+
+  close(c);
+  close(s);
+  close(l);
+  unlink("uscm.sock");
+  unlink("scm.x");
+
+  printf("SCM_RIGHTS test ok\n");
+}
+
+void
+ringtest(void)
+{
+  enum { slotsize = 64, nslots = 8, nmsgs = 1000 };
+  char msg[slotsize + 1];
+  struct ring r, r2;
+
+  printf("ring test\n");
+
+  int fd = ring_create(slotsize, nslots, 0);
+  if (fd < 0)
+    die("ringtest: ring_create failed");
+  if (ring_create(slotsize, 3, 0) >= 0 || ring_create(0, nslots, 0) >= 0)
+    die("ringtest: ring_create of bad geometry succeeded");
+  if (ring_map(&r, fd) < 0)
+    die("ringtest: ring_map failed");
+
+  // Messages that don't fit fail, and so does sending to a full ring
+  // or receiving from an empty one without waiting.
+  if (ring_send(&r, msg, slotsize + 1, 0) >= 0)
+    die("ringtest: oversized send succeeded");
+  if (ring_recv(&r, msg, sizeof(msg), RING_NONBLOCK) >= 0)
+    die("ringtest: receive from empty ring succeeded");
+  for (int i = 0; i < nslots; i++)
+    if (ring_send(&r, &i, sizeof(i), RING_NONBLOCK) < 0)
+      die("ringtest: send %d failed", i);
+  if (ring_send(&r, msg, 1, RING_NONBLOCK) >= 0)
+    die("ringtest: send to full ring succeeded");
+  for (int i = 0; i < nslots; i++) {
+    int v;
+    if (ring_recv(&r, &v, sizeof(v), RING_NONBLOCK) != sizeof(v) || v != i)
+      die("ringtest: receive %d failed", i);
+  }
+
+  // A child sends through the shared mapping while we receive, with
+  // both sides sleeping on the ring when they need to.
+  int pid = fork();
+  if (pid < 0)
+    die("ringtest: fork failed");
+  if (pid == 0) {
+    for (int i = 0; i < nmsgs; i++) {
+      int len = i % slotsize + 1;
+      memset(msg, i, len);
+      if (ring_send(&r, msg, len, 0) < 0)
+        die("ringtest: child send failed");
+    }
+    exit(0);
+  }
+  for (int i = 0; i < nmsgs; i++) {
+    int len = i % slotsize + 1;
+    if (ring_recv(&r, msg, sizeof(msg), 0) != len)
+      die("ringtest: message %d has wrong length", i);
+    for (int j = 0; j < len; j++)
+      if (msg[j] != (char)i)
+        die("ringtest: message %d has wrong data", i);
+  }
+  wait(NULL);
+
+  // A header someone else scribbled on doesn't map.
+  u64 nslots0 = r.hdr->nslots;
+  r.hdr->nslots = 3;
+  if (ring_map(&r2, fd) == 0)
+    die("ringtest: ring with bad header mapped");
+  r.hdr->nslots = nslots0;
+
+  ring_unmap(&r);
+  close(fd);
+
+  printf("ring test ok\n");
+}
+
+// Queue an SQE on the uring mapped at h.
+static void
+uring_queue(struct uring_header *h, int opcode, int fd, void *addr,
+            u32 len, u64 off, u64 user_data)
+{
+  struct uring_sqe *s = URING_SQE(h, h->sq_tail);
+  memset(s, 0, sizeof(*s));
+  s->opcode = opcode;
+  s->fd = fd;
+  s->addr = (u64)addr;
+  s->len = len;
+  s->off = off;
+  s->user_data = user_data;
+  __atomic_store_n(&h->sq_tail, h->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+// Consume the next CQE, which should be for user_data, and return its
+// result.
+static s64
+uring_reap(struct uring_header *h, u64 user_data)
+{
+  if (__atomic_load_n(&h->cq_tail, __ATOMIC_ACQUIRE) == h->cq_head)
+    die("uringtest: no completion for %lu", user_data);
+  struct uring_cqe *c = URING_CQE(h, h->cq_head);
+  if (c->user_data != user_data)
+    die("uringtest: completion for %lu, wanted %lu", c->user_data, user_data);
+  s64 res = c->res;
+  __atomic_store_n(&h->cq_head, h->cq_head + 1, __ATOMIC_RELEASE);
+  return res;
+}
+
+void
+uringtest(void)
+{
+  enum { entries = 8 };
+  char wbuf[] = "uring data", rbuf[sizeof(wbuf)];
+  struct stat st;
+  int fds[2];
+
+  printf("uring test\n");
+
+  if (uring_setup(3, 0) >= 0)
+    die("uringtest: uring_setup with bad size succeeded");
+  int ufd = uring_setup(entries, 0);
+  if (ufd < 0)
+    die("uringtest: uring_setup failed");
+  struct uring_header *h = (struct uring_header*)
+    mmap(0, URING_SIZE(entries), PROT_READ|PROT_WRITE, MAP_SHARED, ufd, 0);
+  if (h == MAP_FAILED)
+    die("uringtest: mmap failed");
+  if (h->magic != URING_MAGIC || h->sq_entries != entries ||
+      h->cq_entries != 2 * entries)
+    die("uringtest: bad header");
+  if (uring_enter(ufd, 0, 0, ~URING_ENTER_ASYNC) >= 0 ||
+      uring_enter(ufd, 0, 2 * entries + 1, 0) >= 0)
+    die("uringtest: uring_enter with bad arguments succeeded");
+
+  unlink("uring.x");
+  int fd = open("uring.x", O_CREAT|O_RDWR, 0666);
+  if (fd < 0)
+    die("uringtest: open failed");
+
+  // A batch runs in order in one uring_enter.
+  memset(rbuf, 0, sizeof(rbuf));
+  uring_queue(h, URING_OP_NOP, -1, nullptr, 0, 0, 1);
+  uring_queue(h, URING_OP_PWRITE, fd, wbuf, sizeof(wbuf), 100, 2);
+  uring_queue(h, URING_OP_PREAD, fd, rbuf, sizeof(rbuf), 100, 3);
+  uring_queue(h, URING_OP_FSTAT, fd, &st, 0, 0, 4);
+  if (uring_enter(ufd, 4, 4, 0) != 4)
+    die("uringtest: uring_enter failed");
+  if (uring_reap(h, 1) != 0 ||
+      uring_reap(h, 2) != sizeof(wbuf) ||
+      uring_reap(h, 3) != sizeof(rbuf) ||
+      uring_reap(h, 4) != 0)
+    die("uringtest: batch failed");
+  if (memcmp(rbuf, wbuf, sizeof(wbuf)) || st.st_size != 100 + sizeof(wbuf))
+    die("uringtest: batch got wrong results");
+
+  // Async batches run file I/O on a worker, but fail anything that
+  // could leave the worker waiting, like reading an empty pipe.
+  if (pipe(fds) < 0)
+    die("uringtest: pipe failed");
+  memset(rbuf, 0, sizeof(rbuf));
+  uring_queue(h, URING_OP_PREAD, fd, rbuf, sizeof(rbuf), 100, 5);
+  uring_queue(h, URING_OP_READ, fds[0], rbuf, 1, 0, 6);
+  if (uring_enter(ufd, 2, 2, URING_ENTER_ASYNC) != 2)
+    die("uringtest: async uring_enter failed");
+  if (uring_reap(h, 5) != sizeof(rbuf) || memcmp(rbuf, wbuf, sizeof(wbuf)))
+    die("uringtest: async pread failed");
+  if (uring_reap(h, 6) != -1)
+    die("uringtest: async read of a pipe didn't fail");
+
+  close(fds[0]);
+  close(fds[1]);
+  munmap(h, URING_SIZE(entries));
+  close(ufd);
+  close(fd);
+  unlink("uring.x");
+
+  printf("uring test ok\n");
+}
+
+void
+syscallvtest(void)
+{
+  char wbuf[] = "syscallv data", rbuf[sizeof(wbuf)];
+  struct stat st;
+
+  printf("syscallv test\n");
+
+  unlink("syscallv.x");
+
+  // Create, write, and close a file in one trap, feeding the new fd
+  // to the later records.
+  struct syscall_rec create[3] = {
+    { SYS_openat, SYSCALLV_STOP,
+      { (unsigned long)AT_FDCWD, (unsigned long)"syscallv.x",
+        O_CREAT | O_RDWR, 0666 } },
+    { SYS_write, SYSCALLV_ARG(0, 1),
+      { 0, (unsigned long)wbuf, sizeof(wbuf) } },
+    { SYS_close, SYSCALLV_ARG(0, 2), { 0 } },
+  };
+  if (syscallv(create, 3, 0) != 3)
+    die("syscallvtest: create batch failed");
+  if (create[0].ret < 0 || create[1].ret != sizeof(wbuf) || create[2].ret != 0)
+    die("syscallvtest: create batch returned %ld %ld %ld",
+        create[0].ret, create[1].ret, create[2].ret);
+
+  memset(rbuf, 0, sizeof(rbuf));
+  struct syscall_rec check[4] = {
+    { SYS_openat, SYSCALLV_STOP,
+      { (unsigned long)AT_FDCWD, (unsigned long)"syscallv.x", O_RDONLY } },
+    { SYS_pread, SYSCALLV_ARG(0, 1),
+      { 0, (unsigned long)rbuf, sizeof(rbuf), 0 } },
+    { SYS_fstatx, SYSCALLV_ARG(0, 2), { 0, (unsigned long)&st, 0 } },
+    { SYS_close, SYSCALLV_ARG(0, 3), { 0 } },
+  };
+  if (syscallv(check, 4, 0) != 4 || check[1].ret != sizeof(rbuf) ||
+      check[2].ret != 0 || check[3].ret != 0)
+    die("syscallvtest: check batch failed");
+  if (memcmp(rbuf, wbuf, sizeof(wbuf)) || st.st_size != sizeof(wbuf))
+    die("syscallvtest: check batch got wrong results");
+
+  // A failed SYSCALLV_STOP record ends the batch.
+  check[0].args[1] = (unsigned long)"syscallv.nonexistent";
+  check[1].ret = 12345;
+  if (syscallv(check, 4, 0) != 1 || check[0].ret >= 0 || check[1].ret != 12345)
+    die("syscallvtest: SYSCALLV_STOP didn't stop the batch");
+
+  // Without it, the batch keeps going, unless SYSCALLV_STOP_ON_ERROR.
+  struct syscall_rec closes[2] = {
+    { SYS_close, 0, { 1000 } },
+    { SYS_getpid, 0, { 0 } },
+  };
+  if (syscallv(closes, 2, 0) != 2 || closes[0].ret >= 0 ||
+      closes[1].ret != getpid())
+    die("syscallvtest: batch stopped without SYSCALLV_STOP");
+  if (syscallv(closes, 2, SYSCALLV_STOP_ON_ERROR) != 1)
+    die("syscallvtest: SYSCALLV_STOP_ON_ERROR didn't stop the batch");
+
+  // Nested batches, references to records before the batch, and
+  // oversized batches are rejected.
+  struct syscall_rec bad[2] = {
+    { SYS_getpid, 0, { 0 } },
+    { SYS_syscallv, 0, { (unsigned long)closes, 2, 0 } },
+  };
+  if (syscallv(bad, 2, 0) != 1)
+    die("syscallvtest: nested syscallv ran");
+  bad[1].num = SYS_close;
+  bad[1].flags = SYSCALLV_ARG(0, 2);
+  if (syscallv(bad, 2, 0) != 1)
+    die("syscallvtest: SYSCALLV_ARG past the start of the batch ran");
+  if (syscallv(bad, SYSCALLV_MAX + 1, 0) >= 0 || syscallv(bad, 1, 0x100) >= 0)
+    die("syscallvtest: syscallv with bad arguments succeeded");
+
+  unlink("syscallv.x");
+
+  printf("syscallv test ok\n");
+}
+
+void
+clocktest(void)
+{
+  printf("clocktest\n");
+
+  // Stay on one CPU so this only tests re-anchoring, not TSC skew
+  // between CPUs.
+  int pid = fork();
+  if (pid < 0)
+    die("clocktest: fork");
+  if (pid == 0) {
+    setaffinity(0);
+    // The kernel re-anchors the clock page about once a second.
+    uint64_t start = uptime(), prev = start, prevwall = time_nsec();
+    while (prev - start < 3500000000ull) {
+      uint64_t now = uptime(), wall = time_nsec();
+      if (now < prev)
+        die("clocktest: uptime went back %lu -> %lu", prev, now);
+      if (wall < prevwall)
+        die("clocktest: time_nsec went back %lu -> %lu", prevwall, wall);
+      prev = now;
+      prevwall = wall;
+    }
+
+    // The page should agree with the kernel's own clock.
+    uint64_t page = uptime(), sys = uptime_syscall();
+    if (page > sys + 250000000ull || sys > page + 250000000ull)
+      die("clocktest: clock page %lu, uptime syscall %lu", page, sys);
+    exit(0);
+  }
+
+  int status;
+  wait(&status);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    die("clocktest: child failed");
+
+  printf("clocktest ok\n");
+}
+
+// Check that dst[0, n) matches src and that the guard bytes around it
+// weren't touched.
+static void
+check_copy(const char *what, const u8 *dst, const u8 *src, size_t n,
+           size_t guard)
+{
+  for (size_t i = 0; i < n; i++)
+    if (dst[i] != src[i])
+      die("pageopstest: %s: byte %lu of %lu differs", what, i, n);
+  for (size_t i = 1; i <= guard; i++)
+    if (dst[-(ssize_t)i] != 0xee || dst[n + i - 1] != 0xee)
+      die("pageopstest: %s: wrote outside %lu bytes", what, n);
+}
+
+void
+pageopstest(void)
+{
+  enum { PG = PAGEOPS_BYTES };
+  printf("pageopstest\n");
+
+  u8 *buf = (u8*)mmap(0, 4 * PG, PROT_READ|PROT_WRITE,
+                      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    die("pageopstest: mmap failed");
+  u8 *src = buf, *dst = buf + 2 * PG;
+  for (int i = 0; i < PG; i++)
+    src[i] = i * 7 + 3;
+
+  // Every implementation this CPU supports, and the dispatchers, must
+  // fill exactly one page and leave its neighbors alone.
+  for (int i = -1; i < pageops_nimpls; i++) {
+    pageops_impl impl = { "dispatch", nullptr, zero_page, copy_page };
+    if (i >= 0)
+      impl = pageops_impls[i];
+    if (impl.supported && !impl.supported())
+      continue;
+    memset(dst - PG, 0xee, 3 * PG);
+    impl.copy(dst, src);
+    check_copy(impl.name, dst, src, PG, PG);
+    impl.zero(dst);
+    static const u8 zeroes[PG] = {};
+    check_copy(impl.name, dst, zeroes, PG, PG);
+  }
+  zero_page_nt(dst);
+  copy_page_nt(dst, src);
+  check_copy("copy_page_nt", dst, src, PG, PG);
+
+  // Small and odd-sized copies through the kernel, at every
+  // alignment of the user buffers.  These take the word-at-a-time
+  // and overlapping-store paths in the kernel's copy routines.
+  int fd = open("pageops.x", O_CREAT|O_RDWR|O_TRUNC, 0666);
+  if (fd < 0)
+    die("pageopstest: open failed");
+  static const size_t sizes[] = {
+    0, 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100,
+    PG - 1, PG, PG + 1, PG + 33,
+  };
+  for (size_t n : sizes) {
+    for (int a = 0; a < 8; a++) {
+      int b = (a * 3 + 1) % 8;
+      if (pwrite(fd, src + a, n, a + 1) != (ssize_t)n)
+        die("pageopstest: pwrite of %lu failed", n);
+      u8 *d = dst + b;
+      memset(dst - 16, 0xee, 2 * PG);
+      if (pread(fd, d, n, a + 1) != (ssize_t)n)
+        die("pageopstest: pread of %lu failed", n);
+      check_copy("pread", d, src + a, n, 8);
+    }
+  }
+  close(fd);
+  unlink("pageops.x");
+
+  // Same through a pipe, where the kernel copies between its buffer
+  // and ours at odd offsets.
+  int fds[2];
+  if (pipe(fds) < 0)
+    die("pageopstest: pipe failed");
+  for (size_t n : sizes) {
+    if (n == 0 || n > 512)
+      continue;
+    for (int a = 0; a < 8; a++) {
+      if (write(fds[1], src + a, n) != (ssize_t)n)
+        die("pageopstest: pipe write of %lu failed", n);
+      u8 *d = dst + (a + 5) % 8;
+      memset(dst - 16, 0xee, 2 * PG);
+      for (size_t got = 0; got < n; ) {
+        ssize_t r = read(fds[0], d + got, n - got);
+        if (r <= 0)
+          die("pageopstest: pipe read failed");
+        got += r;
+      }
+      check_copy("pipe", d, src + a, n, 8);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // Copy-on-write faults fill the new page with copy_page.
+  memcpy(dst, src, PG);
+  int pid = fork();
+  if (pid < 0)
+    die("pageopstest: fork failed");
+  if (pid == 0) {
+    dst[100] ^= 0xff;
+    dst[100] ^= 0xff;
+    exit(memcmp(dst, src, PG) == 0 ? 0 : 1);
+  }
+  int status;
+  wait(&status);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    die("pageopstest: copy-on-write page differs");
+
+  munmap(buf, 4 * PG);
+  printf("pageopstest ok\n");
+}
+
 static int nenabled;
 static char **enabled;
 
@@ -2086,6 +3584,7 @@ main(int argc, char *argv[])
 
   TEST(validatetest);
   TEST(sigtest);
+  TEST(sigsystest);
 
   TEST(opentest);
   TEST(writetest);
@@ -2118,12 +3617,30 @@ main(int argc, char *argv[])
   TEST(thrtest);
   TEST(ftabletest);
   TEST(renametest);
+  TEST(getdentstest);
 
   TEST(floattest);
+  TEST(fputest);
+  TEST(schedtest);
   TEST(writeprotecttest);
 
   TEST(cloexec);
 
+  TEST(sparsetest);
+
+  TEST(appendtest);
+  TEST(pagingtest);
+  TEST(fadvisetest);
+  TEST(splicetest);
+  TEST(pipeatomic);
+  TEST(pipeanyorder);
+  TEST(unixstream);
+  TEST(scmrights);
+  TEST(ringtest);
+  TEST(uringtest);
+  TEST(syscallvtest);
+  TEST(clocktest);
+  TEST(pageopstest);
   TEST(exectest);               // Must be last
 
   return 0;
@@ -28,6 +28,12 @@ public:
     send_ipi(c, T_TLBFLUSH);
   }
 
+  // Send a T_RESCHED IPI to a remote CPU
+  void send_resched(struct cpu *c)
+  {
+    send_ipi(c, T_RESCHED);
+  }
+
   // Send a T_SAMPCONF IPI to a remote CPU
   void send_sampconf(struct cpu *c)
   {
@@ -7,6 +7,7 @@
 #include "atomic_util.hh"
 #include "lockwrap.hh"
 #include "weakcache.hh"
+#include "ilist.hh"
 
 class buf : public refcache::weak_referenced {
 public:
@@ -52,6 +53,9 @@ public:
     return buf_writer(&data_, &write_lock_, &seq_, this);
   }
 
+  // Link for the reclaim clock.
+  ilink<buf> clock_link_;
+
 private:
   const u32 dev_;
   const u64 block_;
@@ -61,11 +65,23 @@ private:
   sleeplock writeback_lock_;
   std::atomic<bool> dirty_;
 
+  // The cache holds a reference to a buf, and keeps it on the reclaim
+  // clock of clock_node_, while cached_ is set.  The reclaim clock
+  // clears cached_ to drop a buf that hasn't been referenced since
+  // the clock last passed it.  clock_node_ and referenced_ are
+  // protected by the clock's lock while the buf is on the clock.
+  std::atomic<bool> cached_;
+  std::atomic<bool> referenced_;
+  int clock_node_;
+
   bufdata data_;
 
   buf(u32 dev, u64 block)
-    : dev_(dev), block_(block), dirty_(false) {}
+    : dev_(dev), block_(block), dirty_(false), cached_(false),
+      referenced_(false), clock_node_(0) {}
   void onzero() override;
+  void cache();
+  friend struct buf_shrinker;
   NEW_DELETE_OPS(buf);
 
   void mark_dirty() {
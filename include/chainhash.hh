@@ -1,7 +1,21 @@
 #pragma once
 
 /*
- * A bucket-chaining hash table.
+ * A bucket-chaining hash table that resizes itself online.
+ *
+ * Tables start small and double when a chain gets long, or halve
+ * when the table looks mostly empty, so memory follows the number of
+ * items.  Resizing is incremental: while a resize is in progress the
+ * old table links to the new one, and each update moves a few
+ * buckets' items across.  A migrated bucket is never modified again,
+ * and readers and writers that find one follow the link to the new
+ * table.  Lookups are lock-free and run in a gc epoch.  Old tables
+ * are freed through gc.
+ *
+ * The bucket index is the top bits of a multiplicatively mixed hash.
+ * When a table doubles, bucket i splits into buckets 2i and 2i+1.  So
+ * iteration in (hash, key) order is the same whatever the table size
+ * is, and enumerate works across resizes.
  */
 
 #include "spinlock.hh"
@@ -9,26 +23,48 @@
 #include "lockwrap.hh"
 #include "hash.hh"
 #include "ilist.hh"
+#include "log2.hh"
 
 template<class K, class V>
 class chainhash {
 private:
+  enum {
+    // Smallest and largest table sizes, as log2(buckets).
+    min_bits = 2,
+    max_bits = 20,
+    // Grow when an insert makes a chain longer than this.
+    max_chain = 4,
+    // Shrink when a remove empties a bucket and this many buckets
+    // after it are also empty.
+    shrink_sample = 8,
+    // Buckets to migrate per update while resizing.
+    migrate_batch = 8,
+  };
+
   struct item : public rcu_freed {
-    item(const K& k, const V& v)
+    item(const K& k, const V& v, u64 h)
       : rcu_freed("chainhash::item", this, sizeof(*this)),
-        key(k), val(v) {}
+        hash(h), key(k), val(v) {}
     void do_gc() override { delete this; }
     NEW_DELETE_OPS(item);
 
     islink<item> link;
     seqcount<u32> seq;
+    const u64 hash;
     const K key;
     V val;
   };
 
+  typedef islist<item, &item::link> chain_t;
+
   struct bucket {
     spinlock lock __mpalign__;
-    islist<item, &item::link> chain;
+    chain_t chain;
+    // Set once this bucket's items have been copied to the next
+    // table.  After that, the bucket is never modified.
+    std::atomic<bool> migrated;
+
+    bucket() : migrated(false) {}
 
     ~bucket() {
       while (!chain.empty()) {
@@ -39,18 +75,176 @@ private:
     }
   };
 
-  u64 nbuckets_;
+  struct table : public rcu_freed {
+    table(int bits, bucket* buckets)
+      : rcu_freed("chainhash::table", this, sizeof(*this)),
+        bits(bits), nbuckets(1ull << bits), buckets(buckets),
+        next(nullptr), migrate_pos(0) {}
+    ~table() { delete[] buckets; }
+    void do_gc() override { delete this; }
+    NEW_DELETE_OPS(table);
+
+    static table* alloc(int bits) {
+      bucket* b = new (std::nothrow) bucket[1ull << bits];
+      if (!b)
+        return nullptr;
+      table* t = new (std::nothrow) table(bits, b);
+      if (!t)
+        delete[] b;
+      return t;
+    }
+
+    u64 index(u64 h) const { return h >> (64 - bits); }
+    bucket* get(u64 h) const { return &buckets[index(h)]; }
+
+    const int bits;
+    const u64 nbuckets;
+    bucket* const buckets;
+    // The table this one is being resized into, or null.
+    std::atomic<table*> next;
+    // The next bucket to migrate.  Protected by resize_lock_.
+    u64 migrate_pos;
+  };
+
+  std::atomic<table*> cur_;
+  spinlock resize_lock_;
   bool dead_;
-  bucket* buckets_;
+
+  static u64 hash_of(const K& k) {
+    return hash(k) * 0x9e3779b97f4a7c15ull;
+  }
+
+  // Return the bucket that currently holds h, following resize links
+  // past migrated buckets.  Caller must be in a gc epoch.
+  bucket* find_bucket(u64 h, table** tp = nullptr) const {
+    table* t = cur_;
+    for (;;) {
+      bucket* b = t->get(h);
+      if (!b->migrated) {
+        if (tp)
+          *tp = t;
+        return b;
+      }
+      t = t->next;
+    }
+  }
+
+  // Lock and return the bucket that holds h.  Caller must be in a gc
+  // epoch.
+  bucket* lock_bucket(u64 h, scoped_acquire* l, table** tp) {
+    for (;;) {
+      bucket* b = find_bucket(h, tp);
+      *l = b->lock.guard();
+      if (!b->migrated)
+        return b;
+      l->release();
+    }
+  }
+
+  // Begin resizing t to 2^bits buckets, unless something else is
+  // already resizing.  Caller must be in a gc epoch.
+  void start_resize(table* t, int bits) {
+    auto l = resize_lock_.try_guard();
+    if (!l || dead_ || t != cur_ || t->next)
+      return;
+    table* nt = table::alloc(bits);
+    if (!nt)
+      return;
+    t->next = nt;
+    migrate_locked(migrate_batch);
+  }
+
+  // Continue an in-progress resize, if there is one and nobody else
+  // is working on it.
+  void migrate() {
+    if (!cur_.load()->next)
+      return;
+    auto l = resize_lock_.try_guard();
+    if (l)
+      migrate_locked(migrate_batch);
+  }
+
+  // Copy up to n groups of buckets from the current table to the
+  // next table and retire the current table once it is fully
+  // migrated.  A group is the set of old buckets that feed a set of
+  // new buckets: one old bucket when growing, two when shrinking.
+  // No writer can reach a new bucket until its whole group has been
+  // migrated, so we fill new buckets without locking them.  Caller
+  // must hold resize_lock_.
+  void migrate_locked(u64 n) {
+    table* old = cur_;
+    table* nt = old->next;
+    if (!nt)
+      return;
+    u64 group = nt->bits > old->bits ? 1 : 2;
+
+    for (; n && old->migrate_pos < old->nbuckets; n--) {
+      bucket* first = &old->buckets[old->migrate_pos];
+      scoped_acquire l0 = first[0].lock.guard(), l1;
+      if (group == 2)
+        l1 = first[1].lock.guard();
+
+      // Copy the group's items aside first so an allocation failure
+      // leaves everything as it was.
+      chain_t copies;
+      for (u64 g = 0; g < group; g++) {
+        for (const item& i: first[g].chain) {
+          item* c = new (std::nothrow) item(i.key, i.val, i.hash);
+          if (!c) {
+            while (!copies.empty()) {
+              item* x = &copies.front();
+              copies.pop_front();
+              delete x;
+            }
+            return;
+          }
+          copies.push_front(c);
+        }
+      }
+      while (!copies.empty()) {
+        item* c = &copies.front();
+        copies.pop_front();
+        nt->get(c->hash)->chain.push_front(c);
+      }
+      for (u64 g = 0; g < group; g++)
+        first[g].migrated = true;
+      old->migrate_pos += group;
+    }
+
+    if (old->migrate_pos == old->nbuckets) {
+      cur_ = nt;
+      gc_delayed(old);
+    }
+  }
+
+  // Called after removing from the empty bucket b of t.  If the
+  // neighboring buckets are empty too, the table is probably sparse.
+  void maybe_shrink(table* t, bucket* b) {
+    if (t->bits <= min_bits || t->next)
+      return;
+    u64 idx = b - t->buckets;
+    for (u64 i = 1; i <= shrink_sample; i++)
+      if (!t->buckets[(idx + i) % t->nbuckets].chain.empty())
+        return;
+    start_resize(t, t->bits - 1);
+  }
 
 public:
-  chainhash(u64 nbuckets) : nbuckets_(nbuckets), dead_(false) {
-    buckets_ = new bucket[nbuckets_];
-    assert(buckets_);
+  chainhash(u64 nbuckets = 1 << min_bits) : resize_lock_("chainhash"),
+                                            dead_(false) {
+    int bits = ceil_log2(nbuckets);
+    if (bits < min_bits)
+      bits = min_bits;
+    table* t = table::alloc(bits);
+    assert(t);
+    cur_ = t;
   }
 
   ~chainhash() {
-    delete[] buckets_;
+    table* t = cur_;
+    if (t->next)
+      delete t->next.load();
+    delete t;
   }
 
   NEW_DELETE_OPS(chainhash);
@@ -59,17 +253,34 @@ public:
     if (dead_ || lookup(k))
       return false;
 
-    bucket* b = &buckets_[hash(k) % nbuckets_];
-    scoped_acquire l(&b->lock);
+    scoped_gc_epoch rcu_read;
+    u64 h = hash_of(k);
+    table* t;
+    bool grow = false;
+    {
+      scoped_acquire l;
+      bucket* b = lock_bucket(h, &l, &t);
+
+      if (dead_)
+        return false;
 
-    if (dead_)
-      return false;
+      u64 len = 0;
+      bool split = false;
+      for (const item& i: b->chain) {
+        if (i.key == k)
+          return false;
+        len++;
+        split |= (i.hash != h);
+      }
 
-    for (const item& i: b->chain)
-      if (i.key == k)
-        return false;
+      b->chain.push_front(new item(k, v, h));
+      grow = len >= max_chain && split && t->bits < max_bits;
+    }
 
-    b->chain.push_front(new item(k, v));
+    if (grow)
+      start_resize(t, t->bits + 1);
+    else
+      migrate();
     return true;
   }
 
@@ -77,22 +288,32 @@ public:
     if (!lookup(k))
       return false;
 
-    bucket* b = &buckets_[hash(k) % nbuckets_];
-    scoped_acquire l(&b->lock);
-
-    auto i = b->chain.before_begin();
-    auto end = b->chain.end();
-    for (;;) {
-      auto prev = i;
-      ++i;
-      if (i == end)
-        return false;
-      if (i->key == k && i->val == v) {
-        b->chain.erase_after(prev);
-        gc_delayed(&*i);
-        return true;
+    scoped_gc_epoch rcu_read;
+    table* t;
+    bucket* b;
+    {
+      scoped_acquire l;
+      b = lock_bucket(hash_of(k), &l, &t);
+
+      auto i = b->chain.before_begin();
+      auto end = b->chain.end();
+      for (;;) {
+        auto prev = i;
+        ++i;
+        if (i == end)
+          return false;
+        if (i->key == k && i->val == v) {
+          b->chain.erase_after(prev);
+          gc_delayed(&*i);
+          break;
+        }
       }
     }
+
+    if (b->chain.empty())
+      maybe_shrink(t, b);
+    migrate();
+    return true;
   }
 
   bool replace_from(const K& kdst, const V* vpdst,
@@ -109,18 +330,28 @@ public:
      *  - removes src[ksrc]
      *  - sets this[kdst] = vsrc
      */
-    bucket* bdst = &buckets_[hash(kdst) % nbuckets_];
-    bucket* bsrc = &src->buckets_[hash(ksrc) % src->nbuckets_];
+    scoped_gc_epoch rcu_read;
+    u64 hdst = hash_of(kdst), hsrc = hash_of(ksrc);
+    bucket* bdst;
+    bucket* bsrc;
 
     scoped_acquire lsrc, ldst;
-    if (bsrc == bdst) {
-      lsrc = bsrc->lock.guard();
-    } else if (bsrc < bdst) {
-      lsrc = bsrc->lock.guard();
-      ldst = bdst->lock.guard();
-    } else {
-      ldst = bdst->lock.guard();
-      lsrc = bsrc->lock.guard();
+    for (;;) {
+      bdst = find_bucket(hdst);
+      bsrc = src->find_bucket(hsrc);
+      if (bsrc == bdst) {
+        lsrc = bsrc->lock.guard();
+      } else if (bsrc < bdst) {
+        lsrc = bsrc->lock.guard();
+        ldst = bdst->lock.guard();
+      } else {
+        ldst = bdst->lock.guard();
+        lsrc = bsrc->lock.guard();
+      }
+      if (!bdst->migrated && !bsrc->migrated)
+        break;
+      lsrc.release();
+      ldst.release();
     }
 
     auto srci = bsrc->chain.before_begin();
@@ -143,7 +374,7 @@ public:
       if (i.key == kdst) {
         if (vpdst == nullptr || i.val != *vpdst)
           return false;
-        auto w = i.seq.write_begin(); 
+        auto w = i.seq.write_begin();
         i.val = vsrc;
         bsrc->chain.erase_after(srcprev);
         gc_delayed(&*srci);
@@ -156,35 +387,122 @@ public:
 
     bsrc->chain.erase_after(srcprev);
     gc_delayed(&*srci);
-    bdst->chain.push_front(new item(kdst, vsrc));
+    bdst->chain.push_front(new item(kdst, vsrc, hdst));
     return true;
   }
 
+  // Find the key after *prev (or the first key if prev is null) in
+  // (hash, key) order.
   bool enumerate(const K* prev, K* out) const {
     scoped_gc_epoch rcu_read;
 
-    bool prevbucket = (prev != nullptr);
-    for (u64 i = prev ? hash(*prev) % nbuckets_ : 0; i < nbuckets_; i++) {
-      bucket* b = &buckets_[i];
-      bool found = false;
+    u64 hprev = prev ? hash_of(*prev) : 0;
+    u64 pos = hprev;
+    for (;;) {
+      table* t;
+      bucket* b = find_bucket(pos, &t);
+      const item* best = nullptr;
       for (const item& i: b->chain) {
-        if ((!prevbucket || *prev < i.key) && (!found || i.key < *out)) {
-          *out = i.key;
-          found = true;
-        }
+        if (prev && (i.hash < hprev || (i.hash == hprev && !(*prev < i.key))))
+          continue;
+        if (!best || i.hash < best->hash ||
+            (i.hash == best->hash && i.key < best->key))
+          best = &i;
       }
-      if (found)
+      if (best) {
+        *out = best->key;
         return true;
-      prevbucket = false;
+      }
+
+      // Move to the first hash value of the next bucket.
+      u64 idx = t->index(pos);
+      if (idx + 1 == t->nbuckets)
+        return false;
+      pos = (idx + 1) << (64 - t->bits);
     }
+  }
 
-    return false;
+  // Call fn(key, val) for each key after *prev (or from the first
+  // key if prev is null) in enumerate order, until fn returns false.
+  // Unlike calling enumerate repeatedly, this finds each bucket once.
+  // Returns true if it reached the end of the table.  fn runs in a gc
+  // epoch, so it must not block.
+  template<class F>
+  bool enumerate_from(const K* prev, F fn) const {
+    enum { batch = 16 };
+    scoped_gc_epoch rcu_read;
+
+    // The last item we emitted, or null to start with the first
+    // item after *prev.  The gc epoch keeps it valid even if it's
+    // removed.
+    const item* last = nullptr;
+    u64 hprev = prev ? hash_of(*prev) : 0;
+    u64 pos = hprev;
+    for (;;) {
+      table* t;
+      bucket* b = find_bucket(pos, &t);
+
+      // Collect the smallest qualifying items in this bucket in
+      // order.  Buckets are short, so insertion sort is fine.
+      const item* sorted[batch];
+      int n = 0;
+      bool more = false;
+      for (const item& i: b->chain) {
+        // If the table shrank under us, this bucket also covers hash
+        // values we've already passed, so skip everything before pos
+        // and up to the last item we emitted.
+        if (i.hash < pos)
+          continue;
+        if (last) {
+          if (i.hash < last->hash ||
+              (i.hash == last->hash && !(last->key < i.key)))
+            continue;
+        } else if (prev && (i.hash < hprev ||
+                            (i.hash == hprev && !(*prev < i.key)))) {
+          continue;
+        }
+        int j = n;
+        while (j > 0 && (i.hash < sorted[j-1]->hash ||
+                         (i.hash == sorted[j-1]->hash &&
+                          i.key < sorted[j-1]->key)))
+          j--;
+        if (j == batch) {
+          more = true;
+          continue;
+        }
+        if (n == batch) {
+          more = true;
+          n--;
+        }
+        for (int k = n; k > j; k--)
+          sorted[k] = sorted[k-1];
+        sorted[j] = &i;
+        n++;
+      }
+
+      for (int k = 0; k < n; k++) {
+        if (!fn(sorted[k]->key, *seq_reader<V>(&sorted[k]->val,
+                                               &sorted[k]->seq)))
+          return false;
+        last = sorted[k];
+      }
+
+      // If the bucket had more than we could sort at once, go around
+      // again starting after the last item.
+      if (more)
+        continue;
+
+      u64 idx = t->index(pos);
+      if (idx + 1 == t->nbuckets)
+        return true;
+      pos = (idx + 1) << (64 - t->bits);
+    }
   }
 
   bool lookup(const K& k, V* vptr = nullptr) const {
     scoped_gc_epoch rcu_read;
 
-    bucket* b = &buckets_[hash(k) % nbuckets_];
+    bucket* b = find_bucket(hash_of(k));
     for (const item& i: b->chain) {
       if (i.key != k)
         continue;
@@ -199,31 +517,42 @@ public:
     if (dead_)
       return false;
 
-    for (u64 i = 0; i < nbuckets_; i++)
-      for (const item& ii: buckets_[i].chain)
-        if (ii.key != k || ii.val != v)
-          return false;
+    scoped_gc_epoch rcu_read;
+    table* t = cur_;
+    if (!t->next) {
+      for (u64 i = 0; i < t->nbuckets; i++)
+        for (const item& ii: t->buckets[i].chain)
+          if (ii.key != k || ii.val != v)
+            return false;
+    }
+
+    // Finish any resize so there's just one table to lock.
+    auto rl = resize_lock_.guard();
+    migrate_locked(~0ull);
+    t = cur_;
+    if (t->next)
+      return false;
 
-    for (u64 i = 0; i < nbuckets_; i++)
-      buckets_[i].lock.acquire();
+    for (u64 i = 0; i < t->nbuckets; i++)
+      t->buckets[i].lock.acquire();
 
     bool killed = !dead_;
-    for (u64 i = 0; i < nbuckets_; i++)
-      for (const item& ii: buckets_[i].chain)
+    for (u64 i = 0; i < t->nbuckets; i++)
+      for (const item& ii: t->buckets[i].chain)
         if (ii.key != k || ii.val != v)
           killed = false;
 
     if (killed) {
       dead_ = true;
-      bucket* b = &buckets_[hash(k) % nbuckets_];
+      bucket* b = t->get(hash_of(k));
       item* i = &b->chain.front();
       assert(i->key == k && i->val == v);
       b->chain.pop_front();
       gc_delayed(i);
     }
 
-    for (u64 i = 0; i < nbuckets_; i++)
-      buckets_[i].lock.release();
+    for (u64 i = 0; i < t->nbuckets; i++)
+      t->buckets[i].lock.release();
 
     return killed;
   }
@@ -14,6 +14,7 @@
 #include <uk/unistd.h>
 
 class dirns;
+struct kmsghdr;
 
 u64 namehash(const strbuf<DIRSIZ>&);
 
@@ -32,6 +33,16 @@ struct file {
   virtual ssize_t pread(char *addr, size_t n, off_t offset) { return -1; }
   virtual ssize_t pwrite(const char *addr, size_t n, off_t offset) { return -1; }
 
+  // Move up to n bytes from this file to out without a trip through
+  // user space.  If off is non-null, this reads at *off and advances
+  // it instead of the file offset, and likewise for outoff and out.
+  // Returns the number of bytes moved, which is short at EOF, if a
+  // read or write comes up short, or if we're killed.  By default,
+  // this reads into a kernel page and writes from it, a page at a
+  // time.  Files that keep their data in kernel pages override this
+  // to write straight from those pages.
+  virtual ssize_t splice_to(file *out, off_t *off, off_t *outoff, size_t n);
+
   // Socket operations
   virtual int bind(const struct sockaddr *addr, size_t addrlen) { return -1; }
   virtual int listen(int backlog) { return -1; }
@@ -40,6 +51,8 @@ struct file {
   // an out-argument.
   virtual int accept(struct sockaddr_storage *addr, size_t *addrlen, file **out)
   { return -1; }
+  virtual int connect(const struct sockaddr *addr, size_t addrlen)
+  { return -1; }
   // sendto and recvfrom take a userptr to the buf to avoid extra
   // copying in the kernel.  The other pointers will be kernel
   // pointers.  dest_addr may be null.
@@ -53,6 +66,18 @@ struct file {
                            struct sockaddr_storage *src_addr,
                            size_t *addrlen)
   { return -1; }
+  // Send (or receive) up to n messages, as for sendmmsg (or
+  // recvmmsg).  Returns the number of messages sent (or received), or
+  // -1 if there was an error before the first one.  Once a message is
+  // sent, the socket owns the references to its files.  By default,
+  // these move each message's data with write (or read), so they
+  // can't pass files or addresses.
+  virtual int sendmsgs(struct kmsghdr *msgs, int n, int flags);
+  virtual int recvmsgs(struct kmsghdr *msgs, int n, int flags);
+  // Whether this file can hold files in flight.  Such files can't be
+  // passed themselves, since a socket sent into its own queue (or
+  // its peer's) would keep itself alive forever.
+  virtual bool holds_files() { return false; }
 
   virtual sref<mnode> get_mnode() { return sref<mnode>(); }
 
@@ -76,14 +101,22 @@ public:
   const bool readable;
   const bool writable;
   const bool append;
-  u32 off;
+  // Updates to off hold off_lock, except for O_APPEND writes, which
+  // just store their end offset.
+  std::atomic<u64> off;
   sleeplock off_lock;
+  // For directories, the name of the last entry getdents returned.
+  // Valid if off != 0.  Protected by off_lock.
+  strbuf<DIRSIZ> dir_pos;
+  // For files, readahead for reads through this open file.
+  readahead_state ra;
 
   int stat(struct stat*, enum stat_flags) override;
   ssize_t read(char *addr, size_t n) override;
   ssize_t write(const char *addr, size_t n) override;
   ssize_t pread(char* addr, size_t n, off_t off) override;
   ssize_t pwrite(const char *addr, size_t n, off_t offset) override;
+  ssize_t splice_to(file *out, off_t *off, off_t *outoff, size_t n) override;
   void onzero() override
   {
     delete this;
@@ -55,6 +55,14 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entry returned by getdents, which fills its buffer with
+// an array of these.  d_type is one of the T_* file type codes.
+struct dirent64 {
+  u64 d_ino;
+  u8 d_type;
+  char d_name[DIRSIZ+1];
+};
+
 // XXX(Austin) PATH_MAX sucks.  It would be nice if we didn't need it
 // to size kernel copy buffers.
 #define PATH_MAX 256
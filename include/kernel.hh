@@ -42,6 +42,7 @@ struct localsock;
 struct work;
 struct dwork;
 struct irq;
+struct kiovec;
 class print_stream;
 class mnode;
 class buf;
@@ -78,6 +79,10 @@ void            bwrite(buf*);
 // cga.c
 void            cgaputc(int c);
 
+// clockpage.cc
+void            clockpage_tick(void);
+int             clockpage_map(vmap *vmp);
+
 // console.c
 void            cprintf(const char*, ...) __attribute__((format(printf, 1, 2)));
 void            __cprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -106,6 +111,7 @@ void            iupdate(sref<inode>);
 void            iunlock(sref<inode>);
 void            itrunc(inode*);
 int             readi(sref<inode>, char*, u32, u32);
+void            readblocks_direct(sref<inode>, char**, u32, u32);
 void            stati(sref<inode>, struct stat*);
 int             writei(sref<inode>, const char*, u32, u32);
 sref<inode>     nameiparent(sref<inode> cwd, const char*, char*);
@@ -113,6 +119,11 @@ int             dirlink(sref<inode>, const char*, u32);
 void            dir_init(sref<inode> dp);
 void	        dir_flush(sref<inode> dp);
 
+// fpu.cc
+void            fpu_switch(struct proc *prev, struct proc *next);
+void            fpu_trap(void);
+void            fpu_free(struct proc *p);
+
 // futex.cc
 typedef u64* futexkey_t;
 int             futexkey(const u64* useraddr, vmap* vmap, futexkey_t* key);
@@ -127,6 +138,7 @@ void            inithz(void);
 void            ideinit(void);
 void            ideintr(void);
 void            ideread(u32 dev, char* data, u64 count, u64 offset);
+void            idereadv(u32 dev, kiovec* iov, int iovcnt, u64 offset);
 void            idewrite(u32 dev, const char* data, u64 count, u64 offset);
 
 // idle.cc
@@ -146,6 +158,7 @@ void            kmalignfree(void *, int align, u64 size);
 void            verifyfree(char *ptr, u64 nbytes);
 void            kminit(void);
 void            kmemprint(print_stream *s);
+void            kmem_node_pages(int node, size_t *nfree, size_t *ntotal);
 
 // kbd.c
 void            kbdintr(void);
@@ -196,6 +209,7 @@ void            procdumpall(void);
 void            scheduler(void) __noret__;
 void            userinit(void);
 void            yield(void);
+void            preempt(void);
 struct proc*    threadalloc(void (*fn)(void*), void *arg);
 struct proc*    threadpin(void (*fn)(void*), void *arg, const char *name, int cpu);
 
@@ -208,12 +222,12 @@ void            wdpoke(void);
 
 // sched.cc
 void            addrun(struct proc *);
-void            sched(void);
+void            sched(bool compete = false);
 void            post_swtch(void);
 void            scheddump(void);
 int             steal(void);
+void            sched_tick(void);
 void            addrun(struct proc*);
-int             dwork_push(struct dwork*, int);
 
 // syscall.c
 int             fetchint64(uptr, u64*);
@@ -258,6 +272,11 @@ void*           pagelookup(struct vmap*, uptr);
 size_t          safe_read_hw(void *dst, uintptr_t src, size_t n);
 size_t          safe_read_vm(void *dst, uintptr_t src, size_t n);
 
+// work.cc
+int             dwork_push(struct dwork*, int);
+void            work_switch(void);
+bool            work_idle(void);
+
 // zalloc.cc
 char*           zalloc(const char* name);
 void            zfree(void* p);
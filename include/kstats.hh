@@ -46,6 +46,8 @@
   X(uint64_t, kalloc_hot_list_flush_count)      \
   X(uint64_t, kalloc_hot_list_steal_count)      \
   X(uint64_t, kalloc_hot_list_remote_free_count)        \
+  X(uint64_t, reclaim_pages_freed)              \
+  X(uint64_t, reclaim_short_count)              \
 
 #define KSTATS_REFCACHE(X)                      \
   X(uint64_t, refcache_review_count)            \
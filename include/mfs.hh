@@ -8,8 +8,9 @@ extern mfs* anon_fs;
 sref<mnode> namei(sref<mnode> cwd, const char* path);
 sref<mnode> nameiparent(sref<mnode> cwd, const char* path, strbuf<DIRSIZ>* buf);
 s64 readi(sref<mnode> m, char* buf, u64 start, u64 nbytes);
-s64 writei(sref<mnode> m, const char* buf, u64 start, u64 nbytes,
-           mfile::resizer* resize = nullptr);
+s64 writei(sref<mnode> m, const char* buf, u64 start, u64 nbytes);
+s64 appendi(sref<mnode> m, const char* buf, u64 nbytes, u64* startp);
 
 class print_stream;
 void mfsprint(print_stream *s);
+void initmnode(void);
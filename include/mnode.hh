@@ -51,6 +51,7 @@ public:
 
   void cache_pin(bool flag);
   u8 type() const { return inumber(inum_).type(); }
+  static u8 type_of(u64 inum) { return inumber(inum).type(); }
 
   mdir* as_dir();
   const mdir* as_dir() const;
@@ -149,23 +150,65 @@ public:
 
 class mdir : public mnode {
 private:
-  // ~32K cache
-  mdir(mfs* fs, u64 inum) : mnode(fs, inum), map_(1367) {}
+  mdir(mfs* fs, u64 inum) : mnode(fs, inum) {}
   NEW_DELETE_OPS(mdir);
   friend class mnode;
   friend class mfs;
 
-  // XXX We should deal with varying directory sizes better.  One way
-  // would be to make this a resizable hash table.  Linux uses a
-  // unified directory cache hash table, but that would make
-  // serializing a directory much harder for us.
-  chainhash<strbuf<DIRSIZ>, u64> map_;
+  /*
+   * A directory entry's value.  Besides the inode number, this
+   * caches a pointer to the mnode so that lookups don't have to go
+   * through the global mnode cache.
+   *
+   * We can't use a refcache weakref for this: an mnode can have only
+   * one weakref, and mnode_cache owns it.  A raw pointer is safe
+   * anyway.  A linked mnode is pinned in the cache by its link count.
+   * The link count cannot drop to zero and free the mnode while
+   * some core that saw the entry linked is holding off refcache
+   * epochs with cli.  So lookups read the entry and take their
+   * reference under cli.
+   */
+  struct entry {
+    u64 inum;
+    mnode* mn;
+
+    entry() : inum(0), mn(nullptr) {}
+    explicit entry(mnode* m) : inum(m->inum_), mn(m) {}
+
+    bool operator==(const entry& o) const { return inum == o.inum; }
+    bool operator!=(const entry& o) const { return inum != o.inum; }
+  };
+
+  // This starts out with a few buckets and resizes itself as the
+  // directory grows and shrinks.  Linux uses a unified directory
+  // cache hash table, but that would make serializing a directory
+  // much harder for us.
+  chainhash<strbuf<DIRSIZ>, entry> map_;
+
+  /*
+   * A rename takes an entry out of one directory and puts it in
+   * another (or the same one), and a lookup that runs in the middle
+   * can find the name in neither.  Renames write rename_seq_ of both
+   * directories, holding their rename_lock_s, so that lookups, which
+   * take no locks, notice and retry.
+   */
+  spinlock rename_lock_;
+  seqcount<u32> rename_seq_;
+
+  bool lookup_entry(const strbuf<DIRSIZ>& name, entry* ep) const {
+    auto r = rename_seq_.read_begin();
+    bool found;
+    do {
+      found = map_.lookup(name, ep);
+    } while (r.do_retry());
+    return found;
+  }
 
 public:
   bool insert(const strbuf<DIRSIZ>& name, mlinkref* ilink) {
     if (name == ".")
       return false;
-    if (!map_.insert(name, ilink->mn()->inum_))
+    if (!map_.insert(name, entry(ilink->mn().get())))
       return false;
     assert(ilink->held());
     ilink->mn()->nlink_.inc();
@@ -173,7 +216,7 @@ public:
   }
 
   bool remove(const strbuf<DIRSIZ>& name, sref<mnode> m) {
-    if (!map_.remove(name, m->inum_))
+    if (!map_.remove(name, entry(m.get())))
       return false;
     m->nlink_.dec();
     return true;
@@ -181,9 +224,20 @@ public:
 
   bool replace_from(const strbuf<DIRSIZ>& dstname, sref<mnode> mdst,
                     mdir* src, const strbuf<DIRSIZ>& srcname, sref<mnode> msrc) {
-    u64 dstinum = mdst ? mdst->inum_ : 0;
-    if (!map_.replace_from(dstname, mdst ? &dstinum : nullptr,
-                           &src->map_, srcname, msrc->inum_))
+    // Lock the two directories in address order.
+    mdir* first = src < this ? src : this;
+    mdir* second = src < this ? this : src;
+    scoped_acquire l1(&first->rename_lock_), l2;
+    seqcount<u32>::writer w2;
+    if (second != first) {
+      l2 = second->rename_lock_.guard();
+      w2 = second->rename_seq_.write_begin();
+    }
+    auto w1 = first->rename_seq_.write_begin();
+
+    entry dstent = mdst ? entry(mdst.get()) : entry();
+    if (!map_.replace_from(dstname, mdst ? &dstent : nullptr,
+                           &src->map_, srcname, entry(msrc.get())))
       return false;
     if (mdst)
       mdst->nlink_.dec();
@@ -194,31 +248,39 @@ public:
     if (name == ".")
       return true;
 
-    return map_.lookup(name);
+    entry e;
+    return lookup_entry(name, &e);
   }
 
   sref<mnode> lookup(const strbuf<DIRSIZ>& name) const {
     if (name == ".")
       return fs_->get(inum_);
 
-    u64 iprev = -1;
-    for (;;) {
-      u64 inum;
-      if (!map_.lookup(name, &inum))
-        return sref<mnode>();
-
-      sref<mnode> m = fs_->get(inum);
-      if (m)
-        return m;
+    // Every entry we insert carries its mnode, so there is nothing
+    // to look up in the mnode cache.
+    scoped_cli cli;
+    entry e;
+    if (!lookup_entry(name, &e))
+      return sref<mnode>();
+    return sref<mnode>::newref(e.mn);
+  }
 
-      /*
-       * The inode was GCed between the lookup and mnode::get().
-       * Retry the lookup.  Crash if we repeatedly can't find
-       * the same inode (to make such bugs easier to track down).
-       */
-      assert(inum != iprev);
-      iprev = inum;
+  /*
+   * Look up name without taking a reference, for path walks.  The
+   * caller must hold cli for as long as it uses *mp (see entry).
+   * Returns false if name doesn't exist.
+   */
+  bool lookup_noref(const strbuf<DIRSIZ>& name, mnode** mp) const {
+    if (name == ".") {
+      *mp = const_cast<mdir*>(this);
+      return true;
     }
+
+    entry e;
+    if (!lookup_entry(name, &e))
+      return false;
+    *mp = e.mn;
+    return true;
   }
 
   mlinkref lookup_link(const strbuf<DIRSIZ>& name) const {
@@ -236,11 +298,11 @@ public:
 
       scoped_cli cli;
       /*
-       * Retry the lookup, now that we have an sref<mnode>, since
-       * we don't want to do lookup's mnode::get() under cli.
+       * Retry the lookup under our own cli, since the entry may have
+       * changed since lookup released its cli.
        */
-      u64 inum;
-      if (!map_.lookup(name, &inum) || inum != m->inum_)
+      entry e;
+      if (!lookup_entry(name, &e) || e.inum != m->inum_)
         /*
          * The name has either been unlinked or changed to point
          * to another inode.  Retry.
@@ -288,8 +350,28 @@ public:
     return map_.enumerate(prev, name);
   }
 
+  /*
+   * Call fn(name, inum) for each entry after *prev ("." first if
+   * prev is null) until fn returns false.  Returns true if it
+   * reached the last entry.  fn must not block.
+   */
+  template<class F>
+  bool enumerate_entries(const strbuf<DIRSIZ>* prev, F fn) const {
+    if (!prev) {
+      if (!fn(strbuf<DIRSIZ>("."), inum_))
+        return false;
+    } else if (*prev == ".") {
+      prev = nullptr;
+    }
+
+    return map_.enumerate_from(prev, [&fn](const strbuf<DIRSIZ>& name,
+                                           const entry& e) {
+        return fn(name, e.inum);
+      });
+  }
+
   bool kill(sref<mnode> parent) {
-    if (!map_.remove_and_kill("..", parent->inum_))
+    if (!map_.remove_and_kill("..", entry(parent.get())))
       return false;
 
     parent->nlink_.dec();
@@ -316,9 +398,35 @@ mnode::as_dir() const
 }
 
 
+/*
+ * Per-open-file readahead state.  Reads update it without locks, so
+ * concurrent reads through one open file can confuse it, but that
+ * only costs performance.
+ */
+struct readahead_state {
+  enum {
+    NORMAL,       // Read ahead if reads look sequential
+    SEQUENTIAL,   // Always read ahead, with the largest window
+    RANDOM,       // Never read ahead
+  };
+
+  // The page after the last read.
+  u64 next;
+  // One past the last page we've read ahead.
+  u64 issued;
+  // How many pages to keep read ahead of the reader.
+  u32 window;
+  u8 mode;
+
+  readahead_state() : next(0), issued(0), window(0), mode(NORMAL) {}
+};
+
 class mfile : public mnode {
 private:
-  mfile(mfs* fs, u64 inum) : mnode(fs, inum), size_(0) {}
+  mfile(mfs* fs, u64 inum)
+    : mnode(fs, inum), size_(0), reserved_(0), committed_(0),
+      backing_dev_(0), backing_inum_(0), backing_size_(0),
+      on_clock_(false), clock_node_(0), clock_hand_(0) {}
   NEW_DELETE_OPS(mfile);
   friend class mnode;
   friend class mfs;
@@ -328,8 +436,10 @@ public:
     enum {
       FLAG_LOCK_BIT = 0,
       FLAG_LOCK = 1 << FLAG_LOCK_BIT,
-      FLAG_PARTIAL_PAGE_BIT = 1,
-      FLAG_PARTIAL_PAGE = 1 << FLAG_PARTIAL_PAGE_BIT,
+      FLAG_DIRTY_BIT = 1,
+      FLAG_DIRTY = 1 << FLAG_DIRTY_BIT,
+      FLAG_REFERENCED_BIT = 2,
+      FLAG_REFERENCED = 1 << FLAG_REFERENCED_BIT,
     };
 
     /*
@@ -398,15 +508,35 @@ public:
       return bit_spinlock(&value_, FLAG_LOCK_BIT);
     }
 
-    bool is_partial_page() {
-      return !!(value_ & FLAG_PARTIAL_PAGE);
+    /*
+     * A dirty page may differ from the backing inode, so it can't be
+     * evicted.  Pages read in from the backing inode start clean.
+     */
+    bool is_dirty() const {
+      return !!(value_ & FLAG_DIRTY);
+    }
+
+    void set_dirty() {
+      locked_set_bit(FLAG_DIRTY_BIT, &value_);
     }
 
-    void set_partial_page(bool flag) {
-      if (flag)
-        locked_set_bit(FLAG_PARTIAL_PAGE_BIT, &value_);
-      else
-        locked_reset_bit(FLAG_PARTIAL_PAGE_BIT, &value_);
+    /*
+     * The reclaim clock clears the referenced bit as it passes a page
+     * and evicts pages that haven't been used since it last passed.
+     * Test before setting so that hot pages don't bounce the cache
+     * line.
+     */
+    bool is_referenced() const {
+      return !!(value_ & FLAG_REFERENCED);
+    }
+
+    void set_referenced() {
+      if (!is_referenced())
+        locked_set_bit(FLAG_REFERENCED_BIT, &value_);
+    }
+
+    void clear_referenced() {
+      locked_clear_bit(FLAG_REFERENCED_BIT, &value_);
     }
   };
 
@@ -419,21 +549,82 @@ private:
   seqcount<u32> size_seq_;
   u64 size_;
 
+  /*
+   * Appends don't take resize_lock_.  An appender reserves the range
+   * [reserved_, reserved_ + n) with a single compare-and-swap, fills
+   * those pages in parallel with other appenders, and then commits
+   * by advancing size_, in reservation order.  committed_ is the end
+   * of the last committed append, so appends are in flight whenever
+   * it is behind reserved_.  A resizer sets RESERVE_FROZEN in
+   * reserved_ to hold off new reservations and waits for the ones in
+   * flight to commit before it touches size_.
+   *
+   * Pages between size_ and reserved_ may be set while appends are
+   * in flight, so readers must check size_ rather than assume that a
+   * set page is below EOF.
+   */
+  std::atomic<u64> reserved_;
+  std::atomic<u64> committed_;
+  static const u64 RESERVE_FROZEN = 1ull << 63;
+
+  /*
+   * Files loaded from disk are backed by an on-disk inode.  Their
+   * pages are read in directly from the disk on first use, and clean
+   * pages can be evicted and read in again later.  Only the first
+   * backing_size_ bytes come from the disk: a truncate lowers it, and
+   * anything past it is a hole.  backing_size_ only changes under a
+   * resizer.
+   */
+  u32 backing_dev_;
+  u32 backing_inum_;
+  u64 backing_size_;
+
+  /*
+   * A backed file joins the reclaim clock of the NUMA node where it
+   * first reads in a page and stays on it until it's freed.
+   * clock_hand_ is the page where the clock resumes sweeping this
+   * file.  Both are protected by the clock's lock.
+   */
+  std::atomic<bool> on_clock_;
+  int clock_node_;
+  u64 clock_hand_;
+
+public:
+  // Link for the reclaim clock.
+  ilink<mfile> clock_link_;
+
+  ~mfile();
+
+  // Sweep up to nscan of this file's pages for the reclaim clock,
+  // evicting clean pages that weren't used since the last sweep.
+  // Returns the number of pages evicted.  The caller holds the
+  // clock's lock.
+  size_t clock_sweep(size_t nscan);
+
 public:
-  class resizer : public lock_guard<spinlock>,
-                  public seq_writer {
+  class resizer {
   private:
-    resizer(mfile* mf) : lock_guard<spinlock>(&mf->resize_lock_),
-                         seq_writer(&mf->size_seq_),
-                         mf_(mf) {}
+    resizer(mfile* mf);
+    void release();
+
+    lock_guard<spinlock> lock_;
+    seqcount<u32>::writer writer_;
     mfile* mf_;
     friend class mfile;
 
   public:
     resizer() : mf_(nullptr) {}
+    resizer(resizer &&o);
+    resizer &operator=(resizer &&o);
+    ~resizer() { release(); }
+
     explicit operator bool () const { return !!mf_; }
     u64 read_size() { return mf_->size_; }
-    void resize_nogrow(u64 size);
+    // Set the file size.  Shrinking drops the pages past the new end
+    // of file and zeroes the rest of the new last page.  Growing
+    // leaves a hole, which reads as zeroes.
+    void resize(u64 size);
+    // Grow the file to size and install pi as its new last page.
     void resize_append(u64 size, sref<page_info> pi);
   };
 
@@ -445,7 +636,85 @@ public:
     return seq_reader<u64>(&size_, &size_seq_);
   }
 
+  // Back this file with the on-disk inode dev/inum, whose size is
+  // size.  The file must be empty.
+  void set_backing(u32 dev, u32 inum, u64 size);
+
+  // Whether the page at pageidx comes from the backing inode, so that
+  // it must be read in, rather than zero-filled, if it's not cached.
+  bool is_backed(u64 pageidx) const {
+    return pageidx < PGROUNDUP(backing_size_) / PGSIZE;
+  }
+
+  // Return the page at pageidx.  This is unset for holes and for
+  // pages past EOF.  Reading the page in from the backing inode may
+  // sleep.
   page_state get_page(u64 pageidx);
+
+  // Return the page at pageidx if it's in memory.  This never sleeps.
+  page_state get_cached_page(u64 pageidx);
+
+  // Return the page at pageidx and mark it dirty, so it stays in
+  // memory.  If may_load is false, this returns an unset page_state
+  // rather than read in a backed page.
+  page_state dirty_page(u64 pageidx, bool may_load = true);
+
+  // For page faults on shared mappings.  Like get_cached_page, but
+  // fill a hole below EOF with a zeroed page, and mark the page dirty
+  // so it stays in memory as long as the file does.  Returns an unset
+  // page_state if the page must be read in first.  Throws bad_alloc
+  // if there's no memory for the page.
+  page_state fault_page(u64 pageidx);
+
+  // Drop the page at pageidx if it is clean and can be read in again
+  // from the backing inode.  Returns true if the page was dropped.
+  bool evict_page(u64 pageidx);
+
+  // Read in whichever pages of [pageidx, pageidx+npages) come from
+  // the backing inode and aren't in memory, batching pages that are
+  // contiguous on disk.  This may sleep.  It gives up quietly if
+  // it runs out of memory.
+  void readahead(u64 pageidx, u64 npages);
+
+  // Like readahead, but in the background on this CPU's work queue.
+  void readahead_async(u64 pageidx, u64 npages);
+
+  // Note a read of [off, off+n) through an open file with readahead
+  // state ra, and read ahead if the reads look sequential.
+  void read_hint(readahead_state* ra, u64 off, u64 n);
+
+  // Back every hole in [start, end) below EOF with a zeroed page.
+  // Returns false if we run out of memory.
+  bool allocate(u64 start, u64 end);
+
+  // Install pi at pageidx if that page is a hole.  Unless check_eof
+  // is false, which callers may only pass if they hold a resizer or
+  // an append reservation covering pageidx, pages past EOF are left
+  // alone.  Returns the page now at pageidx.
+  page_state install_page(u64 pageidx, sref<page_info> pi,
+                          bool check_eof = true);
+
+  // Reserve n bytes at the end of the file for an append and set
+  // *startp to the offset of the reserved range.  The caller must
+  // fill the range and then call commit_append.  Since that can't
+  // sleep, this fails without reserving anything if the range would
+  // start in a page from the backing inode other than pinned, which
+  // the caller has already made dirty.
+  bool reserve_append(u64 n, u64 pinned, u64* startp);
+
+  // Make the append reserved at [start, start+n) visible.  This waits
+  // for all earlier reservations to commit.
+  void commit_append(u64 start, u64 n);
+
+  // A page of zeroes that private mappings of holes share until they
+  // write to them.
+  static sref<page_info> zero_page;
+
+private:
+  bool fill_hole(u64 pageidx);
+  page_state load_page(u64 pageidx);
+  void install_loaded(u64 pageidx, char* p);
+  void join_clock();
 };
 
 inline mfile*
@@ -499,22 +768,70 @@ mnode::as_dev() const
 }
 
 
+/*
+ * The listening end of a UNIX stream socket.  unixsock.cc defines
+ * what's behind it.
+ */
+struct sock_listener : public referenced {
+protected:
+  sock_listener() {}
+};
+
 class msock : public mnode {
 private:
-  msock(mfs* fs, u64 inum) : mnode(fs, inum), localsock_(nullptr) {}
+  msock(mfs* fs, u64 inum)
+    : mnode(fs, inum), localsock_(nullptr), listener_(nullptr) {}
   NEW_DELETE_OPS(msock);
   friend class mnode;
   friend class mfs;
 
   localsock* localsock_;
+  // Set by listen and cleared when the listener closes.  We hold a
+  // reference to it.  Protected by listener_lock_.
+  sock_listener* listener_;
+  mutable spinlock listener_lock_;
 
 public:
+  ~msock() {
+    if (listener_)
+      listener_->dec();
+  }
+
   localsock* get_sock() const { return localsock_; }
 
   void init(localsock* ls) {
     assert(!localsock_);
     localsock_ = ls;
   }
+
+  // Return the listener on this socket, or null if nothing is
+  // listening on it yet.
+  sref<sock_listener> get_listener() const {
+    auto lk = listener_lock_.guard();
+    return sref<sock_listener>::newref(listener_);
+  }
+
+  // Set the listener on this socket.  Returns false if it already
+  // has one.
+  bool init_listener(sock_listener* l) {
+    auto lk = listener_lock_.guard();
+    if (listener_)
+      return false;
+    l->inc();
+    listener_ = l;
+    return true;
+  }
+
+  // Clear the listener on this socket if it's still l, so the
+  // socket can be listened on again.
+  void clear_listener(sock_listener* l) {
+    auto lk = listener_lock_.guard();
+    if (listener_ != l)
+      return;
+    listener_ = nullptr;
+    lk.release();
+    l->dec();
+  }
 };
 
 inline msock*
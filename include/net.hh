@@ -1,5 +1,87 @@
 #pragma once
 
 #include "file.hh"
+#include <uk/socket.h>
+#include <algorithm>
 
 int netsocket(int, int, int, file**);
+
+// The most messages one sendmmsg or recvmmsg handles
+#define MMSG_MAX 32
+
+// One message of a sendmsg or recvmsg.  The syscall layer copies in
+// the msghdr and its iovecs, but the data stays in user space until
+// the socket copies it.
+struct kmsghdr {
+  struct iovec iov[UIO_MAXIOV];
+  size_t iovcnt;
+  // For sendmsg, the destination, if addrlen isn't 0.  For recvmsg,
+  // where the message came from.
+  struct sockaddr_storage addr;
+  size_t addrlen;
+  // Files passed with SCM_RIGHTS.  Each holds a reference.
+  file *files[SCM_MAX_FD];
+  int nfiles;
+  // The number of bytes sent or received.
+  size_t len;
+  // For recvmsg, MSG_TRUNC and MSG_CTRUNC.
+  int flags;
+
+  kmsghdr() : iovcnt(0), addrlen(0), nfiles(0), len(0), flags(0) {}
+
+  size_t total() const {
+    size_t n = 0;
+    for (size_t i = 0; i < iovcnt; i++)
+      n += iov[i].iov_len;
+    return n;
+  }
+
+  // Gather up to n bytes of the message's data, starting off bytes
+  // in, into dst.  Returns the number of bytes copied, or -1 on a bad
+  // user pointer.
+  ssize_t gather(char *dst, size_t n, size_t off = 0) const {
+    size_t done = 0;
+    for (size_t i = 0; i < iovcnt && done < n; i++) {
+      if (off >= iov[i].iov_len) {
+        off -= iov[i].iov_len;
+        continue;
+      }
+      size_t m = std::min(iov[i].iov_len - off, n - done);
+      userptr<void> src((char*)iov[i].iov_base + off);
+      if (!src.load_bytes(dst + done, m))
+        return -1;
+      done += m;
+      off = 0;
+    }
+    return done;
+  }
+
+  // Scatter n bytes from src into the message's buffers, starting
+  // off bytes in.  Returns the number of bytes that fit, or -1 on a
+  // bad user pointer.
+  ssize_t scatter(const char *src, size_t n, size_t off = 0) const {
+    size_t done = 0;
+    for (size_t i = 0; i < iovcnt && done < n; i++) {
+      if (off >= iov[i].iov_len) {
+        off -= iov[i].iov_len;
+        continue;
+      }
+      size_t m = std::min(iov[i].iov_len - off, n - done);
+      userptr<void> dst((char*)iov[i].iov_base + off);
+      if (!dst.store_bytes(src + done, m))
+        return -1;
+      done += m;
+      off = 0;
+    }
+    return done;
+  }
+
+  // Drop the references to the passed files.
+  void drop_files() {
+    for (int i = 0; i < nfiles; i++)
+      files[i]->dec();
+    nfiles = 0;
+  }
+
+  NEW_DELETE_OPS(kmsghdr);
+};
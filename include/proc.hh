@@ -6,6 +6,7 @@
 #include "fs.h"
 #include "sched.hh"
 #include <uk/signal.h>
+#include <uk/sched.h>
 #include "ilist.hh"
 #include <stdexcept>
 #include "vmalloc.hh"
@@ -75,8 +76,13 @@ struct proc {
   char name[16];               // Process name (debugging)
   u64 tsc;
   u64 curcycles;
+  int sched_class;             // SCHED_OTHER or SCHED_FIFO
+  int nice;                    // SCHED_OTHER weight, NICE_MIN..NICE_MAX
+  u64 vruntime;                // Weighted cycles run, for SCHED_OTHER
   unsigned cpuid;
-  void *fpu_state;             // FXSAVE state, lazily allocated
+  void *fpu_state;             // XSAVE area, lazily allocated
+  int fpu_cpu;                 // CPU that last loaded fpu_state
+  u8 fpu_counter;              // Recent time slices that used the FPU
   struct spinlock lock;
   ilink<proc> child_next;
   ilist<proc,&proc::child_next> childq;
@@ -100,6 +106,7 @@ struct proc {
   int in_exec_;
   int uaccess_;
   bool yield_;                 // yield cpu up when returning to user space
+  bool sysret_full_;           // return from syscall via trapret, not sysret
 
   userptr_str upath;
   userptr<userptr_str> uargv;
@@ -116,12 +123,18 @@ struct proc {
   void         set_state(procstate_t s);
   procstate_t  get_state(void) const { return state_; }
   int          set_cpu_pin(int cpu);
+  static int   set_scheduler(int pid, int policy, int nice);
+  int          set_scheduler(int policy, int nice);
   static int   kill(int pid);
+  static bool  alive(int pid);
   int          kill();
   bool         cansteal(bool nonexec) {
+    // A proc that has never run (tsc == 0) has no cache footprint to
+    // lose, so it can move right away.  Otherwise, don't bounce procs
+    // that just arrived.
     return (get_state() == RUNNABLE && !cpu_pin && 
           (in_exec_ || nonexec) &&
-          curcycles != 0 && curcycles > VICTIMAGE);
+          (tsc == 0 || curcycles > VICTIMAGE));
   };
 
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "spinlock.hh"
+#include "ilist.hh"
+#include "numa.hh"
+
+// Reclaiming memory from caches under memory pressure.  Each NUMA
+// node has a reclaim worker.  kalloc kicks it when one of the node's
+// buddy allocators drops below a low watermark, and the worker asks
+// the registered shrinkers to free memory until the node is back
+// above a high watermark.
+
+struct shrinker
+{
+  shrinker(const char *name) : name_(name) { }
+
+  // Try to free about npages pages of memory cached on behalf of
+  // node.  Returns the number of pages actually given up, which may
+  // take a refcache epoch or two to reach the allocator.  This runs
+  // on the node's reclaim worker, so it may block, but it must not
+  // wait on other cores' deferred work, which may itself be stuck
+  // waiting for memory.
+  virtual size_t shrink(int node, size_t npages) = 0;
+
+  const char *name_;
+};
+
+// Register a shrinker.  Shrinkers are never unregistered.
+void register_shrinker(shrinker *s);
+
+// Ask node's reclaim worker to run.  This never blocks and takes no
+// locks, so the allocator can call it.
+void reclaim_kick(int node);
+
+// An approximate LRU list of cached objects for each NUMA node.
+// Owners add objects to the list of the node they were cached on and
+// sweep it CLOCK-style from the head: an object that was used since
+// the last sweep gets a second chance at the tail, and the rest are
+// evicted.  T must record which node's list it is on.
+template<class T, ilink<T> T::* L>
+class clock_list
+{
+  struct node_list
+  {
+    spinlock lock;
+    ilist<T, L> list;
+    __padout__;
+
+    node_list() : lock("clock_list") { }
+  };
+
+  node_list nodes_[MAX_NUMA_NODES];
+
+public:
+  void
+  add(int node, T *x)
+  {
+    scoped_acquire l(&nodes_[node].lock);
+    nodes_[node].list.push_back(x);
+  }
+
+  void
+  remove(int node, T *x)
+  {
+    scoped_acquire l(&nodes_[node].lock);
+    nodes_[node].list.erase(nodes_[node].list.iterator_to(x));
+  }
+
+  // Visit up to n objects from the head of node's list.  fn(x) runs
+  // with the list locked, so it must not block or remove x itself.
+  // It returns true to keep x, which moves it to the tail, or false
+  // to drop it from the list.
+  template<class F>
+  void
+  sweep(int node, size_t n, F fn)
+  {
+    node_list &nl = nodes_[node];
+    scoped_acquire l(&nl.lock);
+    for (; n && !nl.list.empty(); n--) {
+      T *x = &nl.list.front();
+      nl.list.pop_front();
+      if (fn(x))
+        nl.list.push_back(x);
+    }
+  }
+};
@@ -493,6 +493,11 @@ namespace refcache {
     // Reap dead objects.  This is done in a dedicated thread to
     // avoid deadlock with threads preempted by the timer interrupt.
     void reaper() __attribute__((noreturn));
+
+    // Flush this core's refcache now rather than at the next tick,
+    // so objects on the review lists age faster under memory
+    // pressure.  The calling thread must be pinned.
+    void expedite() { flush(); }
   };
 
   // Per-CPU reference delta cache.  In general this has to be
@@ -8,6 +8,10 @@ struct sockaddr;
 
 #include "sysstubs.h"
 
+// time.c
+uint64_t uptime(void);
+uint64_t time_nsec(void);
+
 // ulib.c
 char* gets(char*, int max);
 
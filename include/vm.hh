@@ -48,6 +48,16 @@ struct vmdesc : public mmu::page_tracker
 
     // Set if the page should be shared across fork().
     FLAG_SHARED = 1<<5,
+
+    // Set if this page frame maps a kernel-maintained page (such as
+    // the clock page) that user space must never be able to write.
+    FLAG_KERNEL = 1<<6,
+
+    // Access hints from madvise for file mappings.  Faults on a
+    // sequential mapping read ahead of the faulting page, and faults
+    // on a random mapping read in only the faulting page.
+    FLAG_SEQUENTIAL = 1<<7,
+    FLAG_RANDOM = 1<<8,
   };
 
   // Flags
@@ -85,6 +95,14 @@ struct vmdesc : public mmu::page_tracker
   // A memory descriptor for writable anonymous memory.
   static struct vmdesc anon_desc;
 
+  // Construct a descriptor that maps the kernel-owned page 'page'
+  // read-only and shares it across fork.
+  static vmdesc kernel_desc(const sref<class page_info> &page)
+  {
+    return vmdesc(FLAG_MAPPED | FLAG_SHARED | FLAG_KERNEL, page,
+                  sref<mnode>(), 0);
+  }
+
   // Radix_array element methods
 
   bit_spinlock get_lock()
@@ -177,6 +195,10 @@ struct vmap : public referenced {
   // Set write permission bit in vmdesc
   int set_write_permission(uptr start, uptr len, bool is_readonly, bool is_cow);
 
+  // Set the access hint for a range.  hint must be 0,
+  // FLAG_SEQUENTIAL or FLAG_RANDOM.
+  int set_access_hint(uptr start, uptr len, u64 hint);
+
   uptr brk_;                    // Top of heap
 
 private:
@@ -202,10 +224,30 @@ private:
     READ, WRITE
   };
 
+  // A file page that ensure_page needs but that isn't in memory.
+  // Reading it in may sleep, which we can't do with vpfs_ locked, so
+  // ensure_page records the miss and the caller reads the page in
+  // after dropping the lock and then tries again.
+  struct page_miss
+  {
+    sref<mnode> inode;
+    u64 pageidx;
+    // The access hint of the faulting mapping.
+    u64 hint;
+
+    page_miss() : pageidx(0), hint(0) { }
+    explicit operator bool() const { return !!inode; }
+    void load();
+  };
+
   // Ensure there is a backing page at @c it.  The caller is
   // responsible for ensuring that there is a mapping at @c it and for
   // locking vpfs_ at @c it.  This throws bad_alloc if a page must be
-  // allocated and cannot be.
+  // allocated and cannot be.  If the page must be read in from disk,
+  // this fills in @c miss and returns null.
   page_info *ensure_page(const vpf_array::iterator &it, access_type type,
-                         bool *allocated = nullptr);
+                         bool *allocated = nullptr,
+                         page_miss *miss = nullptr);
+
+  uptr willneed_locked(uptr start, uptr len, page_miss *miss);
 };
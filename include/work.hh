@@ -3,12 +3,30 @@
 #include "sched.hh"
 #include "ilist.hh"
 
-// Structures for deferring work.  The deferrred work must not go to block/sleep.
-// If it goes to sleep, create a thread and pin it on the desired core.
+// Structures for deferring work.  dwork_push queues work on a CPU's
+// work queue; it runs later on that CPU, highest priority first.
+// Work that must not block runs inline at context switches (a bounded
+// number of items per switch) and from the idle loop.  Work that may
+// block runs on a small pool of kernel worker threads pinned to each
+// CPU.
+
+enum work_prio {
+  WORK_HIGH,      // Run before any other deferred work
+  WORK_NORMAL,
+  WORK_IDLE,      // Run only when the CPU has nothing better to do
+  WORK_NPRIO
+};
 
 struct dwork {
-  dwork() {}
+  dwork(work_prio prio = WORK_NORMAL, bool may_block = false)
+    : prio_(prio), may_block_(may_block), inbox_next_(nullptr) {}
   virtual void run() = 0;
+
+  work_prio prio_;
+  bool may_block_;
+  // Link for the lock-free per-CPU inbox.
+  dwork *inbox_next_;
+  // Link for the per-CPU ready queues.
   islink<dwork> link_;
 };
 
@@ -20,3 +38,9 @@ struct dwframe {
   bool zero() volatile { return v_ == 0; };
   volatile int v_;
 };
+
+// Run fn(arg) once on every CPU from that CPU's worker threads and
+// wait for all of them to finish.  fn may block.  The caller must be
+// able to sleep.
+void dwork_run_all(void (*fn)(void*), void *arg,
+                   work_prio prio = WORK_NORMAL);
@@ -2,9 +2,42 @@
 #include "kernel.hh"
 #include "buf.hh"
 #include "weakcache.hh"
+#include "reclaim.hh"
+#include "cpu.hh"
 
 static weakcache<buf::key_t, buf> bufcache(512 << 10);
 
+// Cached bufs, for dropping the ones that haven't been used lately.
+static clock_list<buf, &buf::clock_link_> buf_clock;
+
+struct buf_shrinker : public shrinker
+{
+  buf_shrinker() : shrinker("buffer cache") { }
+
+  size_t
+  shrink(int node, size_t npages) override
+  {
+    size_t nfreed = 0;
+    buf_clock.sweep(node, 2 * npages, [&](buf* b) {
+        if (nfreed >= npages || b->dirty())
+          return true;
+        if (b->referenced_.exchange(false))
+          // Second chance.
+          return true;
+        // Drop the cache's reference.  The buf goes away once refcache
+        // sees that nobody else is using it, unless a lookup revives
+        // it first.
+        b->cached_.store(false);
+        b->dec();
+        nfreed++;
+        return false;
+      });
+    return nfreed;
+  }
+};
+
+static buf_shrinker the_buf_shrinker;
+
 sref<buf>
 buf::get(u32 dev, u64 block)
 {
@@ -15,19 +48,35 @@ buf::get(u32 dev, u64 block)
       // Wait for buffer to load, by getting a read seqlock,
       // which waits for the write seqlock bit to be cleared.
       b->seq_.read_begin();
+      if (!b->referenced_.load(std::memory_order_relaxed))
+        b->referenced_.store(true, std::memory_order_relaxed);
+      // The reclaim clock may have let go of it.
+      if (!b->cached_.load(std::memory_order_relaxed))
+        b->cache();
       return b;
     }
 
     sref<buf> nb = sref<buf>::transfer(new buf(dev, block));
     auto locked = nb->write();
     if (bufcache.insert(k, nb.get())) {
-      nb->inc();  // keep it in the cache
+      nb->cache();
       ideread(dev, locked->data, BSIZE, block*BSIZE);
       return nb;
     }
   }
 }
 
+// Keep this buf in the cache.
+void
+buf::cache()
+{
+  if (cached_.exchange(true))
+    return;
+  inc();
+  clock_node_ = mycpu()->node->id;
+  buf_clock.add(clock_node_, this);
+}
+
 void
 buf::writeback()
 {
@@ -46,3 +95,9 @@ buf::onzero()
   bufcache.cleanup(weakref_);
   delete this;
 }
+
+void
+initbio(void)
+{
+  register_shrinker(&the_buf_shrinker);
+}
@@ -0,0 +1,119 @@
+// Kernel-maintained clock page.  This is mapped read-only at
+// UCLOCKPAGE in every user address space so that user space can read
+// the time without a system call (much like Linux's vDSO clock).
+
+#include "types.h"
+#include "amd64.h"
+#include "mmu.h"
+#include "kernel.hh"
+#include "vm.hh"
+#include "page_info.hh"
+#include "kstream.hh"
+
+#include <uk/clockpage.h>
+
+// How often to resynchronize the TSC extrapolation with nsectime().
+#define CLOCKPAGE_RESYNC_NSEC 1000000000ull
+
+static_assert(UCLOCKPAGE % PGSIZE == 0, "UCLOCKPAGE is not page aligned");
+static_assert(UCLOCKPAGE + PGSIZE <= USERTOP - USTACKPAGES * PGSIZE,
+              "UCLOCKPAGE overlaps the user stack");
+static_assert(sizeof(struct clockpage) <= PGSIZE, "struct clockpage too big");
+
+static struct clockpage *clockpage;
+static sref<page_info> clockpage_page;
+
+// The TSC and nsectime() at the last resynchronization.  The clock
+// page's own anchor can run ahead of nsectime() (see clockpage_tick),
+// so the TSC rate is calibrated against these instead.
+static u64 sync_tsc, sync_nsec;
+
+// Publish a new (tsc, nsec) correspondence.  Only CPU 0 updates the
+// clock page, so there is no writer-side locking.
+static void
+clockpage_publish(u64 tsc, u64 nsec, u64 mult)
+{
+  clockpage->seq++;
+  barrier();
+  clockpage->tsc_base = tsc;
+  clockpage->nsec_base = nsec;
+  clockpage->tsc_mult = mult;
+  barrier();
+  clockpage->seq++;
+}
+
+// Called from timerintr on CPU 0.  Re-anchors the clock page to
+// nsectime() and recalibrates the TSC rate from the interval since
+// the last resynchronization.
+//
+// The clock page must never go backward.  If extrapolating with the
+// old rate has taken it past nsectime(), the new anchor starts where
+// the old one left off, and the rate is slowed so the page falls
+// back in step with nsectime() over the next interval.
+void
+clockpage_tick(void)
+{
+  if (!clockpage)
+    return;
+
+  u64 tsc = rdtsc();
+  u64 nsec = nsectime();
+  if (nsec - sync_nsec < CLOCKPAGE_RESYNC_NSEC)
+    return;
+
+  u64 mult = clockpage->tsc_mult;
+  if (tsc > sync_tsc)
+    mult = ((u128)(nsec - sync_nsec) << 32) / (tsc - sync_tsc);
+
+  // What user space reads right now from the old anchor.
+  u64 cur = clockpage->nsec_base;
+  if (tsc > clockpage->tsc_base)
+    cur += ((u128)(tsc - clockpage->tsc_base) * clockpage->tsc_mult) >> 32;
+
+  u64 base = nsec;
+  if (cur > nsec) {
+    // Slow down by at most half so the clock keeps moving.
+    u64 ahead = cur - nsec;
+    if (ahead > CLOCKPAGE_RESYNC_NSEC / 2)
+      ahead = CLOCKPAGE_RESYNC_NSEC / 2;
+    mult = (u128)mult * (CLOCKPAGE_RESYNC_NSEC - ahead) /
+      CLOCKPAGE_RESYNC_NSEC;
+    base = cur;
+  }
+
+  sync_tsc = tsc;
+  sync_nsec = nsec;
+  clockpage_publish(tsc, base, mult);
+}
+
+// Map the clock page into vmp.  Returns -1 on failure.
+int
+clockpage_map(vmap *vmp)
+{
+  if (!clockpage_page)
+    return 0;
+  if (vmp->insert(vmdesc::kernel_desc(clockpage_page), UCLOCKPAGE,
+                  PGSIZE) == (uptr)-1)
+    return -1;
+  return 0;
+}
+
+void
+initclockpage(void)
+{
+  extern u64 cpuhz;
+  extern uint64_t rtc_nsec0;
+
+  char *p = zalloc("clockpage");
+  if (!p)
+    panic("initclockpage: zalloc");
+  clockpage_page = sref<page_info>::transfer(new(page_info::of(p)) page_info());
+  clockpage = (struct clockpage*)p;
+
+  clockpage->cpuhz = cpuhz;
+  clockpage->epoch_nsec = rtc_nsec0;
+  sync_tsc = rdtsc();
+  sync_nsec = nsectime();
+  clockpage_publish(sync_tsc, sync_nsec, (1000000000ull << 32) / cpuhz);
+  clockpage->flags = CLOCKPAGE_VALID;
+}
@@ -47,6 +47,8 @@ timerintr(void)
   
   ticks++;
 
+  clockpage_tick();
+
   now = nsectime();
   again = 0;
   do {
@@ -64,6 +64,13 @@ ideread(u32 dev, char* data, u64 count, u64 offset)
   disks[0]->read(data, count, offset);
 }
 
+void
+idereadv(u32 dev, kiovec* iov, int iovcnt, u64 offset)
+{
+  assert(disks.size() > 0);
+  disks[0]->readv(iov, iovcnt, offset);
+}
+
 void
 idewrite(u32 dev, const char* data, u64 count, u64 offset)
 {
@@ -274,6 +274,9 @@ load_image(proc *p, const char *path, const char * const *argv,
   if (sp < 0)
     return -1;
 
+  if (clockpage_map(vmp.get()) < 0)
+    return -1;
+
   // for usetup
   uintptr_t phdr = 0;
   if (load_addr != -1)
@@ -1,14 +1,141 @@
 #include "types.h"
+#include "mmu.h"
 #include "kernel.hh"
 #include "spinlock.hh"
 #include "condvar.hh"
+#include "proc.hh"
 #include "fs.h"
 #include "file.hh"
 #include <uk/stat.h>
 #include "net.hh"
+#include <algorithm>
 
 struct devsw __mpalign__ devsw[NDEV];
 
+// Write all of buf to f, at *off if off is non-null.  Sockets and
+// pipes may take less than we offer, so keep going until it's all
+// written.  Returns the number of bytes written, or -1 if none were.
+static ssize_t
+splice_write(file *f, off_t *off, const char *buf, size_t n)
+{
+  size_t done = 0;
+  while (done < n) {
+    ssize_t r;
+    if (off)
+      r = f->pwrite(buf + done, n - done, *off);
+    else
+      r = f->write(buf + done, n - done);
+    if (r <= 0)
+      break;
+    if (off)
+      *off += r;
+    done += r;
+  }
+  if (done == 0 && n != 0)
+    return -1;
+  return done;
+}
+
+int
+file::sendmsgs(struct kmsghdr *msgs, int n, int flags)
+{
+  char *b = kalloc("sendmsgbuf");
+  if (!b)
+    return -1;
+  auto cleanup = scoped_cleanup([b](){kfree(b);});
+
+  int i;
+  for (i = 0; i < n; i++) {
+    kmsghdr *m = &msgs[i];
+    if (m->nfiles || m->addrlen)
+      break;
+    size_t total = m->total();
+    m->len = 0;
+    while (m->len < total) {
+      size_t want = std::min(total - m->len, (size_t)PGSIZE);
+      if (m->gather(b, want, m->len) < 0)
+        return i ? i : -1;
+      ssize_t r = write(b, want);
+      if (r <= 0)
+        return i ? i : -1;
+      m->len += r;
+      // A short write ends the batch.
+      if ((size_t)r < want)
+        return i + 1;
+    }
+  }
+  return i ? i : -1;
+}
+
+int
+file::recvmsgs(struct kmsghdr *msgs, int n, int flags)
+{
+  if (n == 0)
+    return 0;
+
+  char *b = kalloc("recvmsgbuf");
+  if (!b)
+    return -1;
+  auto cleanup = scoped_cleanup([b](){kfree(b);});
+
+  // Stream reads don't have message boundaries, so fill one message
+  // with one read.
+  kmsghdr *m = &msgs[0];
+  size_t want = std::min(m->total(), (size_t)PGSIZE);
+  ssize_t r = read(b, want);
+  if (r < 0)
+    return -1;
+  if (m->scatter(b, r) < 0)
+    return -1;
+  m->len = r;
+  m->addrlen = 0;
+  m->nfiles = 0;
+  m->flags = 0;
+  return 1;
+}
+
+ssize_t
+file::splice_to(file *out, off_t *off, off_t *outoff, size_t n)
+{
+  char *b = kalloc("splicebuf");
+  if (!b)
+    return -1;
+  auto cleanup = scoped_cleanup([b](){kfree(b);});
+
+  size_t done = 0;
+  while (done < n && !myproc()->killed) {
+    size_t want = std::min(n - done, (size_t)PGSIZE);
+    ssize_t r = off ? pread(b, want, *off) : read(b, want);
+    if (r < 0 && done == 0)
+      return -1;
+    if (r <= 0)
+      break;
+    // splice_write keeps writing until out has taken all r bytes or
+    // fails.
+    ssize_t w = splice_write(out, outoff, b, r);
+    if (w < 0)
+      w = 0;
+    if (off) {
+      // What out didn't take is still in the source.
+      *off += w;
+      done += w;
+    } else {
+      // We can't put back what out didn't take, so count everything
+      // we consumed, or the caller would think it's still there.
+      done += r;
+    }
+    if (w < r) {
+      if (done == 0)
+        return -1;
+      break;
+    }
+    // Don't wait on a pipe or socket for more than it had.
+    if ((size_t)r < want)
+      break;
+  }
+  return done;
+}
+
 
 int
 file_inode::stat(struct stat *st, enum stat_flags flags)
@@ -60,14 +187,12 @@ file_inode::read(char *addr, size_t n)
   } else if (ip->type() != mnode::types::file) {
     return -1;
   } else {
-    mfile::page_state ps = ip->as_file()->get_page(off / PGSIZE);
-    if (!ps.get_page_info())
-      return 0;
-
-    if (ps.is_partial_page() && off >= *ip->as_file()->read_size())
+    // Don't bother with the offset lock at EOF.
+    if (off >= *ip->as_file()->read_size())
       return 0;
 
     l = off_lock.guard();
+    ip->as_file()->read_hint(&ra, off, n);
     r = readi(ip, addr, off, n);
   }
   if (r > 0)
@@ -96,14 +221,19 @@ file_inode::write(const char *addr, size_t n)
       return -1;
     }
   } else if (ip->type() == mnode::types::file) {
-    l = off_lock.guard();
-    mfile::resizer resize;
     if (append) {
-      resize = ip->as_file()->write_size();
-      off = resize.read_size();
+      // Appends reserve their own range at EOF, so they don't need
+      // the offset lock.  Concurrent appenders through this file
+      // race to set off, but it lands at the end of one of them.
+      u64 start;
+      r = appendi(ip, addr, n, &start);
+      if (r > 0)
+        off = start + r;
+      return r;
     }
 
-    r = writei(ip, addr, off, n, append ? &resize : nullptr);
+    l = off_lock.guard();
+    r = writei(ip, addr, off, n);
   } else {
     return -1;
   }
@@ -124,6 +254,8 @@ file_inode::pread(char *addr, size_t n, off_t off)
       return -1;
     return devsw[major].pread(ip->as_dev(), addr, off, n);
   }
+  if (ip->type() == mnode::types::file)
+    ip->as_file()->read_hint(&ra, off, n);
   return readi(ip, addr, off, n);
 }
 
@@ -141,6 +273,66 @@ file_inode::pwrite(const char *addr, size_t n, off_t off)
   return writei(ip, addr, off, n);
 }
 
+ssize_t
+file_inode::splice_to(file *out, off_t *off, off_t *outoff, size_t n)
+{
+  if (!readable)
+    return -1;
+  if (ip->type() != mnode::types::file)
+    return file::splice_to(out, off, outoff, n);
+
+  mfile *mf = ip->as_file();
+  lock_guard<sleeplock> l;
+  u64 pos;
+  if (off) {
+    if (*off < 0)
+      return -1;
+    pos = *off;
+  } else {
+    l = off_lock.guard();
+    pos = this->off;
+  }
+
+  u64 size = *mf->read_size();
+  if (pos >= size)
+    return 0;
+  if (n > size - pos)
+    n = size - pos;
+  mf->read_hint(&ra, pos, n);
+
+  size_t done = 0;
+  bool failed = false;
+  while (done < n && !myproc()->killed) {
+    u64 cur = pos + done;
+    u64 pgoff = cur % PGSIZE;
+    size_t len = std::min(n - done, (size_t)(PGSIZE - pgoff));
+
+    // The page_state holds a reference to the page, so it can't be
+    // freed under the write even if it's evicted or truncated away.
+    // Holes read as zeroes.
+    mfile::page_state ps = mf->get_page(cur / PGSIZE);
+    sref<page_info> pi = ps.get_page_info();
+    if (!pi)
+      pi = mfile::zero_page;
+    ssize_t w = splice_write(out, outoff, (const char*)pi->va() + pgoff, len);
+    if (w < 0) {
+      failed = true;
+      break;
+    }
+    done += w;
+    if ((size_t)w < len)
+      break;
+  }
+
+  if (off)
+    *off = pos + done;
+  else
+    this->off = pos + done;
+  if (done == 0 && failed)
+    return -1;
+  return done;
+}
+
 
 int
 file_pipe_reader::stat(struct stat *st, enum stat_flags flags)
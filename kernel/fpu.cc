@@ -0,0 +1,225 @@
+// Lazy switching of user FPU, SSE, AVX, and AVX-512 state.
+//
+// A proc that has used the FPU has an XSAVE area in fpu_state.  A
+// CPU's FPU registers hold the state of its fpu_owner, and a proc's
+// fpu_cpu says which CPU last loaded its state, so a proc's state is
+// live on a CPU only if the two agree.  We save a proc's state when
+// it's switched out after it could have used the FPU (XSAVEOPT and
+// XSAVES only write the components it actually changed), so the copy
+// in fpu_state is current whenever the proc isn't running.  When it
+// next runs, it takes a #NM trap to load its state only if it uses
+// the FPU and its state isn't already live on that CPU.
+//
+// Procs that trap for the FPU in FPU_EAGER_SLICES consecutive time
+// slices are FPU-heavy, and we load their state when we switch to
+// them instead of waiting for the trap.  The count keeps going up
+// with each eager switch until it wraps, which drops the proc back to
+// lazy mode to see if it still needs the FPU.
+
+#include "types.h"
+#include "kernel.hh"
+#include "amd64.h"
+#include "bits.hh"
+#include "cpu.hh"
+#include "spinlock.hh"
+#include "condvar.hh"
+#include "proc.hh"
+#include "kstream.hh"
+#include "cpuid.hh"
+#include "log2.hh"
+
+enum { FPU_EAGER_SLICES = 5 };
+
+static enum {
+  FPU_FXSAVE, FPU_XSAVE, FPU_XSAVEOPT, FPU_XSAVES
+} fpu_mode;
+
+// State components we enable in XCR0
+static u64 fpu_xfeatures;
+
+// Bytes in a proc's fpu_state
+static size_t fpu_state_size;
+
+// The state of a freshly initialized FPU, which each proc starts with
+static char fpu_initial_state[4096] __attribute__((aligned(64)));
+
+static void
+fpu_save(void *area)
+{
+  switch (fpu_mode) {
+  case FPU_FXSAVE:
+    fxsave(area);
+    break;
+  case FPU_XSAVE:
+    xsave(area, fpu_xfeatures);
+    break;
+  case FPU_XSAVEOPT:
+    xsaveopt(area, fpu_xfeatures);
+    break;
+  case FPU_XSAVES:
+    xsaves(area, fpu_xfeatures);
+    break;
+  }
+}
+
+static void
+fpu_restore(void *area)
+{
+  switch (fpu_mode) {
+  case FPU_FXSAVE:
+    fxrstor(area);
+    break;
+  case FPU_XSAVE:
+  case FPU_XSAVEOPT:
+    xrstor(area, fpu_xfeatures);
+    break;
+  case FPU_XSAVES:
+    xrstors(area, fpu_xfeatures);
+    break;
+  }
+}
+
+// Make p's state live on this CPU.  TS must be clear.
+static void
+fpu_load(proc *p)
+{
+  fpu_restore(p->fpu_state);
+  mycpu()->fpu_owner = p;
+  p->fpu_cpu = myid();
+}
+
+void
+initfpu(void)
+{
+  // Allow ourselves to use FPU instructions.  We'll set TS again
+  // before we schedule anything.
+  lcr0(rcr0() & ~(CR0_TS | CR0_EM));
+
+  auto &f = cpuid::features();
+  if (f.xsave) {
+    lcr4(rcr4() | CR4_OSXSAVE);
+    if (myid() == 0) {
+      // x87 and SSE, plus whatever vector state the CPU supports.
+      // AVX-512's components only work with AVX and each other.
+      cpuid::leaf l = cpuid::get_leaf(cpuid::leafid::ext_state);
+      u64 supported = l.a | ((u64)l.d << 32);
+      fpu_xfeatures = XFEATURE_X87 | XFEATURE_SSE;
+      if (f.avx && (supported & XFEATURE_AVX)) {
+        fpu_xfeatures |= XFEATURE_AVX;
+        if (f.avx512f && (supported & XFEATURE_AVX512) == XFEATURE_AVX512)
+          fpu_xfeatures |= XFEATURE_AVX512;
+      }
+    }
+    xsetbv(0, fpu_xfeatures);
+    // We don't manage any supervisor state.
+    if (f.xsaves)
+      writemsr(MSR_IA32_XSS, 0);
+  }
+
+  // Initialize FPU, ignoring pending FP exceptions
+  fninit();
+  // Don't generate interrupts for any SSE exceptions
+  ldmxcsr(0x1f80);
+
+  if (myid() != 0)
+    return;
+
+  // The XSAVE area sizes depend on XCR0, so re-read leaf 0xD now.
+  size_t size;
+  if (!f.xsave) {
+    fpu_mode = FPU_FXSAVE;
+    size = FXSAVE_BYTES;
+  } else if (f.xsaves) {
+    fpu_mode = FPU_XSAVES;
+    size = cpuid::get_leaf(cpuid::leafid::ext_state, 1, true).b;
+  } else {
+    fpu_mode = f.xsaveopt ? FPU_XSAVEOPT : FPU_XSAVE;
+    size = cpuid::get_leaf(cpuid::leafid::ext_state, 0, true).b;
+  }
+  if (size > sizeof(fpu_initial_state))
+    panic("initfpu: %lu byte XSAVE area", size);
+  // kmalloc aligns power-of-two sizes, and XSAVE needs 64 bytes.
+  fpu_state_size = round_up_to_pow2(size);
+
+  // Stash away the initial FPU state to use as each process' initial
+  // FPU state
+  fpu_save(fpu_initial_state);
+
+  static const char *names[] = {"fxsave", "xsave", "xsaveopt", "xsaves"};
+  cprintf("fpu: %s, xfeatures 0x%lx, %lu byte state\n",
+          names[fpu_mode], fpu_xfeatures, size);
+}
+
+// Switch the FPU from prev to next.  Called by the scheduler with
+// interrupts disabled, just before it switches stacks.
+void
+fpu_switch(proc *prev, proc *next)
+{
+  cpu *c = mycpu();
+  u64 cr0 = rcr0();
+
+  // TS is clear if prev could have used the FPU during its time
+  // slice.  Otherwise it certainly didn't, so it's not FPU-heavy.
+  if (!(cr0 & CR0_TS)) {
+    if (c->fpu_owner == prev && prev->fpu_state)
+      fpu_save(prev->fpu_state);
+  } else {
+    prev->fpu_counter = 0;
+  }
+
+  bool live = c->fpu_owner == next && next->fpu_cpu == myid();
+  bool eager = !live && next->fpu_counter >= FPU_EAGER_SLICES;
+
+  // Clear TS if next can use the FPU right away.  Otherwise set it,
+  // along with MP, and clear EM, so we get a #NM exception if next
+  // tries to use FPU or SIMD instructions.
+  u64 ncr0 = (cr0 | CR0_MP) & ~CR0_EM;
+  if (live || eager)
+    ncr0 &= ~CR0_TS;
+  else
+    ncr0 |= CR0_TS;
+  if (cr0 != ncr0)
+    lcr0(ncr0);
+
+  if (eager) {
+    fpu_load(next);
+    next->fpu_counter++;
+  }
+}
+
+// Handle a #NM exception: myproc() used the FPU with TS set.
+void
+fpu_trap(void)
+{
+  proc *p = myproc();
+
+  // Clear "task switched" flag to enable floating-point instructions.
+  // fpu_switch will set it again when it switches tasks.
+  clts();
+
+  // Lazily allocate p's FPU state.  Whoever owned the FPU before
+  // already saved theirs when they were switched out.
+  if (!p->fpu_state) {
+    p->fpu_state = kmalloc(fpu_state_size, "(xsave)");
+    if (!p->fpu_state) {
+      console.println("out of memory allocating xsave region");
+      p->killed = 1;
+      return;
+    }
+    assert((uptr)p->fpu_state % 64 == 0);
+    memmove(p->fpu_state, fpu_initial_state, fpu_state_size);
+  }
+
+  if (mycpu()->fpu_owner != p || p->fpu_cpu != myid())
+    fpu_load(p);
+  if (p->fpu_counter < FPU_EAGER_SLICES)
+    p->fpu_counter++;
+}
+
+void
+fpu_free(proc *p)
+{
+  if (p->fpu_state)
+    kmfree(p->fpu_state, fpu_state_size);
+  p->fpu_state = nullptr;
+}
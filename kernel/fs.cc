@@ -35,6 +35,7 @@
 #include "proc.hh"
 #include "fs.h"
 #include "buf.hh"
+#include "disk.hh"
 #include "file.hh"
 #include "cpu.hh"
 #include "kmtrace.hh"
@@ -870,6 +871,43 @@ readi(sref<inode> ip, char *dst, u32 off, u32 n)
   return n;
 }
 
+// Read blocks [bn, bn+n) of ip straight into dsts[0..n), each of
+// which must hold BSIZE bytes, without going through the buffer
+// cache.  Blocks that are contiguous on disk go to the disk as one
+// request, up to DISK_REQMAX bytes.  This is for file data that is
+// cached elsewhere (the mfs page cache), so it must never be used on
+// blocks that may be dirty in the buffer cache.
+void
+readblocks_direct(sref<inode> ip, char **dsts, u32 bn, u32 n)
+{
+  scoped_gc_epoch e;
+
+  kiovec iov[DISK_REQMAX / BSIZE];
+  int iovcnt = 0;
+  u32 start = 0;
+  for (u32 i = 0; i < n; i++) {
+    u32 addr;
+    try {
+      addr = bmap(ip, bn + i);
+    } catch (out_of_blocks& e) {
+      // Read operations should never cause out-of-blocks conditions
+      panic("readblocks_direct: out of blocks");
+    }
+
+    if (iovcnt && (addr != start + iovcnt || iovcnt == (int)NELEM(iov))) {
+      idereadv(ip->dev, iov, iovcnt, (u64)start * BSIZE);
+      iovcnt = 0;
+    }
+    if (iovcnt == 0)
+      start = addr;
+    iov[iovcnt].iov_base = dsts[i];
+    iov[iovcnt].iov_len = BSIZE;
+    iovcnt++;
+  }
+  if (iovcnt)
+    idereadv(ip->dev, iov, iovcnt, (u64)start * BSIZE);
+}
+
 // PAGEBREAK!
 // Write data to inode.
 int
@@ -6,6 +6,7 @@
 #include "spinlock.hh"
 #include "amd64.h"
 #include "traps.h"
+#include "disk.hh"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
@@ -97,6 +98,16 @@ idewrite(u32 dev, const char* data, u64 count, u64 offset)
   assert(idewait(1) >= 0);
 }
 
+// PIO can only do one contiguous buffer at a time.
+void
+idereadv(u32 dev, kiovec* iov, int iovcnt, u64 offset)
+{
+  for (int i = 0; i < iovcnt; i++) {
+    ideread(dev, (char*)iov[i].iov_base, iov[i].iov_len, offset);
+    offset += iov[i].iov_len;
+  }
+}
+
 void
 ideintr(void)
 {
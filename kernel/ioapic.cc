@@ -186,7 +186,8 @@ ioapic_82093::enable_irq(const struct irq &irq, bool enable)
 {
   assert(irq.valid());
   assert(irq.vector >= 32 && irq.vector < 256);
-  assert(irq.vector != T_TLBFLUSH && irq.vector != T_SAMPCONF);
+  assert(irq.vector != T_TLBFLUSH && irq.vector != T_SAMPCONF &&
+         irq.vector != T_IPICALL && irq.vector != T_RESCHED);
 
   int pin;
   auto ioapic = map_gsi(irq.gsi, &pin);
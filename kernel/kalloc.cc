@@ -22,6 +22,7 @@
 #include "file.hh"
 #include "major.h"
 #include "heapprof.hh"
+#include "reclaim.hh"
 
 #include <algorithm>
 #include <iterator>
@@ -45,10 +46,13 @@ struct locked_buddy
   // another overlapping buddy.
   size_t free_limit;
   buddy_allocator alloc;
+  // The NUMA node whose memory this allocator manages.  Reclaim for
+  // this allocator has to happen on that node.
+  int node;
   __padout__;
 
-  locked_buddy(buddy_allocator &&alloc)
-    : lock(spinlock("buddy")), alloc(std::move(alloc))
+  locked_buddy(buddy_allocator &&alloc, int node)
+    : lock(spinlock("buddy")), alloc(std::move(alloc)), node(node)
   {
     free_limit = alloc.get_free_bytes();
   }
@@ -56,6 +60,11 @@ struct locked_buddy
 
 static static_vector<locked_buddy, MAX_BUDDIES> buddies;
 
+// The buddies [low, high) that hold each NUMA node's memory.
+static struct {
+  size_t low, high;
+} node_buddy_range[MAX_NUMA_NODES];
+
 struct mempool : public balance_pool<mempool> {
   int buddy_;      // the buddy allocator this pool; it can contain any phys mem
   uintptr_t base_; // base this pool's local memory
@@ -354,6 +363,7 @@ struct memory {
       return (char*)res;
     } else {
       cprintf("kalloc: out of memory\n");
+      reclaim_kick(buddies[mempools[mem->mempool].buddy_].node);
       return nullptr;
     }
   }
@@ -673,6 +683,20 @@ kmemprint(print_stream *s)
   s->println();
 }
 
+// Return the number of free pages in node in *nfree and the number it
+// started with in *ntotal.
+void
+kmem_node_pages(int node, size_t *nfree, size_t *ntotal)
+{
+  *nfree = *ntotal = 0;
+  auto &range = node_buddy_range[node];
+  for (size_t b = range.low; b < range.high; ++b) {
+    auto l = buddies[b].lock.guard();
+    *nfree += buddies[b].alloc.get_free_bytes() / PGSIZE;
+    *ntotal += buddies[b].free_limit / PGSIZE;
+  }
+}
+
 static int
 kmemstatsread(mdev*, char *dst, u32 off, u32 n)
 {
@@ -731,6 +755,9 @@ kalloc(const char *name, size_t size)
           mem->hot_pages[mem->nhot++] = page;
         }
       }
+      // Refills are rare enough to check the watermark here.
+      if (lb->alloc.get_free_bytes() < lb->free_limit / RECLAIM_LOW_DIV)
+        reclaim_kick(lb->node);
       source = "refilled hot list";
     }
     res = mem->hot_pages[--mem->nhot];
@@ -788,6 +815,10 @@ kalloc(const char *name, size_t size)
     return (char*)res;
   } else {
     cprintf("kalloc: out of memory\n");
+    // Every buddy we could steal from came up short, so they all need
+    // reclaim.  Kicks to the same node coalesce.
+    for (auto idx : mycpu()->mem->steal)
+      reclaim_kick(buddies[idx].node);
     if (KERNEL_HEAP_PROFILE)
       heap_profile_print(&console);
     return nullptr;
@@ -1040,7 +1071,7 @@ initkalloc(void)
           node_stats.metadata_bytes += stats.metadata_bytes;
           node_stats.waste_bytes += stats.waste_bytes;
           // Add to buddies
-          buddies.emplace_back(std::move(buddy));
+          buddies.emplace_back(std::move(buddy), node.id);
           allmem.add(buddies.size()-1, p2v(remaining.base), subsize);
         }
         // XXX(Austin) It would be better if we knew what free_init
@@ -1049,6 +1080,8 @@ initkalloc(void)
       }
     }
     size_t node_buddies = buddies.size() - node_low;
+    node_buddy_range[node.id].low = node_low;
+    node_buddy_range[node.id].high = buddies.size();
 
     console.println("kalloc: ", ssize(node_stats.free), " available in node ",
                     node.id,
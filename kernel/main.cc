@@ -37,6 +37,7 @@ void initrcu(void);
 void initproc(void);
 void initinode(void);
 void initdisk(void);
+void initbio(void);
 void inituser(void);
 void initsamp(void);
 void inite1000(void);
@@ -60,7 +61,10 @@ void initwd(void);
 void initdev(void);
 void inithpet(void);
 void initrtc(void);
+void initclockpage(void);
 void initmfs(void);
+void initwork(void);
+void initreclaim(void);
 void idleloop(void);
 
 #define IO_RTC  0x70
@@ -221,8 +225,10 @@ cmain(u64 mbmagic, u64 mbaddr)
   initproc();      // process table
   initsched();     // scheduler run queues
   initidle();
+  initwork();      // deferred work queues and workers
   initgc();        // gc epochs and threads
   initrefcache();  // Requires initsched
+  initreclaim();   // Requires initwork
   initconsole();
   initfutex();
   initsamp();
@@ -233,8 +239,10 @@ cmain(u64 mbmagic, u64 mbaddr)
   initpci();               // Suggests initacpi
   initnet();
   initrtc();               // Requires inithpet
+  initclockpage();         // Requires inithz, initrtc, initz
   initdev();               // Misc /dev nodes
   initdisk();      // disk
+  initbio();       // buffer cache
   initinode();     // inode cache
   initmfs();
 
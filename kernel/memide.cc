@@ -11,6 +11,7 @@
 #include "traps.h"
 
 #include "buf.hh"
+#include "disk.hh"
 
 extern u8 _fs_img_start[];
 extern u64 _fs_img_size;
@@ -60,4 +61,13 @@ idewrite(u32 dev, const char* data, u64 count, u64 offset)
   memmove(p, data, count);
 }
 
+void
+idereadv(u32 dev, kiovec* iov, int iovcnt, u64 offset)
+{
+  for (int i = 0; i < iovcnt; i++) {
+    ideread(dev, (char*)iov[i].iov_base, iov[i].iov_len, offset);
+    offset += iov[i].iov_len;
+  }
+}
+
 #endif  /* MEMIDE */
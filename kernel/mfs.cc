@@ -54,15 +54,23 @@ skipelem(const char **rpath, char *name)
 
 // Look up and return the mnode for a path name.  If nameiparent is true,
 // return the mnode for the parent and copy the final path element into name.
+//
+// The walk takes no references on the directories along the way; only
+// the result gets one.  It runs under cli, which keeps refcache from
+// freeing any mnode we reach through a directory entry (see
+// mdir::entry), and each lookup retries if a rename races with it.
 static sref<mnode>
 namex(sref<mnode> cwd, const char* path, bool nameiparent, strbuf<DIRSIZ>* name)
 {
-  sref<mnode> m;
+  sref<mnode> start;
 
   if (*path == '/')
-    m = root_fs->get(root_inum);
+    start = root_fs->get(root_inum);
   else
-    m = cwd;
+    start = cwd;
+
+  scoped_cli cli;
+  mnode* m = start.get();
 
   int r;
   while ((r = skipelem(&path, name->buf_)) == 1) {
@@ -71,11 +79,11 @@ namex(sref<mnode> cwd, const char* path, bool nameiparent, strbuf<DIRSIZ>* name)
 
     if (nameiparent && *path == '\0') {
       // Stop one level early.
-      return m;
+      return sref<mnode>::newref(m);
     }
 
-    sref<mnode> next = m->as_dir()->lookup(*name);
-    if (!next)
+    mnode* next;
+    if (!m->as_dir()->lookup_noref(*name, &next))
       return sref<mnode>();
 
     m = next;
@@ -84,7 +92,7 @@ namex(sref<mnode> cwd, const char* path, bool nameiparent, strbuf<DIRSIZ>* name)
   if (r == -1 || nameiparent)
     return sref<mnode>();
 
-  return m;
+  return sref<mnode>::newref(m);
 }
 
 sref<mnode>
@@ -106,45 +114,50 @@ readi(sref<mnode> m, char* buf, u64 start, u64 nbytes)
   if (m->type() != mnode::types::file)
     return -1;
 
+  // Pages past EOF may be set while appends are in flight, so a set
+  // page doesn't mean there's data there.  Check the size once.
+  u64 msize = *m->as_file()->read_size();
+  if (start >= msize)
+    return 0;
   u64 end = start + nbytes;
+  if (end > msize)
+    end = msize;
+
   u64 off = 0;
   while (start + off < end) {
     u64 pos = start + off;
     u64 pgbase = PGROUNDDOWN(pos);
-
-    mfile::page_state ps = m->as_file()->get_page(pgbase / PGSIZE);
-    sref<page_info> pi = ps.get_page_info();
-    if (!pi)
-      break;
-
-    if (ps.is_partial_page()) {
-      u64 msize = *m->as_file()->read_size();
-      if (end > msize)
-        end = msize;
-      // Re-check loop condition, since end changed
-      if (pos >= end)
-        break;
-    }
-
     u64 pgoff = pos - pgbase;
     u64 pgend = end - pgbase;
     if (pgend > PGSIZE)
       pgend = PGSIZE;
 
-    memmove(buf + off, (const char*) pi->va() + pgoff, pgend - pgoff);
+    // Holes read as zeroes.
+    mfile::page_state ps = m->as_file()->get_page(pgbase / PGSIZE);
+    sref<page_info> pi = ps.get_page_info();
+    if (pi)
+      memmove(buf + off, (const char*) pi->va() + pgoff, pgend - pgoff);
+    else
+      memset(buf + off, 0, pgend - pgoff);
     off += (pgend - pgoff);
   }
 
   return off;
 }
 
-s64
-writei(sref<mnode> m, const char* buf, u64 start, u64 nbytes,
-       mfile::resizer* parentresize)
+// Copy buf into [start, start+nbytes) of mf, filling holes with the
+// zeroed pages in newpages (and allocating more if newpages runs out).
+// The caller must hold a resizer or an append reservation covering
+// the range if it is past EOF.  If may_load is false, the caller
+// can't sleep and must already have pinned every page in the range
+// that comes from the backing inode.  Returns the number of bytes
+// copied, which is short only if we ran out of memory or the file
+// shrank.
+static u64
+fill_range(mfile* mf, const char* buf, u64 start, u64 nbytes,
+           bool check_eof, bool may_load,
+           char** newpages, size_t* nnewpages)
 {
-  if (m->type() != mnode::types::file)
-    return -1;
-
   u64 end = start + nbytes;
   u64 off = 0;
   while (start + off < end) {
@@ -155,76 +168,128 @@ writei(sref<mnode> m, const char* buf, u64 start, u64 nbytes,
     if (pgend > PGSIZE)
       pgend = PGSIZE;
 
-    mfile::resizer *resize = parentresize;
-    mfile::resizer scoped_resize;
-
-    mfile::page_state ps = m->as_file()->get_page(pgbase / PGSIZE);
+    // Written pages differ from the disk, so they stay in memory.
+    mfile::page_state ps = mf->dirty_page(pgbase / PGSIZE, may_load);
     sref<page_info> pi = ps.get_page_info();
-    if (pi) {
-      /* File already has the page we are about to update */
-      if (ps.is_partial_page() && resize == nullptr) {
-        if (pos + pgend - pgoff > *m->as_file()->read_size()) {
-          scoped_resize = m->as_file()->write_size();
-          resize = &scoped_resize;
-        }
-      }
-
-      /*
-       * What happens when writing past the end of the file but within
-       * the file's last page?  One worry might be that we're exposing
-       * some non-zero bytes left over in the part of the last page that
-       * is past the end of the file.  Our plan is to ensure that any
-       * file truncate zeroes out any partial pages.  Currently, we only
-       * have O_TRUNC, which discards all pages.
-       */
-
-      memmove((char*) pi->va() + pgoff, buf + off, pgend - pgoff);
-      if (resize && *resize)
-        resize->resize_nogrow(pos + pgend - pgoff);
-    } else {
-      /* File does not yet have the page we are about to update */
-      if (!resize) {
-        scoped_resize = m->as_file()->write_size();
-        resize = &scoped_resize;
-      }
-
-      /*
-       * If this is a write past the end of the file, we may need
-       * to first zero out some memory locations, or even fill in
-       * a few zero pages.  We do not support sparse files -- the
-       * holes are filled in with zeroed pages.
-       */
-      u64 msize = resize->read_size();
-      while (msize < pgbase) {
-        if (msize % PGSIZE) {
-          resize->resize_nogrow(msize - (msize % PGSIZE) + PGSIZE);
-        } else {
-          char* p = zalloc("file page");
-          if (!p)
-            break;
-
-          pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
-          resize->resize_append(msize + PGSIZE, pi);
-        }
-
-        msize = resize->read_size();
-      }
-
-      char* p = zalloc("file page");
+    if (!pi) {
+      assert(!mf->is_backed(pgbase / PGSIZE));
+      char* p = *nnewpages ? newpages[--*nnewpages] : zalloc("file page");
       if (!p)
         break;
-
-      memmove(p + pgoff, buf + off, pgend - pgoff);
-      pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
-      resize->resize_append(pos + pgend - pgoff, pi);
+      // Someone else may fill the hole first, in which case we write
+      // to their page and ours gets freed.
+      pi = mf->install_page(
+        pgbase / PGSIZE,
+        sref<page_info>::transfer(new (page_info::of(p)) page_info()),
+        check_eof).get_page_info();
+      if (!pi)
+        break;
     }
 
+    /*
+     * What happens when writing past the end of the file but within
+     * the file's last page?  One worry might be that we're exposing
+     * some non-zero bytes left over in the part of the last page that
+     * is past the end of the file.  This can't happen because
+     * resizer::resize zeroes the tail of the last page whenever it
+     * shrinks a file.
+     */
+    memmove((char*) pi->va() + pgoff, buf + off, pgend - pgoff);
     off += (pgend - pgoff);
   }
+  return off;
+}
+
+s64
+writei(sref<mnode> m, const char* buf, u64 start, u64 nbytes)
+{
+  if (m->type() != mnode::types::file)
+    return -1;
+
+  mfile* mf = m->as_file();
+  u64 end = start + nbytes;
+
+  // A write that extends the file holds the resize lock until it has
+  // filled every page, so the new size never covers data that isn't
+  // there yet.  Other writes only lock the pages they fill.
+  mfile::resizer resize;
+  if (end > *mf->read_size()) {
+    // The resize lock is a spinlock, so read in any pages we need
+    // from the backing inode first.
+    for (u64 idx = start / PGSIZE;
+         idx < PGROUNDUP(end) / PGSIZE && mf->is_backed(idx); idx++)
+      mf->dirty_page(idx);
+
+    resize = mf->write_size();
+    if (end <= resize.read_size())
+      resize = mfile::resizer();
+  }
 
+  size_t nnew = 0;
+  u64 off = fill_range(mf, buf, start, nbytes, !resize, !resize,
+                       nullptr, &nnew);
+  if (resize && start + off > resize.read_size())
+    resize.resize(start + off);
   return off ?: -1;
 }
 
+s64
+appendi(sref<mnode> m, const char* buf, u64 nbytes, u64* startp)
+{
+  if (m->type() != mnode::types::file)
+    return -1;
+  if (nbytes == 0) {
+    *startp = *m->as_file()->read_size();
+    return 0;
+  }
+
+  mfile* mf = m->as_file();
+  if (nbytes > APPEND_MAX_PAGES * PGSIZE)
+    nbytes = APPEND_MAX_PAGES * PGSIZE;
+
+  // Once we've reserved a range, we have to fill all of it, so
+  // allocate every page the range could need up front.  The range
+  // may straddle one more page boundary than its length suggests.
+  char* newpages[APPEND_MAX_PAGES + 1];
+  size_t nnew = 0;
+  size_t want = PGROUNDUP(nbytes) / PGSIZE + 1;
+  for (; nnew < want; nnew++) {
+    newpages[nnew] = zalloc("file page");
+    if (!newpages[nnew])
+      break;
+  }
+
+  u64 start = 0, off = 0;
+  while (nnew == want) {
+    // The append will start in the page holding the current EOF,
+    // which may need to be read in, and we can't sleep once we've
+    // reserved.  If a truncate moves EOF to another page before we
+    // reserve, pin that one and try again.
+    u64 eofpg = *mf->read_size() / PGSIZE;
+    if (mf->is_backed(eofpg))
+      mf->dirty_page(eofpg);
+
+    // Other appenders wait for us to commit, and so may a resizer
+    // holding resize_lock_, so don't get preempted until we do.
+    scoped_cli cli;
+    if (!mf->reserve_append(nbytes, eofpg, &start))
+      continue;
+    off = fill_range(mf, buf, start, nbytes, false, false, newpages, &nnew);
+    assert(off == nbytes);
+    mf->commit_append(start, nbytes);
+    break;
+  }
+
+  // The unused pages are still zeroed.
+  while (nnew)
+    zfree(newpages[--nnew]);
+
+  if (off == 0)
+    return -1;
+  *startp = start;
+  return off;
+}
+
 static int
 mfsstatsread(mdev*, char *dst, u32 off, u32 n)
 {
@@ -236,5 +301,10 @@ mfsstatsread(mdev*, char *dst, u32 off, u32 n)
 void
 initmfs(void)
 {
+  char* p = zalloc("zero page");
+  if (!p)
+    panic("initmfs: zalloc");
+  mfile::zero_page = sref<page_info>::transfer(new (page_info::of(p)) page_info());
   devsw[MAJ_MFSSTATS].pread = mfsstatsread;
+  initmnode();
 }
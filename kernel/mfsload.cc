@@ -30,23 +30,12 @@ load_dir(sref<inode> i, sref<mnode> m)
   }
 }
 
+// File data isn't copied in here.  The file's pages are read in from
+// the inode on first use, and can be evicted again while clean.
 static void
 load_file(sref<inode> i, sref<mnode> m)
 {
-  for (size_t pos = 0; pos < i->size; pos += PGSIZE) {
-    char* p = zalloc("load_file");
-    assert(p);
-
-    auto pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
-
-    size_t nbytes = i->size - pos;
-    if (nbytes > PGSIZE)
-      nbytes = PGSIZE;
-
-    assert(nbytes == readi(i, p, pos, nbytes));
-    auto resize = m->as_file()->write_size();
-    resize.resize_append(pos + nbytes, pi);
-  }
+  m->as_file()->set_backing(i->dev, i->inum, i->size);
 }
 
 static sref<mnode>
@@ -1,13 +1,44 @@
 #include "types.h"
 #include "kernel.hh"
+#include "fs.h"
 #include "mnode.hh"
+#include "file.hh"
 #include "weakcache.hh"
 #include "atomic_util.hh"
 #include "percpu.hh"
+#include "reclaim.hh"
+#include "cpu.hh"
+#include "work.hh"
 
 namespace {
   // 32MB icache (XXX make this proportional to physical RAM)
   weakcache<pair<mfs*, u64>, mnode> mnode_cache(32 << 20);
+
+  // Files with pages read in from disk, for reclaiming clean pages.
+  clock_list<mfile, &mfile::clock_link_> file_clock;
+
+  // The most pages of one file the clock sweeps before moving on to
+  // the next file.
+  enum { FILE_CLOCK_SLICE = 64 };
+
+  struct file_shrinker : public shrinker
+  {
+    file_shrinker() : shrinker("file pages") { }
+
+    size_t
+    shrink(int node, size_t npages) override
+    {
+      size_t nfreed = 0;
+      file_clock.sweep(node, npages, [&](mfile* mf) {
+          if (nfreed < npages)
+            nfreed += mf->clock_sweep(FILE_CLOCK_SLICE);
+          return true;
+        });
+      return nfreed;
+    }
+  };
+
+  file_shrinker the_file_shrinker;
 };
 
 sref<mnode>
@@ -102,26 +133,82 @@ mnode::linkcount::onzero()
   m->cache_pin(false);
 }
 
+sref<page_info> mfile::zero_page;
+
+mfile::resizer::resizer(mfile* mf)
+  : lock_(&mf->resize_lock_), mf_(mf)
+{
+  // Stop new appends and wait for the ones in flight to commit.
+  // After this, we're the only one that can touch size_.
+  u64 reserved = mf->reserved_.fetch_or(RESERVE_FROZEN);
+  while (mf->committed_.load(std::memory_order_acquire) != reserved)
+    nop_pause();
+  writer_ = mf->size_seq_.write_begin();
+}
+
+mfile::resizer::resizer(resizer &&o)
+  : lock_(std::move(o.lock_)), writer_(std::move(o.writer_)), mf_(o.mf_)
+{
+  o.mf_ = nullptr;
+}
+
+mfile::resizer &
+mfile::resizer::operator=(resizer &&o)
+{
+  release();
+  lock_ = std::move(o.lock_);
+  writer_ = std::move(o.writer_);
+  mf_ = o.mf_;
+  o.mf_ = nullptr;
+  return *this;
+}
+
+void
+mfile::resizer::release()
+{
+  if (!mf_)
+    return;
+  writer_.done();
+  // Let appends start again at the new end of file.
+  mf_->committed_.store(mf_->size_, std::memory_order_relaxed);
+  mf_->reserved_.store(mf_->size_, std::memory_order_release);
+  lock_.release();
+  mf_ = nullptr;
+}
+
 void
-mfile::resizer::resize_nogrow(u64 newsize)
+mfile::resizer::resize(u64 newsize)
 {
   u64 oldsize = mf_->size_;
   mf_->size_ = newsize;
-  assert(PGROUNDUP(newsize) <= PGROUNDUP(oldsize));
-  auto begin = mf_->pages_.find(PGROUNDUP(newsize) / PGSIZE);
-  auto end = mf_->pages_.find(PGROUNDUP(oldsize) / PGSIZE);
-  auto lock = mf_->pages_.acquire(begin, end);
-  mf_->pages_.unset(begin, end);
-
-  if (PGROUNDDOWN(newsize) > PGROUNDDOWN(oldsize)) {
-    /* Grew to a multiple of PGSIZE */
-    mf_->pages_.find(oldsize / PGSIZE)->set_partial_page(false);
-  }
+  // Whatever the disk has past the new size is gone for good.  This
+  // has to happen before we drop pages, like size_; see load_page.
+  if (newsize < mf_->backing_size_)
+    mf_->backing_size_ = newsize;
+
+  if (newsize < oldsize) {
+    auto begin = mf_->pages_.find(PGROUNDUP(newsize) / PGSIZE);
+    auto end = mf_->pages_.find(PGROUNDUP(oldsize) / PGSIZE);
+    {
+      auto lock = mf_->pages_.acquire(begin, end);
+      mf_->pages_.unset(begin, end);
+    }
 
-  if (PGROUNDDOWN(newsize) < PGROUNDDOWN(oldsize) && PGOFFSET(newsize)) {
-    /* Shrunk, and last page is partial */
-    mf_->pages_.find(newsize / PGSIZE)->set_partial_page(true);
+    auto it = mf_->pages_.find(newsize / PGSIZE);
+    if (PGOFFSET(newsize) && it.is_set()) {
+      /*
+       * Shrunk, and last page is partial.  Zero out everything past
+       * the new end of file, so that growing the file again or
+       * writing past EOF exposes zeroes rather than old data.
+       */
+      u64 tail = oldsize < PGROUNDUP(newsize) ? PGOFFSET(oldsize) : PGSIZE;
+      memset((char*) it->get_page_info()->va() + PGOFFSET(newsize), 0,
+             tail - PGOFFSET(newsize));
+    }
   }
+
+  // The bytes past the old end of file are already zero, so growing
+  // just leaves a hole.
 }
 
 void
@@ -129,21 +216,37 @@ mfile::resizer::resize_append(u64 size, sref<page_info> pi)
 {
   assert(PGROUNDUP(mf_->size_) / PGSIZE + 1 == PGROUNDUP(size) / PGSIZE);
 
-  if (PGOFFSET(mf_->size_)) {
-    /* Also filled out last partial page */
-    mf_->pages_.find(mf_->size_ / PGSIZE)->set_partial_page(false);
-  }
+  u64 pageidx = PGROUNDUP(mf_->size_) / PGSIZE;
+  resize(size);
+  auto ps = mf_->install_page(pageidx, std::move(pi), false);
+  assert(ps.is_set());
+}
 
-  auto it = mf_->pages_.find(PGROUNDUP(mf_->size_) / PGSIZE);
-  // XXX This is rather unfortunate for the first write to a file
-  // since the fill will expand the lock to a huge range.  This would
-  // be a great place to use lock_for_fill if we had it.
-  auto lock = mf_->pages_.acquire(it);
-  page_state ps(pi);
-  if (PGOFFSET(size))
-    ps.set_partial_page(true);
-  mf_->pages_.fill(it, ps);
-  mf_->size_ = size;
+void
+mfile::set_backing(u32 dev, u32 inum, u64 size)
+{
+  auto resize = write_size();
+  assert(resize.read_size() == 0);
+  backing_dev_ = dev;
+  backing_inum_ = inum;
+  backing_size_ = size;
+  resize.resize(size);
+}
+
+mfile::~mfile()
+{
+  if (on_clock_)
+    file_clock.remove(clock_node_, this);
+}
+
+mfile::page_state
+mfile::get_cached_page(u64 pageidx)
+{
+  auto it = pages_.find(pageidx);
+  if (!it.is_set())
+    return mfile::page_state();
+  it->set_referenced();
+  return it->copy_consistent();
 }
 
 mfile::page_state
@@ -151,16 +254,336 @@ mfile::get_page(u64 pageidx)
 {
   auto it = pages_.find(pageidx);
   if (!it.is_set()) {
-    if (pageidx < PGROUNDUP(size_) / PGSIZE) {
-      // XXX read from disk
-    }
-
+    if (is_backed(pageidx))
+      return load_page(pageidx);
     return mfile::page_state();
   }
 
+  it->set_referenced();
   return it->copy_consistent();
 }
 
+// Read the page at pageidx in from the backing inode.  Disk blocks
+// are page-sized, so this is one block, read straight into the new
+// page without going through the buffer cache.
+mfile::page_state
+mfile::load_page(u64 pageidx)
+{
+  static_assert(BSIZE == PGSIZE, "file pages must be one disk block");
+
+  char* p = zalloc("file page");
+  if (!p)
+    throw_bad_alloc();
+  readblocks_direct(iget(backing_dev_, backing_inum_), &p, pageidx, 1);
+  install_loaded(pageidx, p);
+  return get_cached_page(pageidx);
+}
+
+// Install p, freshly read in from the backing inode, at pageidx,
+// unless someone beat us to it.
+void
+mfile::install_loaded(u64 pageidx, char* p)
+{
+  auto pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
+
+  {
+    scoped_cli cli;
+    auto it = pages_.find(pageidx);
+    auto lock = pages_.acquire(it);
+    // A truncate may have raced with the disk read.  It lowers
+    // backing_size_ before it takes the page locks to drop pages, so
+    // checking under the page lock catches it.  Anything past
+    // backing_size_ in this page must read as zeroes.
+    if (!it.is_set() && is_backed(pageidx)) {
+      u64 valid = backing_size_ - pageidx * PGSIZE;
+      if (valid < PGSIZE)
+        memset(p + valid, 0, PGSIZE - valid);
+      pages_.fill(it, page_state(pi));
+    }
+  }
+  join_clock();
+}
+
+void
+mfile::readahead(u64 pageidx, u64 npages)
+{
+  u64 end = PGROUNDUP(backing_size_) / PGSIZE;
+  if (pageidx >= end)
+    return;
+  if (npages < end - pageidx)
+    end = pageidx + npages;
+
+  sref<inode> ip;
+  while (pageidx < end) {
+    if (pages_.find(pageidx).is_set()) {
+      pageidx++;
+      continue;
+    }
+
+    // Read the next run of missing pages in one go.
+    char* pages[RA_MAX_PAGES];
+    u32 n = 0;
+    for (; n < RA_MAX_PAGES && pageidx + n < end &&
+           !pages_.find(pageidx + n).is_set(); n++) {
+      pages[n] = zalloc("file page");
+      if (!pages[n])
+        break;
+    }
+    if (n == 0)
+      // Out of memory.  Readahead is only a hint.
+      return;
+
+    if (!ip)
+      ip = iget(backing_dev_, backing_inum_);
+    readblocks_direct(ip, pages, pageidx, n);
+    for (u32 i = 0; i < n; i++)
+      install_loaded(pageidx + i, pages[i]);
+    pageidx += n;
+  }
+}
+
+namespace {
+  struct readahead_work : public dwork
+  {
+    readahead_work(sref<mnode> m, u64 pageidx, u64 npages)
+      : dwork(WORK_NORMAL, true), m_(m), pageidx_(pageidx),
+        npages_(npages) { }
+
+    virtual void run() override {
+      m_->as_file()->readahead(pageidx_, npages_);
+      delete this;
+    }
+
+    sref<mnode> m_;
+    u64 pageidx_, npages_;
+
+    NEW_DELETE_OPS(readahead_work);
+  };
+}
+
+void
+mfile::readahead_async(u64 pageidx, u64 npages)
+{
+  if (!is_backed(pageidx))
+    return;
+  auto w = new (std::nothrow) readahead_work(sref<mnode>::newref(this),
+                                             pageidx, npages);
+  if (w)
+    dwork_push(w, myid());
+}
+
+void
+mfile::read_hint(readahead_state* ra, u64 off, u64 n)
+{
+  if (n == 0 || ra->mode == readahead_state::RANDOM)
+    return;
+  u64 size = *read_size();
+  if (off >= size)
+    return;
+  if (n > size - off)
+    n = size - off;
+
+  u64 first = off / PGSIZE;
+  u64 last = (off + n - 1) / PGSIZE;
+  // Picking up in the page where the last read left off is still
+  // sequential.
+  bool seq = (first == ra->next || first + 1 == ra->next);
+  ra->next = last + 1;
+  if (!seq && ra->mode != readahead_state::SEQUENTIAL) {
+    ra->window = 0;
+    ra->issued = 0;
+    return;
+  }
+
+  if (ra->mode == readahead_state::SEQUENTIAL)
+    ra->window = RA_MAX_PAGES;
+  else if (ra->window == 0)
+    ra->window = RA_MIN_PAGES;
+  else if (ra->window < RA_MAX_PAGES)
+    ra->window *= 2;
+
+  if (!is_backed(first))
+    return;
+
+  // If this read needs pages from the disk, get them in one request
+  // rather than a page at a time.
+  if (!pages_.find(first).is_set())
+    readahead(first, last + 1 - first);
+
+  // Keep the window ahead of the reader, and top it up in the
+  // background once the reader has used half of it.
+  if (ra->issued < last + 1)
+    ra->issued = last + 1;
+  u64 want = last + 1 + ra->window;
+  if (ra->issued - (last + 1) <= ra->window / 2 && ra->issued < want) {
+    readahead_async(ra->issued, want - ra->issued);
+    ra->issued = want;
+  }
+}
+
+void
+mfile::join_clock()
+{
+  if (on_clock_.load(std::memory_order_relaxed) || on_clock_.exchange(true))
+    return;
+  clock_node_ = mycpu()->node->id;
+  file_clock.add(clock_node_, this);
+}
+
+size_t
+mfile::clock_sweep(size_t nscan)
+{
+  u64 end = PGROUNDUP(backing_size_) / PGSIZE;
+  if (clock_hand_ >= end)
+    clock_hand_ = 0;
+
+  size_t nfreed = 0;
+  for (; nscan && clock_hand_ < end; nscan--, clock_hand_++) {
+    scoped_cli cli;
+    auto it = pages_.find(clock_hand_);
+    if (!it.is_set())
+      continue;
+    auto lock = pages_.acquire(it);
+    if (!it.is_set() || it->is_dirty())
+      continue;
+    if (it->is_referenced()) {
+      // Second chance.
+      it->clear_referenced();
+      continue;
+    }
+    pages_.fill(it, page_state());
+    nfreed++;
+  }
+  return nfreed;
+}
+
+mfile::page_state
+mfile::dirty_page(u64 pageidx, bool may_load)
+{
+  for (;;) {
+    page_state ps = may_load ? get_page(pageidx) : get_cached_page(pageidx);
+    if (!ps.is_set())
+      return page_state();
+
+    scoped_cli cli;
+    auto it = pages_.find(pageidx);
+    auto lock = pages_.acquire(it);
+    if (it.is_set()) {
+      it->set_dirty();
+      return *it;
+    }
+    // Evicted before we could mark it dirty.  Read it in again.
+  }
+}
+
+bool
+mfile::evict_page(u64 pageidx)
+{
+  scoped_cli cli;
+  auto it = pages_.find(pageidx);
+  auto lock = pages_.acquire(it);
+  if (!it.is_set() || it->is_dirty() || !is_backed(pageidx))
+    return false;
+  pages_.fill(it, page_state());
+  return true;
+}
+
+mfile::page_state
+mfile::install_page(u64 pageidx, sref<page_info> pi, bool check_eof)
+{
+  scoped_cli cli;
+  auto it = pages_.find(pageidx);
+  auto lock = pages_.acquire(it);
+  // A truncate sets size_ before it takes the page locks to drop
+  // pages, so checking size_ under the page lock means we can't
+  // install a page that the truncate has already passed over.
+  if (!it.is_set() && (!check_eof || pageidx < PGROUNDUP(size_) / PGSIZE))
+    pages_.fill(it, page_state(pi));
+
+  it = pages_.find(pageidx);
+  if (!it.is_set())
+    return page_state();
+  return *it;
+}
+
+// Back the hole at pageidx with a zeroed page.  Returns false only if
+// out of memory; pages that aren't holes are left alone.
+bool
+mfile::fill_hole(u64 pageidx)
+{
+  if (get_cached_page(pageidx).is_set() || is_backed(pageidx) ||
+      pageidx >= PGROUNDUP(*read_size()) / PGSIZE)
+    return true;
+
+  char* p = zalloc("file hole");
+  if (!p)
+    return false;
+  install_page(pageidx,
+               sref<page_info>::transfer(new (page_info::of(p)) page_info()));
+  return true;
+}
+
+mfile::page_state
+mfile::fault_page(u64 pageidx)
+{
+  if (!fill_hole(pageidx))
+    throw_bad_alloc();
+  return dirty_page(pageidx, false);
+}
+
+bool
+mfile::allocate(u64 start, u64 end)
+{
+  for (u64 idx = start / PGSIZE; idx < PGROUNDUP(end) / PGSIZE; idx++)
+    if (!fill_hole(idx))
+      return false;
+  return true;
+}
+
+bool
+mfile::reserve_append(u64 n, u64 pinned, u64* startp)
+{
+  u64 start = reserved_.load(std::memory_order_acquire);
+  for (;;) {
+    if (start & RESERVE_FROZEN) {
+      // A resizer holds the file.  Wait for it to finish.
+      nop_pause();
+      start = reserved_.load(std::memory_order_acquire);
+      continue;
+    }
+    // A truncate since the caller pinned its page may have moved EOF
+    // into a page that's been evicted.  Truncates lower backing_size_
+    // before they release reserved_, so this sees the new size.
+    if (start / PGSIZE != pinned && is_backed(start / PGSIZE))
+      return false;
+    if (reserved_.compare_exchange_weak(start, start + n)) {
+      *startp = start;
+      return true;
+    }
+  }
+}
+
+void
+mfile::commit_append(u64 start, u64 n)
+{
+  // Appends become visible in reservation order, so a reader never
+  // sees a hole where an earlier append is still being copied.
+  while (committed_.load(std::memory_order_acquire) != start)
+    nop_pause();
+
+  {
+    auto w = size_seq_.write_begin();
+    size_ = start + n;
+  }
+  committed_.store(start + n, std::memory_order_release);
+}
+
+void
+initmnode(void)
+{
+  register_shrinker(&the_file_shrinker);
+}
+
 void
 mfsprint(print_stream *s)
 {
@@ -112,6 +112,14 @@ public:
     return r;
   }
 
+  int connect(const struct sockaddr *addr, size_t addrlen) override
+  {
+    lwip_core_lock();
+    int r = lwip_connect(socket_, addr, addrlen);
+    lwip_core_unlock();
+    return r;
+  }
+
   int accept(struct sockaddr_storage* addr, size_t *addrlen, file **out)
     override
   {
@@ -184,6 +192,9 @@ start_timer(struct timer_thread *t, void (*func)(void),
 
   acquire(&p->lock);
   safestrcpy(p->name, name, sizeof(p->name));
+  // Timer threads are latency-critical; don't queue them behind
+  // batch work.
+  p->sched_class = SCHED_FIFO;
   addrun(p);
   release(&p->lock);
 }
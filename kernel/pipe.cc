@@ -7,10 +7,16 @@
 #include "fs.h"
 #include "file.hh"
 #include "cpu.hh"
+#include "ilist.hh"
+#include "lb.hh"
 #include "uk/unistd.h"
 #include "uk/fcntl.h"
 
 #define PIPESIZE (16*4096)
+// Writes of up to PIPE_BUF bytes don't interleave with other writes.
+#define PIPE_BUF 4096
+// How many chunks an unordered pipe's per-core buffer holds.
+#define PIPE_CORE_CHUNKS 16
 
 struct pipe {
   virtual ~pipe() { };
@@ -20,111 +26,370 @@ struct pipe {
   NEW_DELETE_OPS(pipe);
 };
 
-struct ordered : pipe {
+// The open state of a pipe's ends and the waiting protocol its
+// readers and writers share.  A side that finds the pipe empty (or
+// full) sets rwaiting (or wwaiting) under lock and checks again
+// before sleeping.  The other side checks the flag after it
+// publishes, so it only takes lock and wakes anyone when someone is
+// actually waiting for the pipe to become non-empty (or non-full).
+struct pipe_ends : pipe {
   struct spinlock lock;
-  struct spinlock lock_close;
   struct condvar  empty;
   struct condvar  full;
   std::atomic<bool> readopen;   // read fd is still open
-  int writeopen;  // write fd is still open
+  std::atomic<bool> writeopen;  // write fd is still open
+  std::atomic<bool> rwaiting;   // a reader is waiting on empty
+  std::atomic<bool> wwaiting;   // a writer is waiting on full
+  bool nonblock;
+
+  pipe_ends(int flags)
+    : lock("pipe", LOCKSTAT_PIPE), empty("pipe:empty"), full("pipe:full"),
+      readopen(true), writeopen(true), rwaiting(false), wwaiting(false),
+      nonblock(flags & O_NONBLOCK) { }
+
+  // Wake the other side if it's waiting on cv.
+  void wake(std::atomic<bool> *waiting, struct condvar *cv) {
+    if (!waiting->load())
+      return;
+    scoped_acquire l(&lock);
+    waiting->store(false);
+    cv->wake_all();
+  }
+
+  // Wait until ready(), which should also check whether the other
+  // side closed.  Returns false if we were killed.
+  template<class F>
+  bool wait(std::atomic<bool> *waiting, struct condvar *cv, F ready) {
+    scoped_acquire l(&lock);
+    for (;;) {
+      waiting->store(true);
+      if (ready())
+        return true;
+      if (myproc()->killed)
+        return false;
+      cv->sleep(&lock);
+    }
+  }
+
+  virtual int close(int writable) override {
+    scoped_acquire l(&lock);
+    if(writable){
+      writeopen = false;
+    } else {
+      readopen = false;
+    }
+    empty.wake_all();
+    full.wake_all();
+    if(!readopen && !writeopen){
+      return 1;
+    }
+    return 0;
+  }
+};
+
+// A byte ring.  Writers serialize on wlock and readers on rlock, but
+// the two sides never share a lock: nwrite is only advanced by the
+// writer holding wlock and nread by the reader holding rlock, so
+// between the two sides the ring is single-producer/single-consumer
+// and each side copies whole segments with memmove.  Neither side
+// holds its lock while it sleeps.
+struct ordered : pipe_ends {
+  struct spinlock wlock;
+  struct spinlock rlock;
+  __padout__;
   std::atomic<size_t> nread;  // number of bytes read
+  __padout__;
   std::atomic<size_t> nwrite; // number of bytes written
-  bool nonblock;
+  __padout__;
   char data[PIPESIZE];
 
   ordered(int flags)
-    : readopen(true), writeopen(1), nread(0), nwrite(0),
-      nonblock(flags & O_NONBLOCK)
-  {
-    lock = spinlock("pipe", LOCKSTAT_PIPE);
-    lock_close = spinlock("pipe:close", LOCKSTAT_PIPE);
-    empty = condvar("pipe:empty");
-    full = condvar("pipe:full");
-  };
+    : pipe_ends(flags), wlock("pipe:write", LOCKSTAT_PIPE),
+      rlock("pipe:read", LOCKSTAT_PIPE), nread(0), nwrite(0) { }
   ~ordered() override {
   };
   NEW_DELETE_OPS(ordered);
 
   virtual int write(const char *addr, int n) override {
-    if (nonblock) {
-      for (;;) {
-        size_t nr = nread;
-        size_t nw = nwrite;
-        if (nr == nread) {
-          // use nread sort-of like a seqlock
-          if (nw == nr + PIPESIZE)
-            return -1;
-          break;
-        }
+    // Writes of up to PIPE_BUF bytes go in all at once.
+    size_t need = n <= PIPE_BUF ? n : 1;
+    int done = 0;
+    while (done < n) {
+      if (!readopen)
+        return done ? done : -1;
+
+      size_t nw = nwrite.load(std::memory_order_relaxed);
+      size_t space = PIPESIZE - (nw - nread.load(std::memory_order_acquire));
+      if (space < need) {
+        if (nonblock)
+          return done ? done : -1;
+        auto ready = [&]() {
+          return !readopen ||
+            PIPESIZE - (nwrite.load() - nread.load()) >= need;
+        };
+        if (!wait(&wwaiting, &full, ready))
+          return done ? done : -1;
+        continue;
       }
-    }
 
-    if (!readopen)
-      return -1;
+      {
+        scoped_acquire l(&wlock);
+        // Another writer may have filled the ring since we looked.
+        nw = nwrite.load(std::memory_order_relaxed);
+        space = PIPESIZE - (nw - nread.load(std::memory_order_acquire));
+        if (space < need)
+          continue;
+        size_t len = n - done;
+        if (len > space)
+          len = space;
+        size_t pos = nw % PIPESIZE;
+        size_t first = len < PIPESIZE - pos ? len : PIPESIZE - pos;
+        memmove(data + pos, addr + done, first);
+        memmove(data, addr + done + first, len - first);
+        nwrite.store(nw + len);
+        done += len;
+        need = 1;
+      }
+      wake(&rwaiting, &empty);
+    }
+    return done;
+  }
 
-    scoped_acquire l(&lock);
-    for(int i = 0; i < n; i++){
-      while(nwrite == nread + PIPESIZE){ 
-        if (nonblock || myproc()->killed)
+  virtual int read(char *addr, int n) override {
+    size_t len;
+    for (;;) {
+      if (nwrite.load(std::memory_order_acquire) ==
+          nread.load(std::memory_order_relaxed)) {
+        if (nonblock)
           return -1;
-        scoped_acquire lclose(&lock_close);
-        if (!readopen)
+        auto ready = [&]() {
+          return !writeopen || nwrite.load() != nread.load();
+        };
+        if (!wait(&rwaiting, &empty, ready))
           return -1;
-        full.sleep(&lock, &lock_close);
+        if (nwrite.load() == nread.load() && !writeopen)
+          return 0;
       }
-      data[nwrite++ % PIPESIZE] = addr[i];
+
+      scoped_acquire l(&rlock);
+      size_t nr = nread.load(std::memory_order_relaxed);
+      len = nwrite.load(std::memory_order_acquire) - nr;
+      // Another reader may have emptied the ring since we looked.
+      if (len == 0)
+        continue;
+      if (len > (size_t)n)
+        len = n;
+      size_t pos = nr % PIPESIZE;
+      size_t first = len < PIPESIZE - pos ? len : PIPESIZE - pos;
+      memmove(addr, data + pos, first);
+      memmove(addr + first, data, len - first);
+      nread.store(nr + len);
+      break;
     }
-    if (n > 0)
-      empty.wake_all();
-    return n;
+    wake(&wwaiting, &full);
+    return len;
   }
+};
 
-  virtual int read(char *addr, int n) override {
-    if (nonblock) {
-      for (;;) {
-        size_t nr = nread;
-        size_t nw = nwrite;
-        if (nr == nread) {
-          // use nread sort-of like a seqlock
-          if (nw == nr)
-            return -1;
+// One write's worth (up to PIPE_BUF bytes) of an unordered pipe.
+struct pipe_chunk {
+  islink<pipe_chunk> link;
+  typedef isqueue<pipe_chunk, &pipe_chunk::link> list_t;
+  u32 len;                      // bytes in data
+  u32 off;                      // bytes already read
+  char data[];
+
+  static pipe_chunk* alloc(size_t len) {
+    pipe_chunk *c = (pipe_chunk*)kmalloc(sizeof(pipe_chunk) + len, "pipechunk");
+    if (!c)
+      return nullptr;
+    new (c) pipe_chunk();
+    c->len = len;
+    c->off = 0;
+    return c;
+  }
+
+  void free() {
+    size_t sz = sizeof(pipe_chunk) + len;
+    this->~pipe_chunk();
+    kmfree(this, sz);
+  }
+
+private:
+  pipe_chunk() { }
+};
+
+// A core's share of an unordered pipe.
+struct corepipe : public balance_pool<corepipe> {
+  struct spinlock lock;
+  pipe_chunk::list_t chunks;
+  // The number of chunks.  This is read without lock as a hint.
+  std::atomic<u64> len;
+  __padout__;
+
+  corepipe() : balance_pool(PIPE_CORE_CHUNKS),
+               lock("corepipe", LOCKSTAT_PIPE), len(0) { }
+  ~corepipe() {
+    while (!chunks.empty()) {
+      pipe_chunk &c = chunks.front();
+      chunks.pop_front();
+      c.free();
+    }
+  }
+
+  u64 balance_count() const {
+    return len;
+  }
+
+  void balance_move_to(corepipe* target) {
+    assert(this != target);
+    if (!lock.try_acquire())
+      return;
+    if (!target->lock.try_acquire()) {
+      lock.release();
+      return;
+    }
+
+    while (target->len < len) {
+      pipe_chunk &c = chunks.front();
+      chunks.pop_front();
+      len--;
+      target->chunks.push_back(&c);
+      target->len++;
+    }
+
+    lock.release();
+    target->lock.release();
+  }
+
+  // Queue c if there's room.
+  bool put(pipe_chunk *c) {
+    scoped_acquire l(&lock);
+    if (len >= PIPE_CORE_CHUNKS)
+      return false;
+    chunks.push_back(c);
+    len++;
+    return true;
+  }
+
+  // Copy out up to n bytes.  We only split a chunk if it's the first
+  // one and doesn't fit, so a reader whose buffer can hold a whole
+  // write gets all of it.
+  size_t take(char *addr, size_t n) {
+    scoped_acquire l(&lock);
+    size_t done = 0;
+    while (done < n && !chunks.empty()) {
+      pipe_chunk &c = chunks.front();
+      size_t m = c.len - c.off;
+      if (m > n - done) {
+        if (done)
           break;
+        m = n;
+      }
+      memmove(addr + done, c.data + c.off, m);
+      c.off += m;
+      done += m;
+      if (c.off == c.len) {
+        chunks.pop_front();
+        len--;
+        c.free();
+      }
+    }
+    return done;
+  }
+};
+
+// A pipe for handing out work, where the order of the data doesn't
+// matter (O_ANYORDER).  Each core has its own queue of chunks, each
+// holding up to PIPE_BUF bytes of one write, so writers and readers
+// on different cores don't share anything but their wait flags.  A
+// reader takes from its own core's queue, and once that's empty it
+// balances with the other cores' queues, the way unordered UNIX
+// datagram sockets do, and if that doesn't turn anything up it
+// takes straight from any core that has data.  Data from one write
+// of up to PIPE_BUF bytes stays together unless a reader asks for
+// fewer bytes.
+struct unordered : pipe_ends {
+  corepipe cores[NCPU];
+  balancer<unordered, corepipe> b;
+
+  unordered(int flags) : pipe_ends(flags), b(this) { }
+  ~unordered() override {
+  };
+  NEW_DELETE_OPS(unordered);
+
+  corepipe* balance_get(int id) const {
+    if (id >= ncpu)
+      return nullptr;
+    return const_cast<corepipe*>(&cores[id]);
+  }
+
+  bool any_data() {
+    for (int i = 0; i < ncpu; i++)
+      if (cores[i].len)
+        return true;
+    return false;
+  }
+
+  virtual int write(const char *addr, int n) override {
+    int done = 0;
+    while (done < n) {
+      if (!readopen)
+        return done ? done : -1;
+
+      size_t len = n - done;
+      if (len > PIPE_BUF)
+        len = PIPE_BUF;
+      pipe_chunk *c = pipe_chunk::alloc(len);
+      if (!c)
+        return done ? done : -1;
+      memmove(c->data, addr + done, len);
+
+      // Our core's queue is full until a reader takes from it or
+      // steals from it.
+      while (!cores[myid()].put(c)) {
+        auto ready = [&]() {
+          return !readopen || cores[myid()].len < PIPE_CORE_CHUNKS;
+        };
+        if (nonblock || !readopen || !wait(&wwaiting, &full, ready)) {
+          c->free();
+          return done ? done : -1;
         }
       }
+      done += len;
+      wake(&rwaiting, &empty);
     }
+    return done;
+  }
 
-    scoped_acquire l(&lock);
-    while(nread == nwrite) {
+  virtual int read(char *addr, int n) override {
+    if (n <= 0)
+      return 0;
+    for (;;) {
+      corepipe *cp = &cores[myid()];
+      if (cp->len == 0)
+        b.balance();
+      size_t r = cp->take(addr, n);
+      for (int i = 0; r == 0 && i < ncpu; i++)
+        if (cores[i].len)
+          r = cores[i].take(addr, n);
+      if (r) {
+        wake(&wwaiting, &full);
+        return r;
+      }
+
+      // Other readers can keep taking the data we see, and wait()
+      // doesn't check for a kill while there's data, so check here.
       if (nonblock || myproc()->killed)
         return -1;
-      scoped_acquire lclose(&lock_close);
-      if (writeopen == 0)
+      if (!writeopen && !any_data())
         return 0;
-      empty.sleep(&lock, &lock_close);
-    }
-    int i;
-    for(i = 0; i < n; i++) { 
-      if(nread == nwrite)
-        break;
-      addr[i] = data[nread++ % PIPESIZE];
-    }
-    if (i > 0)
-      full.wake_all();
-    return i;
-  }
-
-  virtual int close(int writable) override {
-    scoped_acquire l(&lock_close);
-    if(writable){
-      writeopen = 0;
-    } else {
-      readopen = 0;
-    }
-    empty.wake_all();
-    if(readopen == 0 && writeopen == 0){
-      return 1;
+      auto ready = [&]() {
+        return !writeopen || any_data();
+      };
+      if (!wait(&rwaiting, &empty, ready))
+        return -1;
     }
-    return 0;
   }
 };
 
@@ -135,7 +400,10 @@ pipealloc(sref<file> *f0, sref<file> *f1, int flags)
   struct pipe *p = nullptr;
   auto cleanup = scoped_cleanup([&](){delete p;});
   try {
-    p = new ordered(flags);
+    if (flags & O_ANYORDER)
+      p = new unordered(flags);
+    else
+      p = new ordered(flags);
     *f0 = make_sref<file_pipe_reader>(p);
     *f1 = make_sref<file_pipe_writer>(p);
   } catch (std::bad_alloc &e) {
@@ -34,11 +34,12 @@ enum { sched_debug = 0 };
 
 proc::proc(int npid) :
   kstack(0), pid(npid), parent(0), tf(0), context(0), killed(0),
-  tsc(0), curcycles(0), cpuid(0), fpu_state(nullptr),
+  tsc(0), curcycles(0), sched_class(SCHED_OTHER), nice(0), vruntime(0),
+  cpuid(0), fpu_state(nullptr), fpu_cpu(-1), fpu_counter(0),
   cpu_pin(0), oncv(0), cv_wakeup(0),
   futex_lock("proc::futex_lock", LOCKSTAT_PROC),
   user_fs_(0), unmap_tlbreq_(0), data_cpuid(-1), in_exec_(0), 
-  uaccess_(0), yield_(false),
+  uaccess_(0), yield_(false), sysret_full_(false),
   upath(nullptr), uargv(nullptr),
   exception_inuse(0), magic(PROC_MAGIC), unmapped_hint(0), state_(EMBRYO)
 {
@@ -53,9 +54,7 @@ proc::proc(int npid) :
 proc::~proc(void)
 {
   magic = 0;
-  if (fpu_state)
-    kmfree(fpu_state, FXSAVE_BYTES);
-  fpu_state = nullptr;
+  fpu_free(this);
 }
 
 void
@@ -108,6 +107,23 @@ proc::set_cpu_pin(int cpu)
   return 0;
 }
 
+// Change this proc's scheduling class and nice value.  If the proc
+// is already on a run queue, the change takes effect the next time it
+// is enqueued.
+int
+proc::set_scheduler(int policy, int nice)
+{
+  if (policy != SCHED_OTHER && policy != SCHED_FIFO)
+    return -1;
+  if (nice < NICE_MIN || nice > NICE_MAX)
+    return -1;
+
+  scoped_acquire l(&lock);
+  sched_class = policy;
+  this->nice = nice;
+  return 0;
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
@@ -118,6 +134,17 @@ yield(void)
   sched();
 }
 
+// Offer the CPU up at the end of a time slice.  Unlike yield, the
+// current proc keeps running if its scheduling class says it's still
+// owed CPU time ahead of the procs waiting here.
+void
+preempt(void)
+{
+  acquire(&myproc()->lock);
+  myproc()->set_state(RUNNABLE);
+  sched(true);
+}
+
 
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
@@ -327,6 +354,28 @@ proc::kill(int pid)
   return p->kill();
 }
 
+int
+proc::set_scheduler(int pid, int policy, int nice)
+{
+  // Like kill(pid), this races with the target exiting.  There are no
+  // users to check, so only let processes change their children.
+  scoped_gc_epoch e;
+  proc *p = xnspid->lookup(pid);
+  if (p == 0 || p->parent != myproc())
+    return -1;
+  return p->set_scheduler(policy, nice);
+}
+
+// Whether pid names a process that hasn't been killed or exited.
+// Pids aren't reused, so a stale pid just reads as dead.
+bool
+proc::alive(int pid)
+{
+  scoped_gc_epoch e;
+  proc *p = xnspid->lookup(pid);
+  return p && !p->killed && p->get_state() != ZOMBIE;
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -395,6 +444,9 @@ doclone(clone_flags flags)
   np->parent = myproc();
   *np->tf = *myproc()->tf;
   np->cpu_pin = myproc()->cpu_pin;
+  np->sched_class = myproc()->sched_class;
+  np->nice = myproc()->nice;
+  np->vruntime = myproc()->vruntime;
   np->data_cpuid = myproc()->data_cpuid;
   np->run_cpuid_ = myproc()->run_cpuid_;
   np->user_fs_ = myproc()->user_fs_;
@@ -588,6 +640,9 @@ proc::deliver_signal(int signo)
 
   tf->rip = (u64) sig[signo].sa_handler;
   tf->rdi = signo;
+  // If we're in a system call, SYSRET wouldn't restore rdi.  The
+  // next return through trapret clears this.
+  sysret_full_ = true;
   return true;
 }
 
@@ -0,0 +1,158 @@
+// Reclaiming cached memory under memory pressure.
+//
+// Each NUMA node has a reclaim worker pinned to one of its CPUs.
+// kalloc kicks the worker when a buddy allocator drops below the low
+// watermark (see RECLAIM_LOW_DIV), and the worker also checks the
+// watermark every RECLAIM_INTERVAL msec on its own.  The allocator
+// can't take the worker's lock to wake it, so a kick goes through
+// the worker CPU's lock-free work inbox.  Once the node's free memory
+// is below the low watermark, the worker works out how many pages it
+// takes to get back to the high watermark and asks the shrinkers for
+// them in batches.  Freed pages reach the allocator
+// only once refcache is done with them, so the worker counts what
+// the shrinkers give up rather than watching the free count.
+
+#include "types.h"
+#include "kernel.hh"
+#include "amd64.h"
+#include "spinlock.hh"
+#include "condvar.hh"
+#include "proc.hh"
+#include "cpu.hh"
+#include "numa.hh"
+#include "reclaim.hh"
+#include "work.hh"
+#include "kstats.hh"
+
+#include <atomic>
+
+enum { MAX_SHRINKERS = 16 };
+
+static shrinker *shrinkers[MAX_SHRINKERS];
+static std::atomic<int> nshrinkers;
+
+struct reclaim_state;
+
+// Wakes the reclaim worker.  There's one of these per node, and it's
+// queued at most once at a time.
+struct reclaim_wake : public dwork {
+  reclaim_wake(reclaim_state *rs) : dwork(WORK_HIGH), rs_(rs) { }
+  virtual void run() override;
+
+  reclaim_state *rs_;
+};
+
+struct reclaim_state {
+  reclaim_state()
+    : cpu(-1), kicked(false), lock("reclaim"), cv(condvar("reclaim")),
+      wake(this) { }
+
+  // The CPU the worker is pinned to, or -1 if there's no worker.
+  int cpu;
+  // Whether wake is queued.
+  std::atomic<bool> kicked;
+  struct spinlock lock;
+  struct condvar cv;
+  reclaim_wake wake;
+  __padout__;
+};
+
+static reclaim_state reclaim_states[MAX_NUMA_NODES];
+
+void
+reclaim_wake::run()
+{
+  // Once we've been dequeued, we can be queued again.
+  rs_->kicked.store(false);
+  scoped_acquire l(&rs_->lock);
+  rs_->cv.wake_all();
+}
+
+void
+register_shrinker(shrinker *s)
+{
+  int i = nshrinkers.fetch_add(1);
+  if (i >= MAX_SHRINKERS)
+    panic("register_shrinker: too many shrinkers");
+  shrinkers[i] = s;
+}
+
+void
+reclaim_kick(int node)
+{
+  reclaim_state *rs = &reclaim_states[node];
+  if (rs->cpu < 0 || rs->kicked.load(std::memory_order_relaxed) ||
+      rs->kicked.exchange(true))
+    return;
+  dwork_push(&rs->wake, rs->cpu);
+}
+
+// Return the number of pages node must free to get back above the
+// high watermark, or 0 if it isn't below the low watermark.
+static size_t
+reclaim_target(int node)
+{
+  size_t nfree, ntotal;
+  kmem_node_pages(node, &nfree, &ntotal);
+  if (nfree >= ntotal / RECLAIM_LOW_DIV)
+    return 0;
+  return ntotal / RECLAIM_HIGH_DIV - nfree;
+}
+
+static void
+reclaim_node(int node, size_t target)
+{
+  size_t nfreed = 0;
+  while (nfreed < target) {
+    size_t pass = 0;
+    // Shrinkers that register later sit higher up (file pages above
+    // the buffer cache above refcache), so ask them first.
+    for (int i = nshrinkers.load() - 1; i >= 0 && nfreed + pass < target; i--) {
+      size_t want = target - nfreed - pass;
+      if (want > RECLAIM_BATCH)
+        want = RECLAIM_BATCH;
+      pass += shrinkers[i]->shrink(node, want);
+    }
+    if (pass == 0)
+      break;
+    nfreed += pass;
+  }
+  kstats::inc(&kstats::reclaim_pages_freed, nfreed);
+  // Nothing left to shrink.  This repeats every interval while memory
+  // stays low, so count it rather than print it.
+  if (nfreed < target)
+    kstats::inc(&kstats::reclaim_short_count);
+}
+
+static void
+reclaim_worker(void *arg)
+{
+  int node = (int)(uintptr_t)arg;
+  reclaim_state *rs = &reclaim_states[node];
+
+  for (;;) {
+    {
+      scoped_acquire l(&rs->lock);
+      rs->cv.sleep_to(&rs->lock,
+                      nsectime() + ((u64)RECLAIM_INTERVAL)*1000000ull);
+    }
+
+    size_t target = reclaim_target(node);
+    if (target)
+      reclaim_node(node, target);
+  }
+}
+
+void
+initreclaim(void)
+{
+  for (auto &node : numa_nodes) {
+    if (node.cpus.empty())
+      continue;
+    char namebuf[32];
+    snprintf(namebuf, sizeof(namebuf), "reclaim_%lu", node.id);
+    threadpin(reclaim_worker, (void*)(uintptr_t)node.id, namebuf,
+              node.cpus[0]->id);
+    reclaim_states[node.id].cpu = node.cpus[0]->id;
+  }
+}
@@ -1,6 +1,10 @@
 #include "refcache.hh"
 #include "proc.hh"
 #include "kstream.hh"
+#include "reclaim.hh"
+#include "work.hh"
+#include "numa.hh"
+#include "cpu.hh"
 
 #include <atomic>
 #include <iterator>
@@ -373,6 +377,61 @@ test(void *)
 }
 #endif
 
+// Flushes one core's refcache.  There's one of these per CPU, and
+// it's queued at most once at a time.
+struct refcache_expedite : public dwork
+{
+  refcache_expedite() : dwork(WORK_HIGH), queued(false) { }
+
+  void
+  run() override
+  {
+    // Once we've been dequeued, we can be queued again.
+    queued.store(false);
+    refcache::mycache->expedite();
+  }
+
+  std::atomic<bool> queued;
+};
+
+static refcache_expedite expedite_work[NCPU];
+
+// Under memory pressure, flush the refcaches of the node's cores so
+// that objects the other shrinkers let go of are reviewed and freed
+// a tick or two sooner.  The flushes are queued, not waited for, so
+// this never blocks on other cores.  refcache frees nothing itself,
+// so it reports the pages that have reached the node's allocator
+// since its last call, which is what the earlier flushes bought.
+struct refcache_shrinker : public shrinker
+{
+  refcache_shrinker() : shrinker("refcache") { }
+
+  size_t
+  shrink(int node, size_t npages) override
+  {
+    size_t nfree, ntotal, gained = 0;
+    kmem_node_pages(node, &nfree, &ntotal);
+    // Only the node's reclaim worker calls this for node.
+    if (primed_[node] && nfree > last_free_[node])
+      gained = nfree - last_free_[node];
+    last_free_[node] = nfree;
+    primed_[node] = true;
+
+    for (struct cpu *c : numa_nodes[node].cpus) {
+      refcache_expedite *w = &expedite_work[c->id];
+      if (w->queued.load(std::memory_order_relaxed) || w->queued.exchange(true))
+        continue;
+      dwork_push(w, c->id);
+    }
+    return gained;
+  }
+
+  size_t last_free_[MAX_NUMA_NODES] = {};
+  bool primed_[MAX_NUMA_NODES] = {};
+};
+
+static refcache_shrinker the_refcache_shrinker;
+
 static void
 refcache_reaper(void*)
 {
@@ -390,6 +449,7 @@ initrefcache(void)
 
   for (int i = 0; i < NCPU; i++)
     threadpin(refcache_reaper, nullptr, "refcache reaper", i);
+  register_shrinker(&the_refcache_shrinker);
 
 #ifdef TEST
   threadpin(test, nullptr, "refcache test", 0);
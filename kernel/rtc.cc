@@ -12,7 +12,7 @@
 #define IO_RTC  0x70
 
 // The UNIX epoch time, in nanoseconds, when nsectime() was 0.
-static uint64_t rtc_nsec0;
+uint64_t rtc_nsec0;
 
 static uint8_t
 rtcread1(uint8_t reg, bool bcd = false, bool twelvehour = false)
@@ -84,7 +84,9 @@ initrtc(void)
   rtc_nsec0 = rtc_now * 1000000000ull - nsectime_now;
 }
 
-//SYSCALL
+// User space normally reads this from the clock page; see time_nsec
+// in lib/time.c.
+//SYSCALL {"uname":"time_nsec_syscall"}
 uint64_t
 sys_time_nsec(void)
 {
@@ -11,15 +11,213 @@
 #include "vm.hh"
 #include "major.h"
 #include "rnd.hh"
-#include "lb.hh"
-#include "work.hh"
 #include "ilist.hh"
 #include "kstream.hh"
 #include "file.hh"
+#include "numa.hh"
+#include "apic.hh"
 
 enum { sched_debug = 0 };
 
-struct schedule : public balance_pool<schedule> {
+// Load weights for SCHED_OTHER procs, indexed by nice - NICE_MIN.
+// Each nice level is worth roughly 10% of CPU time relative to its
+// neighbors (the same table Linux's CFS uses).
+static const u32 nice_weight[NICE_MAX - NICE_MIN + 1] = {
+  /* -20 */ 88761, 71755, 56483, 46273, 36291,
+  /* -15 */ 29154, 23254, 18705, 14949, 11916,
+  /* -10 */  9548,  7620,  6100,  4904,  3906,
+  /*  -5 */  3121,  2501,  1991,  1586,  1277,
+  /*   0 */  1024,   820,   655,   526,   423,
+  /*   5 */   335,   272,   215,   172,   137,
+  /*  10 */   110,    87,    70,    56,    45,
+  /*  15 */    36,    29,    23,    18,    15,
+};
+
+enum { NICE_0_WEIGHT = 1024 };
+
+// SCHED_FIFO procs on a CPU may use at most RT_RUNTIME_PCT percent of
+// each RT_PERIOD_MS window while SCHED_OTHER procs are waiting there,
+// so a spinning real-time proc can't starve the kernel's own threads.
+enum { RT_PERIOD_MS = 1000, RT_RUNTIME_PCT = 95 };
+
+// A per-CPU run queue for one scheduling class.  Except for charge,
+// which only touches the running proc, methods are called with the
+// owning schedule's lock held.
+class sched_class
+{
+public:
+  virtual ~sched_class() {}
+
+  // Add runnable proc p to this queue.
+  virtual void enq(proc *p) = 0;
+
+  // Remove and return the proc that should run next.  The queue must
+  // not be empty.
+  virtual proc* deq() = 0;
+
+  // Return true if prev, which belongs to this class and just gave up
+  // the CPU while still runnable, should keep running in preference
+  // to the head of this queue.
+  virtual bool keep(proc *prev) = 0;
+
+  // Charge p for running 'cycles' cycles.
+  virtual void charge(proc *p, u64 cycles) { }
+
+  // Adjust p's class state as it moves from this queue to 'to'.
+  virtual void migrate(proc *p, sched_class *to) { }
+
+  bool empty() const { return procs_.empty(); }
+
+  ilist<proc, &proc::sched_link> procs_;
+};
+
+// SCHED_FIFO: runnable procs are served strictly in the order they
+// became runnable.  A proc that yields goes to the back of the queue.
+class fifo_class : public sched_class
+{
+public:
+  fifo_class() : period_start_(0), runtime_(0) { }
+  void enq(proc *p) override
+  {
+    procs_.push_back(p);
+  }
+
+  proc* deq() override
+  {
+    proc &p = procs_.front();
+    procs_.pop_front();
+    return &p;
+  }
+
+  bool keep(proc *prev) override
+  {
+    return empty();
+  }
+
+  void charge(proc *p, u64 cycles) override
+  {
+    u64 now = rdtsc();
+    if (now - period_start_ >= period()) {
+      period_start_ = now;
+      runtime_ = 0;
+    }
+    runtime_ += cycles;
+  }
+
+  // Whether this CPU's FIFO procs have used up their share of the
+  // current period.
+  bool throttled() const
+  {
+    return rdtsc() - period_start_ < period() &&
+      runtime_ >= period() / 100 * RT_RUNTIME_PCT;
+  }
+
+private:
+  static u64 period()
+  {
+    extern u64 cpuhz;
+    return cpuhz / 1000 * RT_PERIOD_MS;
+  }
+
+  // Cycles FIFO procs have run since period_start_.  Like all class
+  // accounting, only touched by the local CPU.
+  u64 period_start_;
+  u64 runtime_;
+};
+
+// SCHED_OTHER: weighted fair sharing.  Each proc accumulates
+// vruntime, its run time scaled inversely by its nice weight, and the
+// queue always runs the proc with the least vruntime.  Run queues are
+// short, so the queue is a list kept sorted by vruntime.
+class fair_class : public sched_class
+{
+public:
+  fair_class() : min_vruntime_(0) { }
+
+  void enq(proc *p) override
+  {
+    // Don't let a proc that slept for a long time monopolize the
+    // CPU, but give it a little credit so wakeups are responsive.
+    u64 floor = min_vruntime_ > wakeup_credit() ?
+      min_vruntime_ - wakeup_credit() : 0;
+    if (p->vruntime < floor)
+      p->vruntime = floor;
+
+    auto it = procs_.begin();
+    while (it != procs_.end() && it->vruntime <= p->vruntime)
+      ++it;
+    procs_.insert(it, p);
+  }
+
+  proc* deq() override
+  {
+    proc &p = procs_.front();
+    procs_.pop_front();
+    if (p.vruntime > min_vruntime_)
+      min_vruntime_ = p.vruntime;
+    return &p;
+  }
+
+  bool keep(proc *prev) override
+  {
+    return empty() ||
+      prev->vruntime <= procs_.front().vruntime + granularity();
+  }
+
+  void charge(proc *p, u64 cycles) override
+  {
+    p->vruntime += cycles * NICE_0_WEIGHT / nice_weight[p->nice - NICE_MIN];
+  }
+
+  void migrate(proc *p, sched_class *to) override
+  {
+    // vruntime is only meaningful relative to a queue's
+    // min_vruntime_, so rebase p onto the destination queue.
+    fair_class *dst = static_cast<fair_class*>(to);
+    u64 lag = p->vruntime > min_vruntime_ ? p->vruntime - min_vruntime_ : 0;
+    p->vruntime = dst->min_vruntime_ + lag;
+  }
+
+private:
+  // The vruntime a proc may run ahead of the queue head before it is
+  // preempted, to avoid switching back and forth on every tick.
+  static u64 granularity()
+  {
+    extern u64 cpuhz;
+    return cpuhz / 1000;
+  }
+
+  // The vruntime credit given to a waking proc.
+  static u64 wakeup_credit()
+  {
+    extern u64 cpuhz;
+    return cpuhz / 1000 * QUANTUM / 2;
+  }
+
+  u64 min_vruntime_;
+};
+
+// Fixed-point scale of schedule::load_avg_.
+enum { SCHED_LOAD_SCALE = 1024 };
+
+// The maximum number of queued procs balance_move_to considers when
+// picking a victim.
+enum { SCHED_STEAL_SCAN = 8 };
+
+// The cost of moving p to CPU cpu, in terms of the cache and memory
+// locality it would lose.
+static int
+migration_cost(const proc *p, int cpu)
+{
+  // A proc that has never run has nothing cached anywhere.
+  if (p->tsc == 0 || p->data_cpuid == cpu)
+    return 0;
+  if (p->data_cpuid >= 0 && cpus[p->data_cpuid].node == cpus[cpu].node)
+    return 1;
+  return 2;
+}
+
+struct schedule {
 public:
   schedule(int id);
   ~schedule() {};
@@ -28,29 +226,62 @@ public:
   int id_;    // XXX false sharing on this var???
 
   void enq(proc* entry);
-  proc* deq();
+  proc* deq(proc* prev);
+  void charge(proc* p, u64 cycles);
   void dump(print_stream *);
 
-  void enq_dwork(dwork *w);
-  void try_dwork();
+  bool balance_move_to(schedule *other);
+
+  // The number of runnable procs on this CPU, including the running
+  // one.  This is racy when called from other CPUs.
+  u64 load() const { return nqueued_ + running_; }
+  // Whether this CPU has procs that could be stolen.
+  bool stealable() const { return cansteal_; }
+  u64 load_avg() const { return load_avg_; }
 
-  void balance_move_to(schedule *other);
-  u64 balance_count() const;
+  void set_running(bool running) { running_ = running; }
+  void tick();
+
+  // Rebase p's class state for a move from this CPU to 'to'.  p must
+  // not be on a run queue.  This reads 'to' without its lock, which
+  // is fine for the heuristic state classes keep.
+  void migrate(proc* p, schedule* to)
+  {
+    class_of(p)->migrate(p, to->class_of(p));
+  }
 
   sched_stat stats_;
   u64 ncansteal_;
 private:
   void sanity(void);
 
+  sched_class* class_of(const proc *p)
+  {
+    return p->sched_class == SCHED_FIFO ? (sched_class*)&fifo_ : &fair_;
+  }
+
   struct spinlock lock_ __mpalign__;
-  ilist<proc, &proc::sched_link> proc_;
-  isqueue<dwork, &dwork::link_> work_;
+  // Scheduling classes, in priority order.
+  fifo_class fifo_;
+  fair_class fair_;
+  sched_class *classes_[2];
+
+  // Load summary, read by other CPUs when balancing.  nqueued_ and
+  // cansteal_ are protected by lock_; the rest are only written by
+  // this CPU.
   volatile bool cansteal_ __mpalign__;
+  volatile u32 nqueued_;
+  volatile bool running_;
+  // Exponentially-weighted moving average of load(), sampled every
+  // tick, in units of 1/SCHED_LOAD_SCALE procs.
+  volatile u64 load_avg_;
   __padout__;
 };
 
 schedule::schedule(int id)
-  : balance_pool(1), id_(id), lock_("schedule::lock_", LOCKSTAT_SCHED)
+  : id_(id), lock_("schedule::lock_", LOCKSTAT_SCHED),
+    classes_{&fifo_, &fair_}, cansteal_(false), nqueued_(0),
+    running_(false), load_avg_(0)
 {
   ncansteal_ = 0;
   stats_.enqs = 0;
@@ -62,70 +293,80 @@ schedule::schedule(int id)
   stats_.schedstart = 0;
 }
 
-u64 
-schedule::balance_count() const {
-  // 1 if the number of processes that in runnable state and have
-  // run long enough that they could be stolen is bigger than 1?
-  // XXX length of queue?
-  //
-  // XXX reading ncansteal could be expensive, but local core updates
-  // it and remote core reads it, experiencing a cache-line transfer
-  return cansteal_ > 0 ? 1 : 0;
+void
+schedule::tick()
+{
+  load_avg_ = (load_avg_ * 7 + load() * SCHED_LOAD_SCALE) / 8;
 }
 
-void 
+// Move one queued proc from this CPU to target.  Among the last few
+// procs in the queues (the ones that would run last here), this picks
+// the one that would lose the least locality by moving, preferring
+// the one that ran least recently.  Returns true if a proc was moved.
+bool
 schedule::balance_move_to(schedule* target)
 {
   proc *victim = nullptr;
+  sched_class *from = nullptr;
+  int best = 0;
+  int scanned = 0;
 
   if (!cansteal_ || !tryacquire(&lock_))
-    return;
-
-  for (auto it = proc_.begin(); it != proc_.end(); ++it) {
-    if ((*it).cansteal(true)) {
-      proc_.erase(it);
-      if (--ncansteal_ == 0)
-        cansteal_ = false;
-      sanity();
-      victim = &(*it);
+    return false;
+
+  for (sched_class *c : classes_) {
+    for (auto it = c->procs_.end(); it != c->procs_.begin() &&
+           scanned < SCHED_STEAL_SCAN; ) {
+      proc *p = &*--it;
+      ++scanned;
+      if (!p->cansteal(true))
+        continue;
+      int cost = migration_cost(p, target->id_);
+      if (!victim || cost < best || (cost == best && p->tsc < victim->tsc)) {
+        victim = p;
+        from = c;
+        best = cost;
+      }
     }
   }
+  if (victim) {
+    from->procs_.erase(from->procs_.iterator_to(victim));
+    nqueued_ = nqueued_ - 1;
+    if (--ncansteal_ == 0)
+      cansteal_ = false;
+    sanity();
+  }
   release(&lock_);
   if (!victim) {
     ++stats_.misses;
-    return;
+    return false;
   }
 
   acquire(&victim->lock);
-  if (victim->get_state() == RUNNABLE && !victim->cpu_pin &&
-      victim->curcycles != 0 && victim->curcycles > VICTIMAGE)
-  {
+  if (victim->cansteal(true)) {
     victim->curcycles = 0;
-    victim->cpuid = mycpu()->id;
+    victim->cpuid = target->id_;
+    // The victim's class may have changed while it was queued
+    if (class_of(victim) == from)
+      from->migrate(victim, target->class_of(victim));
     target->enq(victim);
     release(&victim->lock);
-    //cprintf("%d: stole %s from %d\n", mycpu()->id, victim->name, id_);
     ++stats_.steals;
-    return;
+    return true;
   }
+  // Can't happen while the victim was queued, but don't lose it.
   ++stats_.misses;
-  cprintf("%d: don't steal %s---hasn't run long enough\n", 
-          mycpu()->id, victim->name);
-#if 0
-  // XXX why is this code here?  you should only steal a runnable process
-  // it has run for a while on the cpu, or not all.
-  if (victim->get_state() == RUNNABLE) {
-    target->enq(victim);
-  }
-#endif
+  enq(victim);
   release(&victim->lock);
+  return false;
 }
 
 void
 schedule::enq(proc* p)
 {
   scoped_acquire x(&lock_);
-  proc_.push_back(p);
+  class_of(p)->enq(p);
+  nqueued_ = nqueued_ + 1;
   if (p->cansteal(true))
     if (ncansteal_++ == 0) {
       cansteal_ = true;
@@ -134,29 +375,52 @@ schedule::enq(proc* p)
   stats_.enqs++;
 }
 
+// Return the next proc to run on this CPU, or nullptr if there is
+// nothing to run.  prev, if not null, is the runnable proc that is
+// giving up this CPU; if it should keep running instead of anything
+// queued, this also returns nullptr.
 proc*
-schedule::deq(void)
+schedule::deq(proc* prev)
 {   
-  if (proc_.empty())
+  if (fifo_.empty() && fair_.empty())
     return nullptr;
-  // Remove from head
   scoped_acquire x(&lock_);
-  if (proc_.empty()) 
+  proc *p = nullptr;
+  for (sched_class *c : classes_) {
+    // Let fair-share procs in once FIFO procs have had their share.
+    if (c == &fifo_ && fifo_.throttled() && !fair_.empty())
+      continue;
+    if (prev && class_of(prev) == c && c->keep(prev))
+      return nullptr;
+    if (!c->empty()) {
+      p = c->deq();
+      break;
+    }
+  }
+  if (!p)
     return nullptr;
-  proc &p = proc_.front();
-  proc_.pop_front();
-  if (p.cansteal(true))
+  nqueued_ = nqueued_ - 1;
+  if (p->cansteal(true))
     if (--ncansteal_ == 0)
       cansteal_ = false;
   sanity();
   stats_.deqs++;
-  return &p;
+  return p;
+}
+
+void
+schedule::charge(proc* p, u64 cycles)
+{
+  // Only the local CPU touches the running proc's accounting, so
+  // this doesn't need lock_.
+  class_of(p)->charge(p, cycles);
 }
 
 void
 schedule::dump(print_stream *s)
 {
-  s->print(" enq ", stats_.enqs, " deqs ", stats_.deqs, " steals ", stats_.steals, " misses ", stats_.misses);
+  s->print(" enq ", stats_.enqs, " deqs ", stats_.deqs, " steals ", stats_.steals, " misses ", stats_.misses,
+           " load ", load(), " avg ", load_avg_ * 100 / SCHED_LOAD_SCALE, "%");
 }
 
 void
@@ -165,38 +429,122 @@ schedule::sanity(void)
 #if DEBUG
   u64 n = 0;
 
-  for (auto &p : proc_) 
-    if (p.cansteal(true))
-      n++;
+  for (sched_class *c : classes_)
+    for (auto &p : c->procs_)
+      if (p.cansteal(true))
+        n++;
   
   if (n != ncansteal_)
     panic("schedule::sanity: %lu != %lu", n, ncansteal_);
 #endif
 }
 
-void
-schedule::enq_dwork(dwork *w)
+// A bitmap of CPUs that are idle and haven't been claimed by a
+// wakeup.  A CPU sets its bit when it is running its idle proc and
+// clears it when it switches to anything else.  addrun claims an idle
+// CPU by atomically clearing its bit, so concurrent wakeups pick
+// different CPUs and each idle CPU gets at most one reschedule IPI.
+class idle_map
 {
-  scoped_acquire x(&lock_);
-  work_.push_back(w);
-}
+  enum {
+    BITS_PER_WORD = 64,
+    NWORDS = (NCPU + BITS_PER_WORD - 1) / BITS_PER_WORD
+  };
 
-void
-schedule::try_dwork(void)
-{
-  while (!work_.empty()) {
-    auto &w = work_.front();
-    work_.pop_front();
-    w.run();
+  std::atomic<u64> words_[NWORDS];
+
+  std::atomic<u64> &word(int cpu) { return words_[cpu / BITS_PER_WORD]; }
+  static u64 bit(int cpu) { return 1ull << (cpu % BITS_PER_WORD); }
+
+public:
+  idle_map() : words_{} { }
+
+  bool test(int cpu)
+  {
+    return word(cpu).load(std::memory_order_relaxed) & bit(cpu);
   }
-}
+
+  // Set or clear cpu's bit, avoiding the atomic (and the cache line
+  // transfer) if it already has the right value.
+  void set(int cpu, bool idle)
+  {
+    if (test(cpu) == idle)
+      return;
+    if (idle)
+      word(cpu).fetch_or(bit(cpu));
+    else
+      word(cpu).fetch_and(~bit(cpu));
+  }
+
+  // Clear cpu's bit and return true if it was set.
+  bool claim(int cpu)
+  {
+    return test(cpu) && (word(cpu).fetch_and(~bit(cpu)) & bit(cpu));
+  }
+};
 
 struct sched_dir {
 private:
-  balancer<sched_dir, schedule> b_;
   percpu<schedule*> schedule_;
+  idle_map idle_;
+
+  // Record what this CPU is about to run.
+  void note_running(proc *p) {
+    bool idle = (p == idleproc());
+    schedule_[myid()]->set_running(!idle);
+    idle_.set(myid(), idle);
+  }
+
+  // Choose the CPU that woken or new proc p should run on.  This
+  // prefers, in order: p's previous CPU if it is idle (its cache is
+  // still warm); another idle CPU in the same NUMA node; the waking
+  // CPU if it is in the same node and less loaded; and finally p's
+  // previous CPU.  If this returns an idle CPU, it has been claimed
+  // and *idle is set to true; the caller must poke it.
+  int select_cpu(proc *p, bool *idle) {
+    int prev = p->cpuid;
+    int me = myid();
+    *idle = true;
+
+    if (idle_.claim(prev))
+      return prev;
+
+    numa_node *node = cpus[prev].node;
+    if (node) {
+      size_t n = node->cpuids.size();
+      for (size_t i = 0; i < n; i++) {
+        // Start at the waker's position so wakers spread out
+        int cpu = node->cpuids[(me + i) % n];
+        if (idle_.claim(cpu))
+          return cpu;
+      }
+    }
+
+    *idle = false;
+    if (me != prev && cpus[me].node == node &&
+        schedule_[me]->load() + 1 < schedule_[prev]->load())
+      return me;
+    return prev;
+  }
+
+  // Consider cpu as a victim for a steal by 'me', updating *victim if
+  // cpu is busier.
+  void consider(int cpu, int me, u64 min_load, u64 min_avg,
+                schedule **victim) {
+    if (cpu == me)
+      return;
+    schedule *s = schedule_[cpu];
+    if (!s->stealable())
+      return;
+    u64 load = s->load();
+    if (load < min_load || s->load_avg() < min_avg)
+      return;
+    if (!*victim || load > (*victim)->load())
+      *victim = s;
+  }
+
 public:
-  sched_dir() : b_(this) {
+  sched_dir() {
     for (int i = 0; i < NCPU; i++) {
       schedule_[i] = new schedule(i);
     }
@@ -204,37 +552,87 @@ public:
   ~sched_dir() {};
   NEW_DELETE_OPS(sched_dir);
 
-  schedule* balance_get(int id) const {
-    return schedule_[id];
+  // Try to move a proc to this idle CPU from the busiest CPU that has
+  // a stealable proc.  CPUs in this CPU's NUMA node are tried first.
+  // CPUs in other nodes are only robbed if they are persistently
+  // overloaded, since the move loses memory as well as cache
+  // locality.  Returns 1 if a proc was stolen.
+  int steal() {
+    if (!SCHED_LOAD_BALANCE)
+      return 0;
+
+    scoped_cli cli;
+    int me = myid();
+    schedule *mysched = schedule_[me];
+    if (mysched->load() > 0)
+      return 0;
+
+    // Start at a random offset so idle CPUs don't all pile on the
+    // same victim
+    u64 start = rnd();
+    schedule *victim = nullptr;
+    numa_node *node = mycpu()->node;
+    if (node) {
+      for (size_t i = 0; i < node->cpuids.size(); i++)
+        consider(node->cpuids[(start + i) % node->cpuids.size()], me,
+                 2, 0, &victim);
+    }
+    if (!victim) {
+      for (int i = 0; i < ncpu; i++) {
+        int cpu = (start + i) % ncpu;
+        if (node && cpus[cpu].node == node)
+          continue;
+        consider(cpu, me, 3, 2 * SCHED_LOAD_SCALE, &victim);
+      }
+    }
+    if (victim && victim->balance_move_to(mysched))
+      return 1;
+    return 0;
   }
 
-  void steal() {
-    if (!SCHED_LOAD_BALANCE)
-      return;
-    pushcli();
-    b_.balance();
-    popcli();
+  void tick() {
+    schedule_[myid()]->tick();
   }
 
+  // Make woken or new proc p runnable, placing it on a CPU that can
+  // run it soon.
   void addrun(struct proc* p) {
     p->set_state(RUNNABLE);
+
+    bool idle = false;
+    if (!p->cpu_pin) {
+      int cpu = select_cpu(p, &idle);
+      if (cpu != (int)p->cpuid) {
+        schedule_[p->cpuid]->migrate(p, schedule_[cpu]);
+        p->cpuid = cpu;
+      }
+    }
     schedule_[p->cpuid]->enq(p);
-  }
 
-  void pushwork(struct dwork *w, int cpu) {
-    schedule_[cpu]->enq_dwork(w);
+    // A real-time proc preempts a fair-share proc as soon as it
+    // returns to user space.
+    bool preempt = (p->sched_class == SCHED_FIFO);
+    if (p->cpuid == myid()) {
+      if (preempt && myproc() && myproc()->sched_class != SCHED_FIFO)
+        myproc()->yield_ = true;
+    } else if (idle || preempt) {
+      lapic->send_resched(&cpus[p->cpuid]);
+    }
   }
 
-  void trywork() {
-    schedule_[mycpu()->id]->try_dwork();
+  // Put p, which was just switched out while still runnable, back on
+  // its CPU's run queue.
+  void requeue(struct proc* p) {
+    p->set_state(RUNNABLE);
+    schedule_[p->cpuid]->enq(p);
   }
 
-  proc* next() {
-    return schedule_[mycpu()->id]->deq();
+  proc* next(proc* prev) {
+    return schedule_[mycpu()->id]->deq(prev);
   }
 
   void
-  sched(void)
+  sched(bool compete)
   {
     extern void forkret(void);
     int intena;
@@ -256,10 +654,19 @@ public:
     if(readrflags()&FL_IF)
       panic("sched interruptible");
     intena = mycpu()->intena;
-    myproc()->curcycles += rdtsc() - myproc()->tsc;
-
-    // Interrupts are disabled
-    next = this->next();
+    u64 ran = rdtsc() - myproc()->tsc;
+    myproc()->curcycles += ran;
+    if (myproc() != idleproc())
+      schedule_[mycpu()->id]->charge(myproc(), ran);
+
+    // Interrupts are disabled.  If this is a preemption, let the
+    // current proc compete with the run queue if it could keep
+    // running here.
+    prev = myproc();
+    if (!compete || prev == idleproc() || prev->get_state() != RUNNABLE ||
+        prev->cpuid != mycpu()->id)
+      prev = nullptr;
+    next = this->next(prev);
 
     u64 t = rdtsc();
     if (myproc() == idleproc())
@@ -274,6 +681,7 @@ public:
           myproc()->cpuid != mycpu()->id) {
         next = idleproc();
       } else {
+        note_running(myproc());
         myproc()->set_state(RUNNING);
         mycpu()->intena = intena;
         release(&myproc()->lock);
@@ -287,6 +695,7 @@ public:
     prev = myproc();
     mycpu()->proc = next;
     mycpu()->prev = prev;
+    note_running(next);
 
     if (prev->get_state() == ZOMBIE)
       mtstop(prev);
@@ -303,13 +712,7 @@ public:
     }
     mtrec();
 
-    // Set task-switched and monitor coprocessor bit and clear emulation
-    // bit so we get a #NM exception if the new process tries to use FPU
-    // or MMX instructions.
-    auto cr0 = rcr0();
-    auto ncr0 = (cr0 | CR0_TS | CR0_MP) & ~CR0_EM;
-    if (cr0 != ncr0)
-      lcr0(ncr0);
+    fpu_switch(prev, next);
 
     swtch(&prev->context, next->context);
     mycpu()->intena = intena;
@@ -335,15 +738,15 @@ post_swtch(void)
 {
   if (mycpu()->prev->get_state() == RUNNABLE && 
       mycpu()->prev != idleproc())
-    addrun(mycpu()->prev);
+    thesched_dir.requeue(mycpu()->prev);
   release(&mycpu()->prev->lock);
-  thesched_dir.trywork();
+  work_switch();
 }
 
 void
-sched(void)
+sched(bool compete)
 {
-  thesched_dir.sched();
+  thesched_dir.sched(compete);
 }
 
 void
@@ -352,13 +755,6 @@ addrun(struct proc* p)
   thesched_dir.addrun(p);
 }
 
-int
-dwork_push(struct dwork *w, int cpu)
-{
-  thesched_dir.pushwork(w, cpu);
-  return 0;
-}
-
 static int
 statread(mdev* m, char *dst, u32 off, u32 n)
 {
@@ -370,8 +766,13 @@ statread(mdev* m, char *dst, u32 off, u32 n)
 int
 steal(void)
 {
-  thesched_dir.steal();
-  return 0;
+  return thesched_dir.steal();
+}
+
+void
+sched_tick(void)
+{
+  thesched_dir.tick();
 }
 
 void
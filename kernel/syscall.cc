@@ -8,6 +8,7 @@
 #include "cpu.hh"
 #include "kmtrace.hh"
 #include "errno.h"
+#include <uk/unistd.h>
 
 extern "C" int __uaccess_mem(void* dst, const void* src, u64 size);
 extern "C" int __uaccess_str(char* dst, const char* src, u64 size);
@@ -135,3 +136,56 @@ syscall(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 num)
 #endif
   }
 }
+
+int sys_fork_flags(int flags);
+int sys_execv(userptr_str upath, userptr<userptr_str> uargv);
+
+// Run the n system calls in recs in one trap, storing each one's
+// return value in its record.  Returns the number of records run,
+// which is less than n if one failed with SYSCALLV_STOP or we were
+// killed, or -1 if recs is bad.
+//SYSCALL
+int
+sys_syscallv(userptr<struct syscall_rec> recs, int n, int flags)
+{
+  typedef u64 (*syscall_t)(u64, u64, u64, u64, u64, u64);
+
+  if (n < 0 || n > SYSCALLV_MAX || (flags & ~SYSCALLV_STOP_ON_ERROR))
+    return -1;
+
+  // Results of the last 15 records, for SYSCALLV_ARG.
+  u64 rets[16];
+  int i;
+  for (i = 0; i < n; i++) {
+    struct syscall_rec rec;
+    if (!(recs + i).load(&rec))
+      return i ? i : -1;
+    // These don't come back to the batch.
+    if (rec.num >= (u32)nsyscalls ||
+        syscalls[rec.num] == (syscall_t)sys_syscallv ||
+        syscalls[rec.num] == (syscall_t)sys_fork_flags ||
+        syscalls[rec.num] == (syscall_t)sys_execv)
+      return i ? i : -1;
+
+    for (int a = 0; a < 6; a++) {
+      int back = (rec.flags >> (SYSCALLV_ARG_SHIFT + 4 * a)) & 0xf;
+      if (back > i)
+        return i ? i : -1;
+      if (back)
+        rec.args[a] = rets[(i - back) % 16];
+    }
+
+    u64 r = syscall(rec.args[0], rec.args[1], rec.args[2],
+                    rec.args[3], rec.args[4], rec.args[5], rec.num);
+    rets[i % 16] = r;
+    rec.ret = r;
+    if (!userptr<long>(&(recs + i).unsafe_get()->ret).store(&rec.ret))
+      return i + 1;
+    if (myproc()->killed)
+      return i + 1;
+    if ((s64)r < 0 && ((rec.flags & SYSCALLV_STOP) ||
+                       (flags & SYSCALLV_STOP_ON_ERROR)))
+      return i + 1;
+  }
+  return i;
+}
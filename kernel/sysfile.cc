@@ -17,6 +17,7 @@
 #include <vector>
 #include "kstream.hh"
 #include <uk/spawn.h>
+#include <uk/ring.h>
 #include "filetable.hh"
 
 sref<file>
@@ -76,15 +77,13 @@ compute_offset(file_inode *fi, off_t *fioffp, off_t offset, int whence)
     return fioff + offset;
   }
 
-  case SEEK_END:
-    if (offset < 0) {
-      mfile::page_state ps = fi->ip->as_file()->get_page((-offset - 1) / PGSIZE);
-      if (!ps.get_page_info())
-        // Attempt to seek before the beginning of the file
-        return -1;
-    }
-
-    return offset + *fi->ip->as_file()->read_size();
+  case SEEK_END: {
+    off_t size = *fi->ip->as_file()->read_size();
+    if (offset < 0 && -offset > size)
+      // Attempt to seek before the beginning of the file
+      return -1;
+    return offset + size;
+  }
   }
   return -1;
 }
@@ -102,6 +101,14 @@ sys_lseek(int fd, off_t offset, int whence)
     return -1;
 
   file_inode* fi = static_cast<file_inode*>(ff);
+  if (fi->ip->type() == mnode::types::dir) {
+    // Directories can only be rewound, which restarts getdents.
+    if (offset != 0 || whence != SEEK_SET)
+      return -1;
+    auto l = fi->off_lock.guard();
+    fi->off = 0;
+    return 0;
+  }
   if (fi->ip->type() != mnode::types::file)
     return -1;                  // ESPIPE
 
@@ -126,6 +133,142 @@ sys_lseek(int fd, off_t offset, int whence)
   return new_offset;
 }
 
+// Return the regular file open for writing at fd, or null.
+static mfile*
+getwritefile(int fd, sref<file>* fp)
+{
+  *fp = getfile(fd);
+  if (!*fp)
+    return nullptr;
+
+  file* ff = fp->get();
+  if (&typeid(*ff) != &typeid(file_inode))
+    return nullptr;
+
+  file_inode* fi = static_cast<file_inode*>(ff);
+  if (!fi->writable || fi->ip->type() != mnode::types::file)
+    return nullptr;
+  return fi->ip->as_file();
+}
+
+//SYSCALL
+int
+sys_ftruncate(int fd, off_t length)
+{
+  sref<file> f;
+  mfile* mf = getwritefile(fd, &f);
+  if (!mf || length < 0)
+    return -1;
+
+  // Appends may land in the new last page, and can't read it in once
+  // they've started, so read it in now.
+  if (mf->is_backed(length / PGSIZE))
+    mf->dirty_page(length / PGSIZE);
+  mf->write_size().resize(length);
+  return 0;
+}
+
+// Allocate zeroed pages for the holes in [offset, offset+len) and,
+// unless mode has FALLOC_FL_KEEP_SIZE, grow the file to cover the
+// range.  Pages past EOF are never allocated, so with
+// FALLOC_FL_KEEP_SIZE only the part of the range below EOF is
+// affected.  The range must fit in the largest file the disk can
+// hold.
+//SYSCALL
+int
+sys_fallocate(int fd, int mode, off_t offset, off_t len)
+{
+  if (offset < 0 || len <= 0 || (mode & ~FALLOC_FL_KEEP_SIZE))
+    return -1;
+  const u64 maxsize = (u64)MAXFILE * BSIZE;
+  if ((u64)offset > maxsize || (u64)len > maxsize - offset)
+    return -1;
+
+  sref<file> f;
+  mfile* mf = getwritefile(fd, &f);
+  if (!mf)
+    return -1;
+
+  u64 end = offset + len, oldsize = 0;
+  bool grew = false;
+  if (!(mode & FALLOC_FL_KEEP_SIZE)) {
+    auto resize = mf->write_size();
+    oldsize = resize.read_size();
+    if (end > oldsize) {
+      resize.resize(end);
+      grew = true;
+    }
+  }
+  // Allocate outside the resize lock, one page at a time.  Pages
+  // can't exist past EOF, so the file has to grow first.
+  if (mf->allocate(offset, end))
+    return 0;
+
+  // Don't leave the file grown over pages we couldn't allocate,
+  // unless someone else has resized it since.
+  if (grew) {
+    auto resize = mf->write_size();
+    if (resize.read_size() == end)
+      resize.resize(oldsize);
+  }
+  return -1;
+}
+
+// Advise how [offset, offset+len) of the file open at fd will be
+// read.  A len of 0 means through the end of the file, and any range
+// is clipped there.  NORMAL, SEQUENTIAL and RANDOM set the readahead
+// mode of this open file, WILLNEED starts reading the range in, and
+// DONTNEED drops the range's clean pages.
+//SYSCALL
+int
+sys_posix_fadvise(int fd, off_t offset, off_t len, int advice)
+{
+  // offset + len has to fit in an off_t.
+  if (offset < 0 || len < 0 || (u64)offset + len > (~0ull >> 1))
+    return -1;
+
+  sref<file> f = getfile(fd);
+  if (!f)
+    return -1;
+  file* ff = f.get();
+  if (&typeid(*ff) != &typeid(file_inode))
+    return -1;
+  file_inode* fi = static_cast<file_inode*>(ff);
+  if (fi->ip->type() != mnode::types::file)
+    return -1;
+  mfile* mf = fi->ip->as_file();
+
+  // Only pages below EOF can be read in or cached.
+  u64 size = *mf->read_size();
+  u64 end = len && (u64)(offset + len) < size ? offset + len : size;
+  u64 first = offset / PGSIZE;
+  u64 npages = end > (u64)offset ? PGROUNDUP(end) / PGSIZE - first : 0;
+
+  switch (advice) {
+  case POSIX_FADV_NORMAL:
+    fi->ra.mode = readahead_state::NORMAL;
+    return 0;
+  case POSIX_FADV_RANDOM:
+    fi->ra.mode = readahead_state::RANDOM;
+    return 0;
+  case POSIX_FADV_SEQUENTIAL:
+    fi->ra.mode = readahead_state::SEQUENTIAL;
+    return 0;
+  case POSIX_FADV_WILLNEED:
+    if (npages)
+      mf->readahead_async(first, npages);
+    return 0;
+  case POSIX_FADV_DONTNEED:
+    for (u64 idx = first; idx < first + npages; idx++)
+      mf->evict_page(idx);
+    return 0;
+  case POSIX_FADV_NOREUSE:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
 //SYSCALL
 int
 sys_close(int fd)
@@ -153,14 +296,11 @@ sys_fsync(int fd)
   return 0;
 }
 
-//SYSCALL
+// The bodies of read, write, pread and pwrite, for callers that
+// already hold the file.
 ssize_t
-sys_read(int fd, userptr<void> p, size_t n)
+file_read(file *f, userptr<void> p, size_t n)
 {
-  sref<file> f = getfile(fd);
-  if (!f)
-    return -1;
-
   char *b = kalloc("readbuf");
   if (!b)
     return -1;
@@ -178,12 +318,17 @@ sys_read(int fd, userptr<void> p, size_t n)
 
 //SYSCALL
 ssize_t
-sys_pread(int fd, void *ubuf, size_t count, off_t offset)
+sys_read(int fd, userptr<void> p, size_t n)
 {
   sref<file> f = getfile(fd);
   if (!f)
     return -1;
+  return file_read(f.get(), p, n);
+}
 
+ssize_t
+file_pread(file *f, void *ubuf, size_t count, off_t offset)
+{
   if (count > 4*1024*1024)
     count = 4*1024*1024;
 
@@ -197,14 +342,20 @@ sys_pread(int fd, void *ubuf, size_t count, off_t offset)
 
 //SYSCALL
 ssize_t
-sys_write(int fd, const userptr<void> p, size_t n)
+sys_pread(int fd, void *ubuf, size_t count, off_t offset)
 {
-  kstats::timer timer_fill(&kstats::write_cycles);
-  kstats::inc(&kstats::write_count);
-
   sref<file> f = getfile(fd);
   if (!f)
     return -1;
+  return file_pread(f.get(), ubuf, count, offset);
+}
+
+ssize_t
+file_write(file *f, const userptr<void> p, size_t n)
+{
+  kstats::timer timer_fill(&kstats::write_cycles);
+  kstats::inc(&kstats::write_count);
+
   char *b = kalloc("writebuf");
   if (!b)
     return -1;
@@ -219,12 +370,65 @@ sys_write(int fd, const userptr<void> p, size_t n)
 
 //SYSCALL
 ssize_t
-sys_pwrite(int fd, const void *ubuf, size_t count, off_t offset)
+sys_write(int fd, const userptr<void> p, size_t n)
 {
   sref<file> f = getfile(fd);
   if (!f)
     return -1;
+  return file_write(f.get(), p, n);
+}
+
+// Move up to n bytes from infd to outfd without copying them through
+// user space.  If inoffp or outoffp is non-null, it points to the
+// offset to read or write at, which is updated instead of the file
+// offset.
+static ssize_t
+splice_fds(int infd, userptr<off_t> inoffp, int outfd, userptr<off_t> outoffp,
+           size_t n)
+{
+  sref<file> in = getfile(infd);
+  sref<file> out = getfile(outfd);
+  if (!in || !out || in.get() == out.get())
+    return -1;
+
+  off_t inoff, outoff;
+  if (inoffp && (!inoffp.load(&inoff) || inoff < 0))
+    return -1;
+  if (outoffp && (!outoffp.load(&outoff) || outoff < 0))
+    return -1;
+
+  ssize_t r = in->splice_to(out.get(), inoffp ? &inoff : nullptr,
+                            outoffp ? &outoff : nullptr, n);
+  if (r > 0) {
+    if (inoffp && !inoffp.store(&inoff))
+      return -1;
+    if (outoffp && !outoffp.store(&outoff))
+      return -1;
+  }
+  return r;
+}
+
+//SYSCALL
+ssize_t
+sys_sendfile(int outfd, int infd, userptr<off_t> offset, size_t count)
+{
+  return splice_fds(infd, offset, outfd, nullptr, count);
+}
+
+//SYSCALL
+ssize_t
+sys_splice(int infd, userptr<off_t> inoff, int outfd, userptr<off_t> outoff,
+           size_t len, unsigned int flags)
+{
+  // The flags are only hints.
+  if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE))
+    return -1;
+  return splice_fds(infd, inoff, outfd, outoff, len);
+}
 
+ssize_t
+file_pwrite(file *f, const void *ubuf, size_t count, off_t offset)
+{
   if (count > 4*1024*1024)
     count = 4*1024*1024;
 
@@ -234,6 +438,16 @@ sys_pwrite(int fd, const void *ubuf, size_t count, off_t offset)
   return f->pwrite(b, count, offset);
 }
 
+//SYSCALL
+ssize_t
+sys_pwrite(int fd, const void *ubuf, size_t count, off_t offset)
+{
+  sref<file> f = getfile(fd);
+  if (!f)
+    return -1;
+  return file_pwrite(f.get(), ubuf, count, offset);
+}
+
 //SYSCALL
 int
 sys_fstatx(int fd, userptr<struct stat> st, enum stat_flags flags)
@@ -502,7 +716,7 @@ sys_openat(int dirfd, userptr_str path, int omode, ...)
 
   if (m->type() == mnode::types::file && (omode & O_TRUNC))
     if (*m->as_file()->read_size())
-      m->as_file()->write_size().resize_nogrow(0);
+      m->as_file()->write_size().resize(0);
 
   sref<file> f = make_sref<file_inode>(
     m, !(rwmode == O_WRONLY), !(rwmode == O_RDONLY), !!(omode & O_APPEND));
@@ -645,6 +859,39 @@ sys_pipe(userptr<int> fd)
   return sys_pipe2(fd, 0);
 }
 
+//SYSCALL
+int
+sys_ring_create(size_t slotsize, size_t nslots, int flags)
+{
+  if (flags & ~O_CLOEXEC)
+    return -1;
+  if (slotsize == 0 || slotsize > RING_MAX_SLOTSIZE ||
+      nslots == 0 || nslots > RING_MAX_SLOTS || (nslots & (nslots - 1)))
+    return -1;
+  u64 size = RING_SIZE(slotsize, nslots);
+  if (size > RING_MAX_SIZE)
+    return -1;
+
+  // The ring is an anonymous shared file, like a MAP_SHARED|
+  // MAP_ANONYMOUS mapping, except that the ends get to it through a
+  // file descriptor.  Only the header needs writing; the slots are
+  // holes, which read as zero, and zero means free.
+  sref<mnode> m = anon_fs->alloc(mnode::types::file).mn();
+  m->as_file()->write_size().resize(PGROUNDUP(size));
+  sref<file> f = make_sref<file_inode>(m, true, true, false);
+
+  struct ring_header h;
+  memset(&h, 0, sizeof(h));
+  h.magic = RING_MAGIC;
+  h.nslots = nslots;
+  h.slotsize = slotsize;
+  h.stride = RING_STRIDE(slotsize);
+  if (f->pwrite((const char*)&h, sizeof(h), 0) != sizeof(h))
+    return -1;
+
+  return fdalloc(std::move(f), flags);
+}
+
 //SYSCALL
 int
 sys_readdir(int dirfd, const userptr<char> prevptr, userptr<char> nameptr)
@@ -675,6 +922,73 @@ sys_readdir(int dirfd, const userptr<char> prevptr, userptr<char> nameptr)
   return 1;
 }
 
+// Fill ubuf with struct dirent64 records for the next entries of
+// directory dirfd, resuming where the previous call left off.
+// Returns the number of bytes filled, 0 at the end of the directory,
+// or -1 on error.
+//SYSCALL
+ssize_t
+sys_getdents(int dirfd, userptr<void> ubuf, size_t len)
+{
+  sref<file> df = getfile(dirfd);
+  if (!df)
+    return -1;
+
+  file* dff = df.get();
+  if (&typeid(*dff) != &typeid(file_inode))
+    return -1;
+
+  file_inode* dfi = static_cast<file_inode*>(dff);
+  if (dfi->ip->type() != mnode::types::dir)
+    return -1;
+
+  size_t max = len / sizeof(struct dirent64);
+  if (max == 0)
+    return -1;
+
+  // Collect entries in a kernel page, since we can't fault on user
+  // memory while enumerating, and copy them out a page at a time.
+  struct dirent64* kbuf = (struct dirent64*)kalloc("getdents");
+  if (!kbuf)
+    return -1;
+  auto cleanup = scoped_cleanup([kbuf](){ kfree(kbuf); });
+  const size_t per_page = PGSIZE / sizeof(struct dirent64);
+
+  auto l = dfi->off_lock.guard();
+  size_t total = 0;
+  bool done = false;
+  while (total < max && !done) {
+    size_t n = 0;
+    size_t want = max - total < per_page ? max - total : per_page;
+    strbuf<DIRSIZ> last;
+    done = dfi->ip->as_dir()->enumerate_entries(
+      dfi->off ? &dfi->dir_pos : nullptr,
+      [&](const strbuf<DIRSIZ>& name, u64 inum) {
+        if (n == want)
+          return false;
+        struct dirent64* de = &kbuf[n++];
+        de->d_ino = inum;
+        de->d_type = mnode::type_of(inum);
+        memmove(de->d_name, name.buf_, DIRSIZ);
+        de->d_name[DIRSIZ] = 0;
+        last = name;
+        return true;
+      });
+
+    if (n == 0)
+      break;
+    userptr<void> dst((char*)ubuf.unsafe_get() +
+                      total * sizeof(struct dirent64));
+    if (!dst.store_bytes(kbuf, n * sizeof(struct dirent64)))
+      return total ? (ssize_t)(total * sizeof(struct dirent64)) : -1;
+    dfi->dir_pos = last;
+    dfi->off += n;
+    total += n;
+  }
+
+  return total * sizeof(struct dirent64);
+}
+
 //SYSCALL {"uargs":["const char *upath", "char * const uargv[]", "const void *actions", "size_t actions_len"]}
 int
 sys_sys_spawn(userptr_str upath, userptr<userptr_str> uargv,
@@ -96,9 +96,9 @@ sys_nsleep(u64 nsec)
   return 0;
 }
 
-// return how many clock tick interrupts have occurred
-// since boot.
-//SYSCALL
+// Return the number of nanoseconds since boot.  User space normally
+// reads this from the clock page; see uptime in lib/time.c.
+//SYSCALL {"uname":"uptime_syscall"}
 u64
 sys_uptime(void)
 {
@@ -122,15 +122,10 @@ sys_mmap(userptr<void> addr, size_t len, int prot, int flags, int fd,
       return MAP_FAILED;
 
     if (flags & MAP_SHARED) {
+      // The file starts out as one big hole.  Pages get allocated
+      // as they are faulted in.
       m = anon_fs->alloc(mnode::types::file).mn();
-      auto resizer = m->as_file()->write_size();
-      for (size_t i = 0; i < len; i += PGSIZE) {
-        void* p = zalloc("MAP_ANON|MAP_SHARED");
-        if (!p)
-          throw_bad_alloc();
-        auto pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
-        resizer.resize_append(i + PGSIZE, pi);
-      }
+      m->as_file()->write_size().resize(PGROUNDUP(len));
     }
   } else {
     sref<file> f = myproc()->ftable->getfile(fd);
@@ -184,6 +179,19 @@ sys_madvise(userptr<void> addr, size_t len, int advice)
   uptr align_len = PGROUNDUP((uptr)addr + len) - align_addr;
 
   switch (advice) {
+  case MADV_NORMAL:
+  case MADV_RANDOM:
+  case MADV_SEQUENTIAL: {
+    u64 hint = 0;
+    if (advice == MADV_RANDOM)
+      hint = vmdesc::FLAG_RANDOM;
+    else if (advice == MADV_SEQUENTIAL)
+      hint = vmdesc::FLAG_SEQUENTIAL;
+    if (myproc()->vmap->set_access_hint(align_addr, align_len, hint) < 0)
+      return -1;
+    return 0;
+  }
+
   case MADV_WILLNEED:
     if (myproc()->vmap->willneed(align_addr, align_len) < 0)
       return -1;
@@ -261,6 +269,24 @@ sys_setaffinity(int cpu)
   return myproc()->set_cpu_pin(cpu);
 }
 
+// Set the scheduling class and nice value of process pid, or of the
+// calling process if pid is 0.
+//SYSCALL
+int
+sys_setscheduler(int pid, int policy, int nice)
+{
+  extern struct proc *bootproc;
+
+  // There are no users, so init stands in for root: only init and
+  // the real-time procs descended from it may make a proc real-time.
+  if (policy == SCHED_FIFO && myproc() != bootproc &&
+      myproc()->sched_class != SCHED_FIFO)
+    return -1;
+  if (pid == 0 || pid == myproc()->pid)
+    return myproc()->set_scheduler(policy, nice);
+  return proc::set_scheduler(pid, policy, nice);
+}
+
 //SYSCALL
 long
 sys_futex(const u64* addr, int op, u64 val, u64 timer)
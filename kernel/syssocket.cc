@@ -1,6 +1,8 @@
 #include "types.h"
 #include "kernel.hh"
 #include "net.hh"
+#include "proc.hh"
+#include "filetable.hh"
 #include <uk/fcntl.h>
 #include <uk/stat.h>
 #include <uk/socket.h>
@@ -163,14 +165,25 @@ sys_sendto(int sockfd, const userptr<void> buf, size_t len, int flags,
 int
 sys_connect(int sockfd, const userptr<struct sockaddr> addr, u32 addrlen)
 {
-  return -1;
+  sref<file> f = getfile(sockfd);
+  if (!f)
+    return -1;
+
+  struct sockaddr_storage ss;
+  if (!addr)
+    return -1;
+  int r = sockaddr_from_user(&ss, addr, addrlen);
+  if (r < 0)
+    return r;
+
+  return f->connect((struct sockaddr*)&ss, addrlen);
 }
 
 //SYSCALL
 ssize_t
 sys_send(int sockfd, const userptr<void> buf, size_t len, int flags)
 {
-  return -1;
+  return sys_sendto(sockfd, buf, len, flags, nullptr, 0);
 }
 
 //SYSCALL
@@ -179,3 +192,221 @@ sys_recv(int sockfd, userptr<void> buf, size_t len, int flags)
 {
   return sys_recvfrom(sockfd, buf, len, flags, nullptr, nullptr);
 }
+
+// Copy in the iovecs of *umsg and, if send, its destination and the
+// files it passes with SCM_RIGHTS, taking a reference to each.
+static int
+msghdr_from_user(kmsghdr *k, userptr<struct msghdr> umsg, bool send)
+{
+  struct msghdr msg;
+  if (!umsg.load(&msg))
+    return -1;
+  if (msg.msg_iovlen > UIO_MAXIOV)
+    return -1;
+  if (!userptr<struct iovec>(msg.msg_iov).load(k->iov, msg.msg_iovlen))
+    return -1;
+  k->iovcnt = msg.msg_iovlen;
+  if (!send)
+    return 0;
+
+  if (msg.msg_name) {
+    userptr<struct sockaddr> name((struct sockaddr*)msg.msg_name);
+    if (sockaddr_from_user(&k->addr, name, msg.msg_namelen) < 0)
+      return -1;
+    k->addrlen = msg.msg_namelen;
+  }
+
+  char ctl[CMSG_SPACE(SCM_MAX_FD * sizeof(int))];
+  if (msg.msg_controllen > sizeof(ctl))
+    return -1;
+  if (msg.msg_controllen &&
+      !userptr<void>(msg.msg_control).load_bytes(ctl, msg.msg_controllen))
+    return -1;
+  msg.msg_control = ctl;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_len < CMSG_LEN(0) ||
+        (char*)c + c->cmsg_len > ctl + msg.msg_controllen ||
+        c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+      goto bad;
+    int *fds = (int*)CMSG_DATA(c);
+    size_t nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (k->nfiles + nfds > SCM_MAX_FD)
+      goto bad;
+    for (size_t i = 0; i < nfds; i++) {
+      sref<file> f = getfile(fds[i]);
+      if (!f || f->holds_files())
+        goto bad;
+      k->files[k->nfiles++] = f.transfer_to_ptr();
+    }
+  }
+  return 0;
+
+ bad:
+  k->drop_files();
+  return -1;
+}
+
+// Install the files k received as new file descriptors and copy out
+// its source address, control data, and flags to *umsg.  Files that
+// don't fit in the control buffer are dropped and set MSG_CTRUNC.
+static int
+msghdr_to_user(userptr<struct msghdr> umsg, kmsghdr *k)
+{
+  struct msghdr msg;
+  if (!umsg.load(&msg))
+    return -1;
+
+  if (msg.msg_name) {
+    size_t n = std::min((size_t)msg.msg_namelen, k->addrlen);
+    if (!userptr<void>(msg.msg_name).store_bytes(&k->addr, n))
+      return -1;
+    msg.msg_namelen = k->addrlen;
+  }
+
+  int flags = k->flags;
+  size_t ctllen = 0;
+  if (k->nfiles) {
+    int nfit = 0;
+    if (msg.msg_controllen >= CMSG_LEN(sizeof(int)))
+      nfit = std::min((size_t)k->nfiles,
+                      (msg.msg_controllen - CMSG_LEN(0)) / sizeof(int));
+    if (nfit < k->nfiles)
+      flags |= MSG_CTRUNC;
+
+    char ctl[CMSG_SPACE(SCM_MAX_FD * sizeof(int))];
+    struct cmsghdr *c = (struct cmsghdr*)ctl;
+    int *fds = (int*)CMSG_DATA(c);
+    int ninstalled = 0;
+    for (int i = 0; i < k->nfiles; i++) {
+      file *f = k->files[i];
+      k->files[i] = nullptr;
+      if (i >= nfit) {
+        f->dec();
+        continue;
+      }
+      int fd = fdalloc(sref<file>::transfer(f), 0);
+      if (fd < 0) {
+        flags |= MSG_CTRUNC;
+        continue;
+      }
+      fds[ninstalled++] = fd;
+    }
+    k->nfiles = 0;
+
+    if (ninstalled) {
+      c->cmsg_len = CMSG_LEN(ninstalled * sizeof(int));
+      c->cmsg_level = SOL_SOCKET;
+      c->cmsg_type = SCM_RIGHTS;
+      ctllen = std::min(msg.msg_controllen,
+                        (size_t)CMSG_SPACE(ninstalled * sizeof(int)));
+      if (!userptr<void>(msg.msg_control).store_bytes(ctl, c->cmsg_len)) {
+        for (int i = 0; i < ninstalled; i++)
+          myproc()->ftable->close(fds[i]);
+        return -1;
+      }
+    }
+  }
+  msg.msg_controllen = ctllen;
+  msg.msg_flags = flags;
+  return umsg.store(&msg) ? 0 : -1;
+}
+
+// Send (or receive) the n messages described by umsgs on sockfd and
+// store each one's length in lens.  Returns the number of messages
+// sent (or received), or -1 if there was an error before the first.
+static int
+sockmsgs(int sockfd, userptr<struct msghdr> *umsgs, int n, int flags,
+         bool send, size_t *lens)
+{
+  sref<file> f = getfile(sockfd);
+  if (!f)
+    return -1;
+  if (n <= 0)
+    return n == 0 ? 0 : -1;
+
+  kmsghdr *ks = (kmsghdr*)kmalloc(n * sizeof(*ks), "kmsghdr");
+  if (!ks)
+    return -1;
+  for (int i = 0; i < n; i++)
+    new (&ks[i]) kmsghdr();
+  auto cleanup = scoped_cleanup([ks, n](){
+      // Drop the files of any messages that weren't sent or that
+      // we couldn't deliver.
+      for (int i = 0; i < n; i++)
+        ks[i].drop_files();
+      kmfree(ks, n * sizeof(*ks));
+    });
+
+  for (int i = 0; i < n; i++) {
+    if (msghdr_from_user(&ks[i], umsgs[i], send) < 0) {
+      if (i == 0)
+        return -1;
+      n = i;
+      break;
+    }
+  }
+
+  int r = send ? f->sendmsgs(ks, n, flags) : f->recvmsgs(ks, n, flags);
+  for (int i = 0; i < r; i++) {
+    if (!send && msghdr_to_user(umsgs[i], &ks[i]) < 0)
+      return i ? i : -1;
+    lens[i] = ks[i].len;
+  }
+  return r;
+}
+
+//SYSCALL
+ssize_t
+sys_sendmsg(int sockfd, const userptr<struct msghdr> msg, int flags)
+{
+  size_t len;
+  userptr<struct msghdr> umsg(msg);
+  int r = sockmsgs(sockfd, &umsg, 1, flags, true, &len);
+  return r < 1 ? -1 : len;
+}
+
+//SYSCALL
+ssize_t
+sys_recvmsg(int sockfd, userptr<struct msghdr> msg, int flags)
+{
+  size_t len;
+  int r = sockmsgs(sockfd, &msg, 1, flags, false, &len);
+  return r < 1 ? -1 : len;
+}
+
+// Send or receive up to MMSG_MAX of the vlen messages in msgvec and
+// store their lengths in msgvec.
+static int
+sockmmsgs(int sockfd, userptr<struct mmsghdr> msgvec, unsigned int vlen,
+          int flags, bool send)
+{
+  userptr<struct msghdr> umsgs[MMSG_MAX];
+  size_t lens[MMSG_MAX];
+  int n = std::min(vlen, (unsigned int)MMSG_MAX);
+  for (int i = 0; i < n; i++)
+    umsgs[i] = userptr<struct msghdr>(&(msgvec + i).unsafe_get()->msg_hdr);
+  int r = sockmsgs(sockfd, umsgs, n, flags, send, lens);
+  for (int i = 0; i < r; i++) {
+    unsigned int len = lens[i];
+    userptr<unsigned int> ulen(&(msgvec + i).unsafe_get()->msg_len);
+    if (!ulen.store(&len))
+      return i ? i : -1;
+  }
+  return r;
+}
+
+//SYSCALL
+int
+sys_sendmmsg(int sockfd, userptr<struct mmsghdr> msgvec, unsigned int vlen,
+             int flags)
+{
+  return sockmmsgs(sockfd, msgvec, vlen, flags, true);
+}
+
+//SYSCALL
+int
+sys_recvmmsg(int sockfd, userptr<struct mmsghdr> msgvec, unsigned int vlen,
+             int flags)
+{
+  return sockmmsgs(sockfd, msgvec, vlen, flags, false);
+}
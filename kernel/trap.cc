@@ -21,8 +21,6 @@ extern "C" void __uaccess_end(void);
 
 struct intdesc idt[256] __attribute__((aligned(16)));
 
-static char fpu_initial_state[FXSAVE_BYTES];
-
 // boot.S
 extern u64 trapentry[];
 
@@ -35,23 +33,47 @@ static struct irq_info
 
 static void trap(struct trapframe *tf);
 
+// The uncommon ways out of a system call: yielding, dying, or
+// returning somewhere SYSRET can't take us.  Kept out of line so the
+// common path through sysentry_c stays short.
+static void __attribute__((noinline))
+sysexit_slow(proc *p)
+{
+  // SYSRET to a non-canonical rip faults in ring 0 on the user's
+  // stack.  The only way to get one is a syscall instruction at the
+  // very top of user space or an exec of a bogus entry point, so
+  // kill the process rather than fault or fall back on iret.
+  if (p->tf->rip >= USERTOP) {
+    uerr.println("pid ", p->pid, ' ', p->name,
+                 ": sysret to ", shex(p->tf->rip), "--kill proc");
+    p->killed = 1;
+  }
+
+  // Give up the CPU if a higher-priority proc became runnable here.
+  if (p->yield_)
+    yield();
+
+  if (p->killed) {
+    mtstart(trap, p);
+    exit(-1);
+  }
+}
+
 u64
 sysentry_c(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 num)
 {
-  if(myproc()->killed) {
-    mtstart(trap, myproc());
+  // p->tf already points at the top of the kernel stack, where
+  // sysentry saved the user's registers.
+  proc *p = myproc();
+  if (p->killed) {
+    mtstart(trap, p);
     exit(-1);
   }
 
-  trapframe *tf = (trapframe*) (myproc()->kstack + KSTACKSIZE - sizeof(*tf));
-  myproc()->tf = tf;
   u64 r = syscall(a0, a1, a2, a3, a4, a5, num);
 
-  if(myproc()->killed) {
-    mtstart(trap, myproc());
-    exit(-1);
-  }
-
+  if (p->killed || p->yield_ || p->tf->rip >= USERTOP)
+    sysexit_slow(p);
   return r;
 }
 
@@ -194,6 +216,7 @@ trap(struct trapframe *tf)
     if (mycpu()->id == 0)
       timerintr();
     refcache::mycache->tick();
+    sched_tick();
     lapiceoi();
     if (mycpu()->no_sched_count) {
       kstats::inc(&kstats::sched_blocked_tick_count);
@@ -250,35 +273,20 @@ trap(struct trapframe *tf)
     on_ipicall();
     break;
   }
-  case T_DEVICE: {
-    // Clear "task switched" flag to enable floating-point
-    // instructions.  sched will set this again when it switches
-    // tasks.
-    clts();
-    // Save current FPU state
-    // XXX(Austin) This process could exit and free its fpu_state, but
-    // scoped_gc_epoch breaks if I use it here.
-    // XXX(Austin) Do I need to FWAIT first?
-    struct proc *fpu_owner = mycpu()->fpu_owner;
-    if (fpu_owner) {
-      assert(fpu_owner->fpu_state);
-      fxsave(fpu_owner->fpu_state);
-    }
-    // Lazily allocate myproc's FPU state
-    if (!myproc()->fpu_state) {
-      myproc()->fpu_state = kmalloc(FXSAVE_BYTES, "(fxsave)");
-      if (!myproc()->fpu_state) {
-        console.println("out of memory allocating fxsave region");
-        myproc()->killed = 1;
-        break;
-      }
-      memmove(myproc()->fpu_state, &fpu_initial_state, FXSAVE_BYTES);
+  case T_RESCHED:
+    // addrun queued a proc for us.  Reschedule on the way out, or
+    // when no_sched_count is released if we're in a critical section.
+    lapiceoi();
+    if (mycpu()->no_sched_count) {
+      mycpu()->no_sched_count |= NO_SCHED_COUNT_YIELD_REQUESTED;
+      return;
     }
-    // Restore myproc's FPU state
-    fxrstor(myproc()->fpu_state);
-    mycpu()->fpu_owner = myproc();
+    if (myproc())
+      myproc()->yield_ = true;
+    break;
+  case T_DEVICE:
+    fpu_trap();
     break;
-  }
   default:
     if (tf->trapno >= T_IRQ0 && irq_info[tf->trapno - T_IRQ0].handlers) {
       for (auto h = irq_info[tf->trapno - T_IRQ0].handlers; h; h = h->next)
@@ -317,9 +325,11 @@ trap(struct trapframe *tf)
 
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->get_state() == RUNNING &&
-     (tf->trapno == T_IRQ0+IRQ_TIMER || myproc()->yield_)) {
-    yield();
+  if(myproc() && myproc()->get_state() == RUNNING) {
+    if (myproc()->yield_)
+      yield();
+    else if (tf->trapno == T_IRQ0+IRQ_TIMER)
+      preempt();
   }
 
   // Check if the process has been killed since we yielded
@@ -351,22 +361,6 @@ inittrap(void)
   irq_info[255 - T_IRQ0].in_use = true;
 }
 
-void
-initfpu(void)
-{
-  // Allow ourselves to use FPU instructions.  We'll clear this before
-  // we schedule anything.
-  lcr0(rcr0() & ~(CR0_TS | CR0_EM));
-  // Initialize FPU, ignoring pending FP exceptions
-  fninit();
-  // Don't generate interrupts for any SSE exceptions
-  ldmxcsr(0x1f80);
-  // Stash away the initial FPU state to use as each process' initial
-  // FPU state
-  if (myid() == 0)
-    fxsave(&fpu_initial_state);
-}
-
 void
 initmsr(void)
 {
@@ -7,33 +7,51 @@
 #include "atomic_util.hh"
 #include "proc.hh"
 #include "file.hh"
+#include "sleeplock.hh"
+#include "net.hh"
 #include <uk/socket.h>
 #include <uk/un.h>
 
 #define QUEUELEN 10   // Number of message per queue of a local socket
 #define LB 0          // Run with load balancer?
+#define SOCKBUF_PAGES 16  // Pages in flight each way on a stream socket
 
-struct msghdr {
+// A datagram in flight.  It owns its data page and holds a reference
+// to each file passed with it.
+struct sockmsg {
   u32 len;
   struct sockaddr_un uaddr;
   char *data;
-  islink<msghdr> link;
-  typedef isqueue<msghdr, &msghdr::link> list_t;
+  file *files[SCM_MAX_FD];
+  int nfiles;
+  islink<sockmsg> link;
+  typedef isqueue<sockmsg, &sockmsg::link> list_t;
 
-  msghdr() {}
-  ~msghdr() {}
+  sockmsg() : len(0), data(nullptr), nfiles(0) {}
+  ~sockmsg() {
+    if (data)
+      kfree(data);
+    for (int i = 0; i < nfiles; i++)
+      files[i]->dec();
+  }
 
-  NEW_DELETE_OPS(msghdr);
+  NEW_DELETE_OPS(sockmsg);
 };
 
 struct coresocket : public balance_pool<coresocket> {
   int len;
   struct spinlock lock;
-  msghdr::list_t messages;
+  sockmsg::list_t messages;
 
   coresocket() : balance_pool(QUEUELEN), len(0),
                  lock("coresocket", LOCKSTAT_LOCALSOCK) {}
-  ~coresocket() {}
+  ~coresocket() {
+    while (!messages.empty()) {
+      sockmsg &m = messages.front();
+      messages.pop_front();
+      delete &m;
+    }
+  }
   NEW_DELETE_OPS(coresocket);
 
   u64 balance_count() const {
@@ -57,7 +75,7 @@ struct coresocket : public balance_pool<coresocket> {
       n++;
       target->len++;
       len--;
-      msghdr& m = messages.front();
+      sockmsg& m = messages.front();
       messages.pop_front();
       target->messages.push_back(&m);
     }
@@ -133,11 +151,19 @@ struct localsock {
 #endif
   }
 
-  int write(msghdr *m) {
+  int write(sockmsg *m) {
+    return write(&m, 1) == 1 ? 0 : -1;
+  }
+
+  // Queue the n messages in ms, as many as fit at a time under one
+  // acquisition of the coresocket lock.  Returns the number queued,
+  // which is less than n only if we were killed.
+  int write(sockmsg **ms, int n) {
     bool toyield = true;
-    for (;;) {
+    int done = 0;
+    while (done < n) {
       if (myproc()->killed)
-        return -1;
+        return done;
 
       coresocket *cp;
 #if 0
@@ -167,18 +193,32 @@ struct localsock {
       scoped_acquire l(&cp->lock);
       if (cp->len < QUEUELEN) {
         // cprintf("w %d(%d): coresocket %p\n", myproc()->pid, myproc()->cpuid, cp);
-        cp->messages.push_back(m);
-        cp->len++;
-        return 0;
+        for (; done < n && cp->len < QUEUELEN; done++) {
+          cp->messages.push_back(ms[done]);
+          cp->len++;
+        }
+        toyield = true;
       }
     }
+    return done;
   }
 
-  msghdr* read() {
+  sockmsg* read() {
+    sockmsg *m;
+    if (read(&m, 1) < 1)
+      return NULL;
+    return m;
+  }
+
+  // Dequeue up to n messages into ms, waiting for the first one and
+  // then taking whatever else is queued under the same acquisition
+  // of the coresocket lock.  Returns the number dequeued, or -1 if we
+  // were killed.
+  int read(sockmsg **ms, int n) {
     bool toyield = true;
     for (;;) {
       if (myproc()->killed)
-        return NULL;
+        return -1;
 
       coresocket* cp = mycoresocket();
 
@@ -199,10 +239,13 @@ struct localsock {
       scoped_acquire l(&cp->lock);
       if (cp->len > 0) {
         // cprintf("r %d(%d): coresocket %p\n", myproc()->pid, myproc()->cpuid, cp);
-        msghdr &m = cp->messages.front();
-        cp->messages.pop_front();
-        cp->len--;
-        return &m;
+        int got = 0;
+        for (; got < n && cp->len > 0; got++) {
+          ms[got] = &cp->messages.front();
+          cp->messages.pop_front();
+          cp->len--;
+        }
+        return got;
       }
       toyield = true;   // iterate between yielding and balancing
     }
@@ -278,6 +321,10 @@ public:
 
     if (ip->type() != mnode::types::sock)
       return -1;
+    // Stream and seqpacket sockets bind a path without a localsock.
+    localsock *ls = ip->as_sock()->get_sock();
+    if (!ls)
+      return -1;
 
     char *b = kalloc("writebuf");
     if (!b)
@@ -290,21 +337,77 @@ public:
       return -1;
     }
 
-    msghdr *m = new msghdr();
+    sockmsg *m = new sockmsg();
     m->data = b;
     m->len = len;
     m->uaddr.sun_family = AF_UNIX;
     strncpy(m->uaddr.sun_path, socketpath_, UNIX_PATH_MAX);
 
-    int r = ip->as_sock()->get_sock()->write(m);
+    int r = ls->write(m);
     if (r < 0) {
-      kfree(b);
       delete m;
       return -1;
     }
     return len;
   }
 
+  bool holds_files() override { return true; }
+
+  int
+  sendmsgs(struct kmsghdr *msgs, int n, int flags) override
+  {
+    int i = 0;
+    while (i < n) {
+      // Look up each destination once for the whole run of messages
+      // to it, and queue the run together.
+      auto uaddr = check_sockaddr((struct sockaddr*)&msgs[i].addr,
+                                  msgs[i].addrlen);
+      if (!uaddr)
+        break;
+      sref<mnode> ip = namei(myproc()->cwd_m, uaddr->sun_path);
+      if (!ip || ip->type() != mnode::types::sock)
+        break;
+      localsock *ls = ip->as_sock()->get_sock();
+      if (!ls)
+        break;
+
+      sockmsg *batch[MMSG_MAX];
+      int nb = 0;
+      for (; i + nb < n && nb < MMSG_MAX; nb++) {
+        kmsghdr *k = &msgs[i + nb];
+        if (nb && (k->addrlen != msgs[i].addrlen ||
+                   memcmp(&k->addr, &msgs[i].addr, k->addrlen)))
+          break;
+        sockmsg *m = new sockmsg();
+        m->data = kalloc("writebuf");
+        ssize_t len = m->data ? k->gather(m->data, PGSIZE) : -1;
+        if (len < 0) {
+          delete m;
+          break;
+        }
+        m->len = k->len = len;
+        m->uaddr.sun_family = AF_UNIX;
+        strncpy(m->uaddr.sun_path, socketpath_, UNIX_PATH_MAX);
+        memmove(m->files, k->files, k->nfiles * sizeof(k->files[0]));
+        m->nfiles = k->nfiles;
+        batch[nb] = m;
+      }
+
+      int queued = nb ? ls->write(batch, nb) : 0;
+      // The queued messages own the files now.
+      for (int j = 0; j < queued; j++)
+        msgs[i + j].nfiles = 0;
+      for (int j = queued; j < nb; j++) {
+        batch[j]->nfiles = 0;
+        delete batch[j];
+      }
+      i += queued;
+      if (nb == 0 || queued < nb)
+        break;
+    }
+    return i ? i : -1;
+  }
+
   ssize_t
   recvfrom(userptr<void> buf, size_t len, int flags,
            struct sockaddr_storage *src_addr, size_t *addrlen) override
@@ -314,7 +417,9 @@ public:
 
     ssize_t r = -1;
 
-    msghdr *m = localsock_->read();
+    sockmsg *m = localsock_->read();
+    if (!m)
+      return -1;
     if (src_addr) {
       *(struct sockaddr_un*)src_addr = m->uaddr;
       *addrlen = sizeof(m->uaddr);
@@ -328,11 +433,43 @@ public:
     r = m->len;
 
   done:
-    kfree(m->data);
     delete m;
     return r;
   }
 
+  int
+  recvmsgs(struct kmsghdr *msgs, int n, int flags) override
+  {
+    sockmsg *ms[MMSG_MAX];
+    int got = localsock_->read(ms, std::min(n, MMSG_MAX));
+    if (got < 0)
+      return -1;
+
+    // Messages are gone from the queue once we've dequeued them, so a
+    // bad buffer loses it and everything after it.
+    int r = got;
+    for (int j = 0; j < got; j++) {
+      kmsghdr *k = &msgs[j];
+      sockmsg *m = ms[j];
+      ssize_t len = j < r ? k->scatter(m->data, m->len) : -1;
+      if (len < 0) {
+        if (j < r)
+          r = j ? j : -1;
+        delete m;
+        continue;
+      }
+      k->len = len;
+      k->flags = (size_t)len < m->len ? MSG_TRUNC : 0;
+      memmove(&k->addr, &m->uaddr, sizeof(m->uaddr));
+      k->addrlen = sizeof(m->uaddr);
+      memmove(k->files, m->files, m->nfiles * sizeof(m->files[0]));
+      k->nfiles = m->nfiles;
+      m->nfiles = 0;
+      delete m;
+    }
+    return r;
+  }
+
   void
   onzero() override
   {
@@ -340,6 +477,642 @@ public:
   }
 };
 
+// A page of data in flight on a stream socket.  The sender fills a
+// fresh page and hands the page itself to the receiver, which copies
+// out of it and frees it.  Files passed with SCM_RIGHTS ride on the
+// first segment of the send they came with.
+struct sockseg {
+  char *page;
+  u32 len;                      // bytes in page
+  u32 off;                      // bytes already received
+  file *files[SCM_MAX_FD];
+  int nfiles;
+  islink<sockseg> link;
+  typedef isqueue<sockseg, &sockseg::link> list_t;
+
+  sockseg(char *p, u32 l) : page(p), len(l), off(0), nfiles(0) {}
+  ~sockseg() {
+    kfree(page);
+    for (int i = 0; i < nfiles; i++)
+      files[i]->dec();
+  }
+  NEW_DELETE_OPS(sockseg);
+};
+
+// One direction of a connected stream socket.  Senders only append
+// and receivers, which serialize on rdlock, only take from the front,
+// so a receiver can copy out of the front segment without holding
+// lock, which it can't do while it faults on a user buffer.
+struct sockbuf {
+  struct spinlock lock;
+  struct condvar cv;
+  sleeplock rdlock;
+  sockseg::list_t segs;
+  u32 nsegs;
+  // Senders wait when the queue is full and receivers when it's
+  // empty, so only one side ever waits at a time.
+  int nwaiting;
+  bool rdopen;                  // the receiving end is open
+  bool wropen;                  // the sending end is open
+
+  sockbuf()
+    : lock("sockbuf", LOCKSTAT_LOCALSOCK), cv("sockbuf"), nsegs(0),
+      nwaiting(0), rdopen(true), wropen(true) {}
+  ~sockbuf() {
+    while (!segs.empty()) {
+      sockseg &s = segs.front();
+      segs.pop_front();
+      delete &s;
+    }
+  }
+
+  // Queue s, waiting for room.  Returns false if the receiving end is
+  // closed or we were killed, in which case the caller still owns s.
+  bool send(sockseg *s) {
+    scoped_acquire l(&lock);
+    while (rdopen && nsegs >= SOCKBUF_PAGES) {
+      if (myproc()->killed)
+        return false;
+      nwaiting++;
+      cv.sleep(&lock);
+      nwaiting--;
+    }
+    if (!rdopen)
+      return false;
+    segs.push_back(s);
+    if (nsegs++ == 0 && nwaiting)
+      cv.wake_all();
+    return true;
+  }
+
+  // Receive up to n bytes, copying them out with store(at, src, len).
+  // If packet, receive exactly one record and drop whatever part of
+  // it doesn't fit.  If fm isn't null, it takes the files of the
+  // first segment, and the receive stops short of any later segment
+  // with files, so files arrive with the data they were sent with.
+  // Otherwise, files are dropped along with their segment.  Returns
+  // the number of bytes received, 0 at the end of the stream, or -1
+  // on error.
+  template<class F>
+  ssize_t recv(size_t n, bool packet, F store, kmsghdr *fm = nullptr) {
+    auto rl = rdlock.guard();
+    sockseg *s;
+    {
+      scoped_acquire l(&lock);
+      while (segs.empty()) {
+        if (!wropen)
+          return 0;
+        if (myproc()->killed)
+          return -1;
+        nwaiting++;
+        cv.sleep(&lock);
+        nwaiting--;
+      }
+      s = &segs.front();
+    }
+
+    size_t done = 0;
+    for (;;) {
+      if (s->nfiles && fm) {
+        if (done)
+          break;
+        memmove(fm->files, s->files, s->nfiles * sizeof(s->files[0]));
+        fm->nfiles = s->nfiles;
+        s->nfiles = 0;
+      }
+      size_t m = s->len - s->off;
+      if (m > n - done)
+        m = n - done;
+      if (!store(done, s->page + s->off, m))
+        return done ? done : -1;
+      done += m;
+      s->off += m;
+
+      bool consumed = packet || s->off == s->len;
+      sockseg *next = nullptr;
+      {
+        scoped_acquire l(&lock);
+        if (consumed) {
+          segs.pop_front();
+          if (nsegs-- == SOCKBUF_PAGES && nwaiting)
+            cv.wake_all();
+        }
+        if (!packet && done < n && !segs.empty())
+          next = &segs.front();
+      }
+      if (consumed)
+        delete s;
+      if (!next)
+        break;
+      s = next;
+    }
+    return done;
+  }
+
+  // Close the receiving (or sending) end.
+  void shutdown(bool rd) {
+    scoped_acquire l(&lock);
+    if (rd)
+      rdopen = false;
+    else
+      wropen = false;
+    cv.wake_all();
+  }
+};
+
+// The state two connected stream sockets share.  Side 0 receives on
+// dir[0] and sends on dir[1], and side 1 the other way around.
+struct unix_conn : public ::referenced {
+  sockbuf dir[2];
+
+  // One reference for each side.
+  unix_conn() : ::referenced(2) {}
+  NEW_DELETE_OPS(unix_conn);
+};
+
+struct unix_listener;
+
+// A SOCK_STREAM or SOCK_SEQPACKET UNIX socket.  It starts out
+// unconnected, and then either connects, listens, or is handed out
+// by accept already connected.
+struct file_unix_stream : public refcache::referenced, public file
+{
+  const bool packet_;
+  // Protects the state changes below.
+  struct spinlock lock_;
+  // Set once we're connected, along with side_.
+  std::atomic<unix_conn*> conn_;
+  int side_;
+  // Set once we're listening.  We hold a reference to it.
+  unix_listener *listener_;
+  // The socket inode we're bound to, if any.
+  sref<mnode> bound_;
+  // Set while a bind is creating bound_.
+  bool binding_;
+  // Link for the accept queue while we wait to be accepted.
+  islink<file_unix_stream> accept_link_;
+  typedef isqueue<file_unix_stream,
+                  &file_unix_stream::accept_link_> list_t;
+
+  file_unix_stream(bool packet, unix_conn *conn = nullptr, int side = 0)
+    : packet_(packet), lock_("file_unix_stream", LOCKSTAT_LOCALSOCK),
+      conn_(conn), side_(side), listener_(nullptr), binding_(false) {}
+  NEW_DELETE_OPS(file_unix_stream);
+
+  void inc() override { referenced::inc(); }
+  void dec() override { referenced::dec(); }
+
+  int bind(const struct sockaddr *addr, size_t addrlen) override;
+  int listen(int backlog) override;
+  int accept(struct sockaddr_storage *addr, size_t *addrlen,
+             file **out) override;
+  int connect(const struct sockaddr *addr, size_t addrlen) override;
+
+  ssize_t
+  write(const char *buf, size_t len) override
+  {
+    return send(len, [&](size_t at, char *dst, size_t n) {
+        memmove(dst, buf + at, n);
+        return true;
+      });
+  }
+
+  ssize_t
+  read(char *buf, size_t len) override
+  {
+    return recv(len, [&](size_t at, const char *src, size_t n) {
+        memmove(buf + at, src, n);
+        return true;
+      });
+  }
+
+  ssize_t
+  sendto(userptr<void> buf, size_t len, int flags,
+         const struct sockaddr *dest_addr, size_t addrlen) override
+  {
+    return send(len, [&](size_t at, char *dst, size_t n) {
+        userptr<void> src((char*)buf.unsafe_get() + at);
+        return src.load_bytes(dst, n);
+      });
+  }
+
+  ssize_t
+  recvfrom(userptr<void> buf, size_t len, int flags,
+           struct sockaddr_storage *src_addr, size_t *addrlen) override
+  {
+    if (src_addr)
+      *addrlen = unnamed(src_addr);
+    return recv(len, [&](size_t at, const char *src, size_t n) {
+        userptr<void> dst((char*)buf.unsafe_get() + at);
+        return dst.store_bytes(src, n);
+      });
+  }
+
+  bool holds_files() override { return true; }
+
+  int
+  sendmsgs(struct kmsghdr *msgs, int n, int flags) override
+  {
+    int i;
+    for (i = 0; i < n; i++) {
+      kmsghdr *k = &msgs[i];
+      size_t total = k->total();
+      // We're connected, so there's no destination, and files need
+      // at least a byte to ride on.
+      if (k->addrlen || (k->nfiles && total == 0))
+        break;
+      ssize_t r = send(total, [k](size_t at, char *dst, size_t n) {
+          return k->gather(dst, n, at) == (ssize_t)n;
+        }, k);
+      if (r < 0)
+        break;
+      k->len = r;
+      if ((size_t)r < total)
+        return i + 1;
+    }
+    return i ? i : -1;
+  }
+
+  int
+  recvmsgs(struct kmsghdr *msgs, int n, int flags) override
+  {
+    if (n == 0)
+      return 0;
+    // There are no message boundaries to batch on, so this fills only
+    // the first message.
+    kmsghdr *k = &msgs[0];
+    k->nfiles = 0;
+    ssize_t r = recv(k->total(), [k](size_t at, const char *src, size_t n) {
+        return k->scatter(src, n, at) == (ssize_t)n;
+      }, k);
+    if (r < 0)
+      return -1;
+    k->len = r;
+    k->addrlen = 0;
+    k->flags = 0;
+    return 1;
+  }
+
+  void onzero() override;
+
+private:
+  // Send len bytes, filling each page with load(at, dst, n).  If fm
+  // isn't null, its files go with the first page, and it gives up its
+  // references once that page is queued.
+  template<class F>
+  ssize_t
+  send(size_t len, F load, kmsghdr *fm = nullptr)
+  {
+    unix_conn *c = conn_;
+    if (!c)
+      return -1;
+    if (packet_ && len > PGSIZE)
+      return -1;
+    if (!packet_ && len == 0)
+      return 0;
+
+    sockbuf *sb = &c->dir[!side_];
+    size_t done = 0;
+    do {
+      size_t n = len - done;
+      if (n > PGSIZE)
+        n = PGSIZE;
+      char *p = kalloc("sockseg");
+      if (!p)
+        break;
+      if (!load(done, p, n)) {
+        kfree(p);
+        break;
+      }
+      sockseg *s = new sockseg(p, n);
+      bool withfiles = fm && fm->nfiles && done == 0;
+      if (withfiles) {
+        memmove(s->files, fm->files, fm->nfiles * sizeof(fm->files[0]));
+        s->nfiles = fm->nfiles;
+      }
+      if (!sb->send(s)) {
+        if (withfiles)
+          s->nfiles = 0;
+        delete s;
+        break;
+      }
+      if (withfiles)
+        fm->nfiles = 0;
+      done += n;
+    } while (done < len);
+    if (done == 0 && len != 0)
+      return -1;
+    return done;
+  }
+
+  template<class F>
+  ssize_t
+  recv(size_t len, F store, kmsghdr *fm = nullptr)
+  {
+    unix_conn *c = conn_;
+    if (!c)
+      return -1;
+    return c->dir[side_].recv(len, packet_, store, fm);
+  }
+
+  // Fill in the address of an unbound peer and return its length.
+  static size_t
+  unnamed(struct sockaddr_storage *addr)
+  {
+    auto sun = reinterpret_cast<struct sockaddr_un*>(addr);
+    sun->sun_family = AF_UNIX;
+    sun->sun_path[0] = 0;
+    return offsetof(struct sockaddr_un, sun_path);
+  }
+};
+
+// A core's share of a listener's accept queue.
+struct coreaccept : public balance_pool<coreaccept> {
+  struct spinlock lock;
+  file_unix_stream::list_t pending;
+  // Modified under lock, but read without it by the listener, which
+  // pairs the increment in enqueue with its check of waiting_.
+  std::atomic<u64> len;
+  __padout__;
+
+  coreaccept(u64 max)
+    : balance_pool(max), lock("coreaccept", LOCKSTAT_LOCALSOCK), len(0) {}
+  NEW_DELETE_OPS(coreaccept);
+
+  u64 balance_count() const {
+    return len;
+  }
+
+  void balance_move_to(coreaccept* target) {
+    assert(this != target);
+    if (!lock.try_acquire())
+      return;
+    if (!target->lock.try_acquire()) {
+      lock.release();
+      return;
+    }
+
+    while (target->len < len) {
+      file_unix_stream &f = pending.front();
+      pending.pop_front();
+      len--;
+      target->pending.push_back(&f);
+      target->len++;
+    }
+
+    lock.release();
+    target->lock.release();
+  }
+
+  file_unix_stream* take() {
+    scoped_acquire l(&lock);
+    if (!len)
+      return nullptr;
+    file_unix_stream *f = &pending.front();
+    pending.pop_front();
+    len--;
+    return f;
+  }
+};
+
+// A listening stream socket.  Each core has its own accept queue:
+// connect queues the new connection on its own core, and accept
+// takes from its own core's queue first, so a server with an
+// accepting thread on each core handles connections on the core they
+// came in on.  An accepter whose queue is empty balances with the
+// other cores' queues, the way unordered datagram sockets do.
+struct unix_listener : public sock_listener {
+  const bool packet_;
+  // Per-core queue limit.
+  const u64 backlog_;
+  coreaccept *queues_[NCPU];
+  balancer<unix_listener, coreaccept> b_;
+
+  // The socket inode we listen on.
+  const sref<mnode> ip_;
+
+  struct spinlock lock_;
+  struct condvar cv_;
+  // Whether an accepter is waiting.  Set under lock_.
+  std::atomic<bool> waiting_;
+  std::atomic<bool> closed_;
+
+  unix_listener(bool packet, u64 backlog, sref<mnode> ip)
+    : packet_(packet), backlog_(backlog), b_(this), ip_(ip),
+      lock_("unix_listener", LOCKSTAT_LOCALSOCK), cv_("unix_listener"),
+      waiting_(false), closed_(false) {
+    for (int i = 0; i < NCPU; i++)
+      queues_[i] = i < ncpu ? new coreaccept(backlog) : nullptr;
+  }
+
+  ~unix_listener() {
+    drain();
+    for (int i = 0; i < NCPU; i++)
+      delete queues_[i];
+  }
+  NEW_DELETE_OPS(unix_listener);
+
+  coreaccept* balance_get(int id) const {
+    return queues_[id];
+  }
+
+  // Queue f to be accepted.  Returns false if we're closed or this
+  // core's queue is full.
+  bool enqueue(file_unix_stream *f) {
+    coreaccept *q = queues_[myid()];
+    {
+      // close sets closed_ before drain takes each queue's lock, so
+      // either it drains f or we see closed_.
+      scoped_acquire l(&q->lock);
+      if (closed_ || q->len >= backlog_)
+        return false;
+      q->pending.push_back(f);
+      q->len++;
+    }
+    if (waiting_) {
+      scoped_acquire l(&lock_);
+      waiting_ = false;
+      cv_.wake_all();
+    }
+    return true;
+  }
+
+  bool any_pending() {
+    for (int i = 0; i < ncpu; i++)
+      if (queues_[i]->len)
+        return true;
+    return false;
+  }
+
+  // Take the next connection, waiting for one if there are none.
+  // Returns null if we're closed or killed.
+  file_unix_stream* dequeue() {
+    for (;;) {
+      if (closed_)
+        return nullptr;
+      coreaccept *q = queues_[myid()];
+      if (!q->len)
+        b_.balance();
+      file_unix_stream *f = q->take();
+      for (int i = 0; !f && i < ncpu; i++)
+        if (queues_[i]->len)
+          f = queues_[i]->take();
+      if (f)
+        return f;
+
+      scoped_acquire l(&lock_);
+      while (!closed_ && !any_pending()) {
+        if (myproc()->killed)
+          return nullptr;
+        waiting_ = true;
+        if (any_pending())
+          break;
+        cv_.sleep(&lock_);
+      }
+    }
+  }
+
+  // Refuse any connections still waiting to be accepted.
+  void drain() {
+    for (int i = 0; i < ncpu; i++) {
+      while (file_unix_stream *f = queues_[i]->take())
+        f->dec();
+    }
+  }
+
+  // Stop accepting, and take ourselves off the socket inode so the
+  // path can be listened on again.
+  void close() {
+    {
+      scoped_acquire l(&lock_);
+      closed_ = true;
+      cv_.wake_all();
+    }
+    drain();
+    ip_->as_sock()->clear_listener(this);
+  }
+};
+
+int
+file_unix_stream::bind(const struct sockaddr *addr, size_t addrlen)
+{
+  auto uaddr = file_unix_dgram::check_sockaddr(addr, addrlen);
+  if (!uaddr)
+    return -1;
+
+  // Check our state before creating the socket inode, so a bind we'd
+  // refuse doesn't leave one behind.  create may sleep, so claim the
+  // bind with binding_ instead of holding lock_.
+  {
+    scoped_acquire l(&lock_);
+    if (bound_ || binding_ || conn_)
+      return -1;
+    binding_ = true;
+  }
+
+  sref<mnode> ip = create(myproc()->cwd_m, uaddr->sun_path,
+                          T_SOCKET, 0, 0, true);
+
+  scoped_acquire l(&lock_);
+  binding_ = false;
+  if (!ip)
+    return -1;
+  bound_ = ip;
+  return 0;
+}
+
+int
+file_unix_stream::listen(int backlog)
+{
+  if (backlog < 1)
+    backlog = 1;
+  // backlog is for the whole socket, but each core has its own
+  // queue, so split it up.
+  u64 percore = (backlog + ncpu - 1) / ncpu;
+  if (percore < QUEUELEN)
+    percore = QUEUELEN;
+
+  scoped_acquire l(&lock_);
+  if (!bound_ || conn_)
+    return -1;
+  if (listener_)
+    return 0;
+  unix_listener *lst = new unix_listener(packet_, percore, bound_);
+  if (!bound_->as_sock()->init_listener(lst)) {
+    lst->dec();
+    return -1;
+  }
+  listener_ = lst;
+  return 0;
+}
+
+int
+file_unix_stream::accept(struct sockaddr_storage *addr, size_t *addrlen,
+                         file **out)
+{
+  unix_listener *lst;
+  {
+    scoped_acquire l(&lock_);
+    lst = listener_;
+  }
+  if (!lst)
+    return -1;
+  file_unix_stream *f = lst->dequeue();
+  if (!f)
+    return -1;
+  *addrlen = unnamed(addr);
+  *out = f;
+  return 0;
+}
+
+int
+file_unix_stream::connect(const struct sockaddr *addr, size_t addrlen)
+{
+  auto uaddr = file_unix_dgram::check_sockaddr(addr, addrlen);
+  if (!uaddr)
+    return -1;
+
+  sref<mnode> ip = namei(myproc()->cwd_m, uaddr->sun_path);
+  if (!ip || ip->type() != mnode::types::sock)
+    return -1;
+  sref<sock_listener> sl = ip->as_sock()->get_listener();
+  if (!sl)
+    return -1;
+  unix_listener *lst = static_cast<unix_listener*>(sl.get());
+  if (lst->packet_ != packet_)
+    return -1;
+
+  unix_conn *c = new unix_conn();
+  file_unix_stream *peer = new file_unix_stream(packet_, c, 1);
+
+  scoped_acquire l(&lock_);
+  if (conn_ || listener_ || !lst->enqueue(peer)) {
+    l.release();
+    // peer holds one of c's references, and we hold the other.
+    peer->dec();
+    c->dec();
+    return -1;
+  }
+  side_ = 0;
+  conn_ = c;
+  return 0;
+}
+
+void
+file_unix_stream::onzero()
+{
+  if (unix_conn *c = conn_) {
+    c->dir[side_].shutdown(true);
+    c->dir[!side_].shutdown(false);
+    c->dec();
+  }
+  if (listener_) {
+    listener_->close();
+    listener_->dec();
+  }
+  delete this;
+}
+
 int
 unixsocket(int domain, int type, int protocol, file **out)
 {
@@ -347,6 +1120,10 @@ unixsocket(int domain, int type, int protocol, file **out)
     *out = new file_unix_dgram{true};
   else if (type == SOCK_DGRAM_UNORDERED)
     *out = new file_unix_dgram{false};
+  else if (type == SOCK_STREAM)
+    *out = new file_unix_stream{false};
+  else if (type == SOCK_SEQPACKET)
+    *out = new file_unix_stream{true};
   else
     return -1;
   return 0;
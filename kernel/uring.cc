@@ -0,0 +1,384 @@
+// Submission and completion rings for batched, asynchronous system
+// calls.  See <uk/uring.h> for what user space sees.
+//
+// A uring is an anonymous shared file holding the ring header and
+// the SQE and CQE arrays.  The kernel pins its pages and works on
+// them through their direct-map addresses, so it can service the
+// rings from any context.  Operations run by calling the system call
+// implementations directly, either from uring_enter in the caller's
+// context or from a dwork on the caller's CPU, which borrows the
+// caller's address space and file table while it runs them.
+//
+// The dwork workers are shared with reclaim, readahead, and the rest
+// of the kernel, so an async batch must never sleep for an unbounded
+// time.  It runs only the operations that can't wait on another
+// process (regular-file I/O, opens, closes, and stats), and fails the
+// rest.  It also stops as soon as the submitter is killed or exits,
+// leaving any remaining SQEs queued.
+
+#include "types.h"
+#include "kernel.hh"
+#include "mmu.h"
+#include "spinlock.hh"
+#include "condvar.hh"
+#include "proc.hh"
+#include "cpu.hh"
+#include "file.hh"
+#include "filetable.hh"
+#include "mfs.hh"
+#include "sleeplock.hh"
+#include "work.hh"
+#include "vm.hh"
+#include <uk/fcntl.h>
+#include <uk/stat.h>
+#include <uk/socket.h>
+#include <uk/uring.h>
+#include <algorithm>
+#include <vector>
+
+// The system calls that SQEs run.  File I/O goes straight to the
+// file, so that we only look up its fd once.
+ssize_t file_read(file *f, userptr<void> p, size_t n);
+ssize_t file_write(file *f, const userptr<void> p, size_t n);
+ssize_t file_pread(file *f, void *ubuf, size_t count, off_t offset);
+ssize_t file_pwrite(file *f, const void *ubuf, size_t count, off_t offset);
+int sys_openat(int dirfd, userptr_str path, int omode, ...);
+int sys_close(int fd);
+int sys_fstatx(int fd, userptr<struct stat> st, enum stat_flags flags);
+int sys_accept(int xsock, userptr<struct sockaddr> xaddr,
+               userptr<uint32_t> xaddrlen);
+ssize_t sys_sendto(int sockfd, const userptr<void> buf, size_t len, int flags,
+                   const userptr<struct sockaddr> dest_addr, uint32_t addrlen);
+ssize_t sys_recvfrom(int sockfd, userptr<void> buf, size_t len, int flags,
+                     userptr<struct sockaddr> src_addr,
+                     userptr<uint32_t> addrlen);
+
+struct uring : public refcache::referenced, public file
+{
+  uring(sref<mnode> m, u32 entries)
+    : m_(m), sq_entries_(entries), cq_entries_(2 * entries),
+      lock_("uring"), cv_("uring"), nwaiting_(0) {}
+  NEW_DELETE_OPS(uring);
+
+  void inc() override { referenced::inc(); }
+  void dec() override { referenced::dec(); }
+  void onzero() override { delete this; }
+
+  sref<mnode> get_mnode() override { return m_; }
+
+  bool init(u64 size);
+  u32 drain(u32 n, int async_pid = 0);
+  void wait(u32 min_complete);
+
+  // The number of SQEs user space has queued that we haven't taken.
+  u32 queued() {
+    uring_header *h = hdr();
+    return std::min(h->sq_tail - h->sq_head, sq_entries_);
+  }
+
+  const sref<mnode> m_;
+  const u32 sq_entries_;
+  const u32 cq_entries_;
+
+private:
+  s64 run(const uring_sqe &s, file *f);
+  bool nonblocking(const uring_sqe &s, file *f);
+  void post(u64 user_data, s64 res);
+
+  template<class T>
+  T* at(u64 off) {
+    return (T*)((char*)pages_[off / PGSIZE]->va() + off % PGSIZE);
+  }
+  uring_header* hdr() {
+    return at<uring_header>(0);
+  }
+  uring_sqe* sqe(u32 i) {
+    return at<uring_sqe>(URING_SQES_OFF +
+                         (u64)(i & (sq_entries_ - 1)) * sizeof(uring_sqe));
+  }
+  uring_cqe* cqe(u32 i) {
+    return at<uring_cqe>(URING_CQES_OFF(sq_entries_) +
+                         (u64)(i & (cq_entries_ - 1)) * sizeof(uring_cqe));
+  }
+
+  // The file's pages, pinned for as long as we exist.
+  std::vector<sref<page_info> > pages_;
+  // Serializes draining the submission ring, and so also posting
+  // completions.
+  sleeplock submit_lock_;
+  // For uring_enter waiting on completions.
+  struct spinlock lock_;
+  struct condvar cv_;
+  std::atomic<int> nwaiting_;
+};
+
+// Runs up to n_ SQEs on a work queue worker thread, as if r_'s
+// submitter had run them.
+struct uring_work : public dwork
+{
+  uring_work(uring *r, u32 n)
+    : dwork(WORK_NORMAL, true), r_(r), n_(n), pid_(myproc()->pid),
+      vmap_(myproc()->vmap), ftable_(myproc()->ftable),
+      cwd_(myproc()->cwd_m) {
+    r_->inc();
+  }
+  NEW_DELETE_OPS(uring_work);
+
+  void run() override;
+
+  uring *r_;
+  u32 n_;
+  int pid_;
+  sref<vmap> vmap_;
+  sref<filetable> ftable_;
+  sref<mnode> cwd_;
+};
+
+void
+uring_work::run()
+{
+  // Borrow the submitter's address space, file table, and working
+  // directory, so user pointers and file descriptors in the SQEs mean
+  // what they would in a system call.
+  proc *p = myproc();
+  std::swap(p->vmap, vmap_);
+  std::swap(p->ftable, ftable_);
+  std::swap(p->cwd_m, cwd_);
+  switchvm(p);
+
+  r_->drain(n_, pid_);
+
+  std::swap(p->vmap, vmap_);
+  std::swap(p->ftable, ftable_);
+  std::swap(p->cwd_m, cwd_);
+  switchvm(p);
+
+  r_->dec();
+  delete this;
+}
+
+// Pin the first size bytes of the file and set up the header.
+// Returns false if we run out of memory.
+bool
+uring::init(u64 size)
+{
+  mfile *mf = m_->as_file();
+  if (!mf->allocate(0, size))
+    return false;
+  for (u64 idx = 0; idx < size / PGSIZE; idx++) {
+    mfile::page_state ps = mf->dirty_page(idx);
+    if (!ps.is_set())
+      return false;
+    pages_.push_back(ps.get_page_info());
+  }
+
+  uring_header *h = hdr();
+  h->magic = URING_MAGIC;
+  h->sq_entries = sq_entries_;
+  h->cq_entries = cq_entries_;
+  h->sqes_off = URING_SQES_OFF;
+  h->cqes_off = URING_CQES_OFF(sq_entries_);
+  return true;
+}
+
+// Whether s reads or writes the file at s.fd.
+static bool
+file_io(const uring_sqe &s)
+{
+  return s.opcode == URING_OP_READ || s.opcode == URING_OP_WRITE ||
+    s.opcode == URING_OP_PREAD || s.opcode == URING_OP_PWRITE;
+}
+
+// Run s.  For file I/O, f is the file at s.fd, or null if there
+// isn't one.
+s64
+uring::run(const uring_sqe &s, file *f)
+{
+  if (file_io(s) && !f)
+    return -1;
+  switch (s.opcode) {
+  case URING_OP_NOP:
+    return 0;
+  case URING_OP_READ:
+    return file_read(f, userptr<void>((void*)s.addr), s.len);
+  case URING_OP_WRITE:
+    return file_write(f, userptr<void>((void*)s.addr), s.len);
+  case URING_OP_PREAD:
+    return file_pread(f, (void*)s.addr, s.len, s.off);
+  case URING_OP_PWRITE:
+    return file_pwrite(f, (const void*)s.addr, s.len, s.off);
+  case URING_OP_OPENAT:
+    return sys_openat(s.fd, userptr_str((const char*)s.addr), s.op_flags,
+                      (int)s.off);
+  case URING_OP_CLOSE:
+    return sys_close(s.fd);
+  case URING_OP_FSTAT:
+    return sys_fstatx(s.fd, userptr<struct stat>((struct stat*)s.addr),
+                      (enum stat_flags)s.op_flags);
+  case URING_OP_ACCEPT:
+    return sys_accept(s.fd,
+                      userptr<struct sockaddr>((struct sockaddr*)s.addr),
+                      userptr<uint32_t>((uint32_t*)s.addr2));
+  case URING_OP_SEND:
+    return sys_sendto(s.fd, userptr<void>((void*)s.addr), s.len, s.op_flags,
+                      userptr<struct sockaddr>(nullptr), 0);
+  case URING_OP_RECV:
+    return sys_recvfrom(s.fd, userptr<void>((void*)s.addr), s.len,
+                        s.op_flags, userptr<struct sockaddr>(nullptr),
+                        userptr<uint32_t>(nullptr));
+  default:
+    return -1;
+  }
+}
+
+// Whether s can run on a shared worker thread.  Reads and writes of
+// regular files may wait for I/O, but not for another process.  f is
+// as for run, and must be the same file run gets, since s.fd may
+// name a different file by the time we look it up again.
+bool
+uring::nonblocking(const uring_sqe &s, file *f)
+{
+  switch (s.opcode) {
+  case URING_OP_NOP:
+  case URING_OP_OPENAT:
+  case URING_OP_CLOSE:
+  case URING_OP_FSTAT:
+    return true;
+  case URING_OP_READ:
+  case URING_OP_WRITE:
+  case URING_OP_PREAD:
+  case URING_OP_PWRITE: {
+    if (!f)
+      return true;              // Fails right away
+    sref<mnode> m = f->get_mnode();
+    return m && m->type() == mnode::types::file;
+  }
+  default:
+    return false;
+  }
+}
+
+// Post a completion.  Caller must hold submit_lock_ and have checked
+// that there's room.
+void
+uring::post(u64 user_data, s64 res)
+{
+  uring_header *h = hdr();
+  u32 tail = h->cq_tail;
+  uring_cqe *c = cqe(tail);
+  c->user_data = user_data;
+  c->res = res;
+  __atomic_store_n(&h->cq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  // Pairs with the increment of nwaiting_ in wait, so either we see
+  // the waiter or it sees our completion.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (nwaiting_) {
+    scoped_acquire l(&lock_);
+    cv_.wake_all();
+  }
+}
+
+// Run up to n queued SQEs, stopping early if the completion ring
+// fills up.  Returns the number run.  If async_pid is set, we're on
+// a worker thread on behalf of that process: stop if it dies, and
+// fail any SQE that could block.
+u32
+uring::drain(u32 n, int async_pid)
+{
+  auto l = submit_lock_.guard();
+  uring_header *h = hdr();
+  u32 head = h->sq_head;
+  u32 done = 0;
+  while (done < n) {
+    if (head == __atomic_load_n(&h->sq_tail, __ATOMIC_ACQUIRE))
+      break;
+    u32 cq_used = h->cq_tail - __atomic_load_n(&h->cq_head, __ATOMIC_ACQUIRE);
+    if (cq_used >= cq_entries_)
+      break;
+    if (async_pid && !proc::alive(async_pid))
+      break;
+    // Copy the SQE out first, since user space may refill its slot as
+    // soon as sq_head moves past it.
+    uring_sqe s = *sqe(head);
+    __atomic_store_n(&h->sq_head, ++head, __ATOMIC_RELEASE);
+    sref<file> f;
+    if (file_io(s))
+      f = getfile(s.fd);
+    if (async_pid && !nonblocking(s, f.get()))
+      post(s.user_data, -1);
+    else
+      post(s.user_data, run(s, f.get()));
+    done++;
+  }
+  return done;
+}
+
+// Wait until at least min_complete CQEs are waiting to be consumed.
+void
+uring::wait(u32 min_complete)
+{
+  uring_header *h = hdr();
+  auto ready = [&]() {
+    return (u32)(h->cq_tail - h->cq_head) >= min_complete;
+  };
+  if (ready())
+    return;
+
+  scoped_acquire l(&lock_);
+  nwaiting_++;
+  while (!ready() && !myproc()->killed)
+    cv_.sleep(&lock_);
+  nwaiting_--;
+}
+
+//SYSCALL
+int
+sys_uring_setup(u32 entries, int flags)
+{
+  if ((flags & ~O_CLOEXEC) || entries == 0 ||
+      entries > URING_MAX_ENTRIES || (entries & (entries - 1)))
+    return -1;
+
+  u64 size = PGROUNDUP(URING_SIZE(entries));
+  sref<mnode> m = anon_fs->alloc(mnode::types::file).mn();
+  m->as_file()->write_size().resize(size);
+  sref<uring> r = make_sref<uring>(m, entries);
+  if (!r->init(size))
+    return -1;
+  return fdalloc(std::move(r), flags);
+}
+
+//SYSCALL
+int
+sys_uring_enter(int fd, u32 to_submit, u32 min_complete, int flags)
+{
+  sref<file> f = getfile(fd);
+  if (!f)
+    return -1;
+  file *ff = f.get();
+  if (&typeid(*ff) != &typeid(uring))
+    return -1;
+  uring *r = static_cast<uring*>(ff);
+  if ((flags & ~URING_ENTER_ASYNC) || min_complete > r->cq_entries_)
+    return -1;
+
+  u32 n;
+  if (flags & URING_ENTER_ASYNC) {
+    // Hand the batch to a worker on this core.  Several of these may
+    // be queued at once, but they drain one at a time.
+    n = std::min(to_submit, r->queued());
+    if (n) {
+      uring_work *w = new uring_work(r, n);
+      if (dwork_push(w, myid()) < 0) {
+        r->dec();
+        delete w;
+        return -1;
+      }
+    }
+  } else {
+    n = r->drain(to_submit);
+  }
+  r->wait(min_complete);
+  return n;
+}
@@ -14,6 +14,7 @@
 #include "kmtrace.hh"
 #include "kstream.hh"
 #include "page_info.hh"
+#include "pageops.hh"
 #include <algorithm>
 #include "kstats.hh"
 
@@ -37,6 +38,7 @@ void to_stream(class print_stream *s, const vmdesc &vmd)
         {"ANON", vmdesc::FLAG_ANON},
         {"WRITE", vmdesc::FLAG_WRITE},
         {"SHARED", vmdesc::FLAG_SHARED},
+        {"KERNEL", vmdesc::FLAG_KERNEL},
       }), " ");
   if (vmd.page)
     s->print((void*)vmd.page->pa(), "}");
@@ -264,6 +266,24 @@ vmap::remove(uptr start, uptr len)
 
 int
 vmap::willneed(uptr start, uptr len)
+{
+  uptr end = start + len;
+  for (;;) {
+    page_miss miss;
+    start = willneed_locked(start, end - start, &miss);
+    if (!miss)
+      return 0;
+    // Read the missing page in without vpfs_ locked and pick up
+    // where we left off.
+    miss.load();
+  }
+}
+
+// Fault in [start, start+len) with vpfs_ locked, stopping at the first
+// page that must be read in from disk and recording it in miss.
+// Returns the address of the page we stopped at.
+uptr
+vmap::willneed_locked(uptr start, uptr len, page_miss *miss)
 {
   auto begin = vpfs_.find(start / PGSIZE);
   auto end = vpfs_.find((start + len) / PGSIZE);
@@ -284,9 +304,15 @@ vmap::willneed(uptr start, uptr len)
     }
 
     page_info *page = ensure_page(it, writable ? access_type::WRITE
-                                               : access_type::READ);
-    if (!page)
+                                               : access_type::READ,
+                                  nullptr, miss);
+    if (!page) {
+      if (*miss) {
+        shootdown.perform();
+        return it.index() * PGSIZE;
+      }
       continue;
+    }
 
     if (it->flags & vmdesc::FLAG_COW || !writable)
       cache.insert(it.index() * PGSIZE, &*it, page->pa() | PTE_P | PTE_U);
@@ -295,7 +321,7 @@ vmap::willneed(uptr start, uptr len)
   }
 
   shootdown.perform();
-  return 0;
+  return start + len;
 }
 
 int
@@ -330,6 +356,8 @@ vmap::mprotect(uptr start, uptr len, uint64_t flags)
   for (auto it = begin; it < end; it += it.span()) {
     if (!it.is_set())
       return -1;                // ENOMEM
+    if (it->flags & vmdesc::FLAG_KERNEL)
+      return -1;                // EACCES
 
     auto nflags = (it->flags & ~vmdesc::FLAG_WRITE) | flags;
     if (nflags == it->flags)
@@ -406,7 +434,8 @@ vmap::pagefault(uptr va, u32 err)
   // page.
   va = PGROUNDDOWN(va);
 
-  {
+  for (;;) {
+    page_miss miss;
     auto it = vpfs_.find(va / PGSIZE);
     auto lock = vpfs_.acquire(it);
     if (!it.is_set())
@@ -431,7 +460,13 @@ vmap::pagefault(uptr va, u32 err)
 
     // Ensure we have a backing page and copy COW pages
     bool allocated;
-    page_info *page = ensure_page(it, type, &allocated);
+    page_info *page = ensure_page(it, type, &allocated, &miss);
+    if (miss) {
+      // Read the page in without vpfs_ locked and fault again.
+      lock.release();
+      miss.load();
+      continue;
+    }
     if (allocated) {
       kstats::inc(&kstats::page_fault_alloc_count);
       timer_fill.abort();
@@ -454,8 +489,8 @@ vmap::pagefault(uptr va, u32 err)
     }
 
     shootdown.perform();
+    return 1;
   }
-  return 1;
 }
 
 int
@@ -491,19 +526,27 @@ vmap::pagelookup(uptr va)
   // atomically assignable, so I could observe a half-updated vmdesc
   // if I try.  Could use a seqlock.
 
-  auto it = vpfs_.find(va / PGSIZE);
-  if (!it.is_set())
-    return nullptr;
-  auto lock = vpfs_.acquire(it);
-  if (!it.is_set())
-    return nullptr;
+  for (;;) {
+    page_miss miss;
+    auto it = vpfs_.find(va / PGSIZE);
+    if (!it.is_set())
+      return nullptr;
+    auto lock = vpfs_.acquire(it);
+    if (!it.is_set())
+      return nullptr;
 
-  page_info* pi = ensure_page(it, access_type::READ);
-  if (!pi)
-    return nullptr;
+    page_info* pi = ensure_page(it, access_type::READ, nullptr, &miss);
+    if (miss) {
+      lock.release();
+      miss.load();
+      continue;
+    }
+    if (!pi)
+      return nullptr;
 
-  char* kptr = (char*)pi->va();
-  return &kptr[va & (PGSIZE-1)];
+    char* kptr = (char*)pi->va();
+    return &kptr[va & (PGSIZE-1)];
+  }
 }
 
 void*
@@ -533,6 +576,13 @@ int
 vmap::copyout(uptr va, const void *p, u64 len)
 {
   char *buf = (char*)p;
+  page_miss miss;
+ retry:
+  if (miss) {
+    // Read the page in without vpfs_ locked and resume at that page.
+    miss.load();
+    miss = page_miss();
+  }
   auto it = vpfs_.find(va / PGSIZE);
   auto end = vpfs_.find(PGROUNDUP(va + len) / PGSIZE);
   auto lock = vpfs_.acquire(it, end);
@@ -540,7 +590,11 @@ vmap::copyout(uptr va, const void *p, u64 len)
     if (!it.is_set())
       return -1;
     uptr va0 = (uptr)PGROUNDDOWN(va);
-    page_info* pi = ensure_page(it, access_type::READ);
+    page_info* pi = ensure_page(it, access_type::READ, nullptr, &miss);
+    if (miss) {
+      lock.release();
+      goto retry;
+    }
     if (!pi)
       return -1;
     char *p0 = (char*)pi->va();
@@ -579,6 +633,25 @@ vmap::set_write_permission(uptr start, uptr len, bool is_readonly, bool is_cow)
   return 0;
 }
 
+int
+vmap::set_access_hint(uptr start, uptr len, u64 hint)
+{
+  assert(start % PGSIZE == 0);
+  assert(len % PGSIZE == 0);
+  assert(!(hint & ~(vmdesc::FLAG_SEQUENTIAL | vmdesc::FLAG_RANDOM)));
+  auto it = vpfs_.find(start / PGSIZE);
+  auto end = vpfs_.find((start + len) / PGSIZE);
+  auto lock = vpfs_.acquire(it, end);
+  for (; it != end; ++it) {
+    if (!it.is_set())
+      return -1;
+    auto &desc = *it;
+    desc.flags &= ~(vmdesc::FLAG_SEQUENTIAL | vmdesc::FLAG_RANDOM);
+    desc.flags |= hint;
+  }
+  return 0;
+}
+
 int
 vmap::sbrk(ssize_t n, uptr *addr)
 {
@@ -656,9 +729,26 @@ vmap::unmapped_area(size_t npages)
   return 0;
 }
 
+void
+vmap::page_miss::load()
+{
+  mfile *mf = inode->as_file();
+  if (hint & vmdesc::FLAG_SEQUENTIAL) {
+    mf->readahead(pageidx, RA_MAX_PAGES);
+    mf->readahead_async(pageidx + RA_MAX_PAGES, RA_MAX_PAGES);
+  } else if (!(hint & vmdesc::FLAG_RANDOM)) {
+    // Neighboring pages are likely to fault next, and reading them
+    // in with this one costs little more than this one alone.
+    mf->readahead(pageidx, RA_MIN_PAGES);
+  }
+  // Readahead gives up if it's out of memory, but this throws
+  // bad_alloc, so the caller won't keep missing.
+  mf->get_page(pageidx);
+}
+
 page_info *
 vmap::ensure_page(const vmap::vpf_array::iterator &it, vmap::access_type type,
-                  bool *allocated)
+                  bool *allocated, page_miss *miss)
 {
   if (allocated)
     *allocated = false;
@@ -681,24 +771,46 @@ vmap::ensure_page(const vmap::vpf_array::iterator &it, vmap::access_type type,
       page = sref<page_info>::transfer(new(page_info::of(p)) page_info());
     } else {
       u64 page_idx = (it.index() * PGSIZE - desc.start) / PGSIZE;
-      page = desc.inode->as_file()->get_page(page_idx).get_page_info();
-      if (!page)
+      mfile *mf = desc.inode->as_file();
+      if (desc.flags & vmdesc::FLAG_COW) {
+        // Private mappings share the zero page for holes.  A write
+        // fault copies it like any other COW page.
+        page = mf->get_cached_page(page_idx).get_page_info();
+        if (!page && !mf->is_backed(page_idx) &&
+            page_idx < PGROUNDUP(*mf->read_size()) / PGSIZE)
+          page = mfile::zero_page;
+      } else {
+        // Shared mappings must see later writes to the file, so the
+        // hole needs a real page, and the mapping pins the page so it
+        // can't be evicted out from under the mapping and replaced by
+        // a fresh copy that later writes go to.
+        page = mf->fault_page(page_idx).get_page_info();
+      }
+      if (!page) {
+        if (miss && mf->is_backed(page_idx)) {
+          miss->inode = desc.inode;
+          miss->pageidx = page_idx;
+          miss->hint = desc.flags & (vmdesc::FLAG_SEQUENTIAL |
+                                     vmdesc::FLAG_RANDOM);
+        }
         return nullptr;
+      }
     }
   }
 
   if (need_copy) {
-    // This is a COW fault; copy in to a new page
+    // This is a COW fault; copy in to a new page.  The copy overwrites
+    // all of it, so don't bother zeroing it first.
     if (allocated)
       *allocated = true;
-    char *p = zalloc("(vmap::pagelookup)");
+    char *p = kalloc("(vmap::pagelookup)");
     if (!p)
       throw_bad_alloc();
 
     if (SDEBUG)
       sdebug.println("vm: COW copy to ", (void*)p, " from ", page->va(),
                      ' ', page.get());
-    memmove(p, page->va(), PGSIZE);
+    copy_page(p, page->va());
     page = sref<page_info>::transfer(new(page_info::of(p)) page_info());
   }
 
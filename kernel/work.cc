@@ -0,0 +1,306 @@
+// Per-CPU deferred work queues.
+//
+// Each CPU has a lock-free inbox that any CPU can push work on to
+// without contending with the scheduler.  The owning CPU moves inbox
+// entries on to per-priority ready queues (under a per-CPU lock that
+// only that CPU's inline runner and worker threads take) and runs
+// them: non-blocking work inline at context switches with a bounded
+// budget and from the idle loop, and work that may block on a pool
+// of WORK_WORKERS kernel threads pinned to the CPU.
+
+#include "types.h"
+#include "kernel.hh"
+#include "amd64.h"
+#include "spinlock.hh"
+#include "condvar.hh"
+#include "proc.hh"
+#include "cpu.hh"
+#include "percpu.hh"
+#include "work.hh"
+
+#include <uk/sched.h>
+
+struct work_queue {
+  work_queue()
+    : inbox_(nullptr), lock_("work_queue", LOCKSTAT_WQ),
+      cv_(condvar("work_queue")), nqueued_(0), nsleeping_(0) { }
+
+  void push(dwork *w);
+  bool run_inline(int cpu, bool idle);
+  void worker();
+
+private:
+  void drain_inbox();
+  dwork* pop_inline(bool idle);
+  dwork* pop_worker();
+  bool worker_pending();
+
+  typedef isqueue<dwork, &dwork::link_> queue_t;
+
+  // Work pushed by any CPU, in LIFO order.  The owner detaches the
+  // whole list at once, so there's no ABA problem.
+  atomic<dwork*> inbox_;
+
+  // Everything below is protected by lock_.
+  struct spinlock lock_;
+  struct condvar cv_;
+  // Work that must not block, by priority.  This runs inline, but
+  // the workers pick up whatever the inline budget leaves behind.
+  queue_t ready_[WORK_NPRIO];
+  // Work that may block, by priority.  Only the workers run this.
+  queue_t blocking_[WORK_NPRIO];
+  // The number of items in ready_ and blocking_.  This is read
+  // without lock_ as a hint.
+  volatile u64 nqueued_;
+  // The number of workers sleeping on cv_.
+  int nsleeping_;
+};
+
+DEFINE_PERCPU(work_queue, work_queues, NO_CRITICAL);
+
+void
+work_queue::push(dwork *w)
+{
+  dwork *head = inbox_.load(std::memory_order_relaxed);
+  do {
+    w->inbox_next_ = head;
+  } while (!inbox_.compare_exchange_weak(head, w));
+}
+
+// Move the inbox on to the ready queues.  Caller must hold lock_.
+void
+work_queue::drain_inbox()
+{
+  dwork *w = inbox_.exchange(nullptr);
+  if (w == nullptr)
+    return;
+
+  // The inbox is LIFO; reverse it so work runs in the order it was
+  // pushed.
+  dwork *fifo = nullptr;
+  while (w) {
+    dwork *next = w->inbox_next_;
+    w->inbox_next_ = fifo;
+    fifo = w;
+    w = next;
+  }
+
+  for (w = fifo; w; ) {
+    dwork *next = w->inbox_next_;
+    w->inbox_next_ = nullptr;
+    if (w->may_block_)
+      blocking_[w->prio_].push_back(w);
+    else
+      ready_[w->prio_].push_back(w);
+    nqueued_++;
+    w = next;
+  }
+}
+
+// Dequeue the highest priority non-blocking work.  WORK_IDLE work
+// is only returned if idle is true.  Caller must hold lock_.
+dwork*
+work_queue::pop_inline(bool idle)
+{
+  drain_inbox();
+  for (int prio = 0; prio < (idle ? WORK_NPRIO : WORK_IDLE); prio++) {
+    if (!ready_[prio].empty()) {
+      dwork *w = &ready_[prio].front();
+      ready_[prio].pop_front();
+      nqueued_--;
+      return w;
+    }
+  }
+  return nullptr;
+}
+
+// Dequeue the highest priority work for a worker thread.  Workers
+// leave non-blocking WORK_IDLE work to the idle loop.  Caller must
+// hold lock_.
+dwork*
+work_queue::pop_worker()
+{
+  drain_inbox();
+  for (int prio = 0; prio < WORK_NPRIO; prio++) {
+    queue_t *qs[2] = { &blocking_[prio], &ready_[prio] };
+    for (queue_t *q : qs) {
+      if (q->empty() || (prio == WORK_IDLE && q == &ready_[prio]))
+        continue;
+      dwork *w = &q->front();
+      q->pop_front();
+      nqueued_--;
+      return w;
+    }
+  }
+  return nullptr;
+}
+
+// Whether there is work that a worker should pick up.  Caller must
+// hold lock_.
+bool
+work_queue::worker_pending()
+{
+  for (int prio = 0; prio < WORK_NPRIO; prio++)
+    if (!blocking_[prio].empty() ||
+        (prio != WORK_IDLE && !ready_[prio].empty()))
+      return true;
+  return false;
+}
+
+// Run up to WORK_SWITCH_BUDGET items of non-blocking work on this
+// CPU and hand anything left over to the workers.  Returns true if
+// any work ran.
+bool
+work_queue::run_inline(int cpu, bool idle)
+{
+  if (inbox_.load(std::memory_order_relaxed) == nullptr && nqueued_ == 0)
+    return false;
+
+  bool ran = false;
+  for (int n = 0; n < WORK_SWITCH_BUDGET; n++) {
+    dwork *w;
+    {
+      scoped_acquire l(&lock_);
+      w = pop_inline(idle);
+    }
+    if (w == nullptr)
+      break;
+    w->run();
+    ran = true;
+    // Work runs with interrupts enabled, so we may have been
+    // preempted and moved to another CPU.  That CPU will run its own
+    // queue at its next switch.
+    if (myid() != cpu)
+      return ran;
+  }
+
+  scoped_acquire l(&lock_);
+  drain_inbox();
+  if (nsleeping_ && worker_pending())
+    cv_.wake_all(myproc()->yield_);
+  return ran;
+}
+
+void
+work_queue::worker()
+{
+  acquire(&lock_);
+  for (;;) {
+    dwork *w = pop_worker();
+    if (w == nullptr) {
+      nsleeping_++;
+      cv_.sleep(&lock_);
+      nsleeping_--;
+      continue;
+    }
+    release(&lock_);
+
+    // Don't let background work compete with real procs.
+    bool background = (w->prio_ == WORK_IDLE);
+    if (background)
+      myproc()->set_scheduler(SCHED_OTHER, NICE_MAX);
+    w->run();
+    if (background)
+      myproc()->set_scheduler(SCHED_OTHER, 0);
+
+    acquire(&lock_);
+  }
+}
+
+static void
+work_worker(void*)
+{
+  work_queues->worker();
+}
+
+struct work_batch {
+  work_batch(void (*fn)(void*), void *arg, int pending)
+    : fn_(fn), arg_(arg), lock_("work_batch", LOCKSTAT_WQ),
+      cv_(condvar("work_batch")), pending_(pending) { }
+
+  void (*fn_)(void*);
+  void *arg_;
+  struct spinlock lock_;
+  struct condvar cv_;
+  int pending_;
+};
+
+struct batch_work : public dwork {
+  batch_work(work_batch *b, work_prio prio)
+    : dwork(prio, true), b_(b) { }
+
+  virtual void run() override {
+    b_->fn_(b_->arg_);
+    {
+      scoped_acquire l(&b_->lock_);
+      if (--b_->pending_ == 0)
+        b_->cv_.wake_all(myproc()->yield_);
+    }
+    delete this;
+  }
+
+  work_batch *b_;
+
+  NEW_DELETE_OPS(batch_work);
+};
+
+int
+dwork_push(struct dwork *w, int cpu)
+{
+  if (cpu < 0 || cpu >= ncpu)
+    return -1;
+  work_queues[cpu].push(w);
+  return 0;
+}
+
+void
+dwork_run_all(void (*fn)(void*), void *arg, work_prio prio)
+{
+  work_batch b(fn, arg, ncpu);
+  batch_work *items[NCPU];
+
+  // Allocate everything up front so we never leave a partially
+  // submitted batch pointing at our stack.
+  for (int c = 0; c < ncpu; c++) {
+    items[c] = new (std::nothrow) batch_work(&b, prio);
+    if (items[c] == nullptr) {
+      while (c--)
+        delete items[c];
+      throw_bad_alloc();
+    }
+  }
+  for (int c = 0; c < ncpu; c++)
+    work_queues[c].push(items[c]);
+
+  scoped_acquire l(&b.lock_);
+  while (b.pending_)
+    b.cv_.sleep(&b.lock_);
+}
+
+// Called after every context switch.
+void
+work_switch(void)
+{
+  int cpu = myid();
+  work_queues[cpu].run_inline(cpu, myproc() == idleproc());
+}
+
+// Called from the idle loop.  Returns true if any work ran.
+bool
+work_idle(void)
+{
+  int cpu = myid();
+  return work_queues[cpu].run_inline(cpu, true);
+}
+
+void
+initwork(void)
+{
+  for (int c = 0; c < ncpu; c++) {
+    for (int i = 0; i < WORK_WORKERS; i++) {
+      char namebuf[32];
+      snprintf(namebuf, sizeof(namebuf), "work_%u.%u", c, i);
+      threadpin(work_worker, nullptr, namebuf, c);
+    }
+  }
+}
@@ -6,9 +6,7 @@
 #include "ilist.hh"
 #include "mtrace.h"
 #include "work.hh"
-
-extern "C" void zpage(void*);
-extern "C" void zpage_nc(void*);
+#include "pageops.hh"
 
 static const bool prezero = true;
 
@@ -29,7 +27,7 @@ DEFINE_PERCPU(zallocator, z_);
 
 struct zwork : public dwork {
   zwork(dwframe* frame)
-    : frame_(frame)
+    : dwork(WORK_IDLE), frame_(frame)
   {
     frame_->inc();
   }
@@ -39,7 +37,9 @@ struct zwork : public dwork {
       auto *r = (struct free_page*)kalloc("zpage");
       if (r == nullptr)
         break;
-      zpage_nc(r);
+      // Nobody will touch these pages for a while, so don't pull them
+      // into the cache.
+      zero_page_nt(r);
       scoped_cli cli;
       z_->pages.push_front(r);
       ++z_->nPages;
@@ -58,11 +58,13 @@ tryrefill(void)
 {
   int cpu = myid();
   if (prezero && z_[cpu].nPages < 16 && z_[cpu].frame.zero()) {
+    // Background zeroing only runs when this CPU would otherwise be
+    // idle.
     zwork* w = new zwork(&z_[cpu].frame);
-    // XXX This is higher priority than doing actual work.  We should
-    // only do background zeroing if we would otherwise be idle.
-    if (dwork_push(w, cpu) < 0)
+    if (dwork_push(w, cpu) < 0) {
+      z_[cpu].frame.dec();
       delete w;
+    }
   }
 }
 
@@ -85,7 +87,7 @@ zalloc(const char* name)
   if (p == nullptr) {
     p = kalloc(name);
     if (p != nullptr)
-      zpage(p);
+      zero_page(p);
   } else {
     mtunlabel(mtrace_label_block, p);
     mtlabel(mtrace_label_block, p, PGSIZE, name, strlen(name));
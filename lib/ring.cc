@@ -0,0 +1,161 @@
+#include "types.h"
+#include "user.h"
+#include "futex.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <xv6/ring.h>
+
+static struct ring_slot*
+slot_at(struct ring *r, u64 pos)
+{
+  u64 i = pos & (r->nslots - 1);
+  return (struct ring_slot*)(r->slots + i * r->stride);
+}
+
+// Sleep on bell until the other side rings it, unless *state has
+// moved on from blocked by the time we've counted ourselves in
+// waiters.
+static void
+ring_wait(volatile u64 *bell, volatile u64 *waiters,
+          volatile u64 *state, u64 blocked)
+{
+  u64 v = __atomic_load_n(bell, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(state, __ATOMIC_SEQ_CST) == blocked)
+    futex((const u64*)bell, FUTEX_WAIT, v, 0);
+  __atomic_fetch_sub(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+// Wake anyone sleeping on bell.  This only traps if someone is
+// waiting, which only happens when the ring was empty (or full).
+static void
+ring_notify(volatile u64 *bell, volatile u64 *waiters)
+{
+  // Order our update of the slot state before the load of waiters,
+  // against ring_wait's increment of waiters before its load of the
+  // state.  One of us is sure to see the other.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiters, __ATOMIC_RELAXED) == 0)
+    return;
+  __atomic_fetch_add(bell, 1, __ATOMIC_SEQ_CST);
+  futex((const u64*)bell, FUTEX_WAKE, ~0ull, 0);
+}
+
+int
+ring_map(struct ring *r, int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct ring_header))
+    return -1;
+  void *p = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    return -1;
+
+  // Read the geometry once, since whoever else has the ring mapped
+  // could change it under us.
+  struct ring_header *h = (struct ring_header*)p;
+  u64 magic = __atomic_load_n(&h->magic, __ATOMIC_RELAXED);
+  u64 nslots = __atomic_load_n(&h->nslots, __ATOMIC_RELAXED);
+  u64 slotsize = __atomic_load_n(&h->slotsize, __ATOMIC_RELAXED);
+  u64 stride = __atomic_load_n(&h->stride, __ATOMIC_RELAXED);
+  if (magic != RING_MAGIC ||
+      nslots == 0 || nslots > RING_MAX_SLOTS || (nslots & (nslots - 1)) ||
+      slotsize > RING_MAX_SLOTSIZE || stride != RING_STRIDE(slotsize) ||
+      RING_SIZE(slotsize, nslots) > (u64)st.st_size) {
+    munmap(p, st.st_size);
+    return -1;
+  }
+  r->hdr = h;
+  r->slots = (char*)p + sizeof(*h);
+  r->maplen = st.st_size;
+  r->nslots = nslots;
+  r->slotsize = slotsize;
+  r->stride = stride;
+  return 0;
+}
+
+void
+ring_unmap(struct ring *r)
+{
+  munmap(r->hdr, r->maplen);
+  r->hdr = nullptr;
+  r->slots = nullptr;
+}
+
+int
+ring_send(struct ring *r, const void *buf, size_t len, int flags)
+{
+  struct ring_header *h = r->hdr;
+  if (len > r->slotsize)
+    return -1;
+
+  u64 pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+  struct ring_slot *s;
+  u64 lap;
+  for (;;) {
+    s = slot_at(r, pos);
+    lap = pos / r->nslots;
+    u64 state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    s64 d = (s64)(state - 2 * lap);
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&h->head, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+      continue;
+    }
+    if (d < 0) {
+      // The slot still holds the last lap's message, so the ring is
+      // full.
+      if (flags & RING_NONBLOCK)
+        return -1;
+      ring_wait(&h->nonfull, &h->nonfull_waiters, &s->state, state);
+    }
+    pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+  }
+
+  memmove(s + 1, buf, len);
+  s->len = len;
+  __atomic_store_n(&s->state, 2 * lap + 1, __ATOMIC_RELEASE);
+  ring_notify(&h->nonempty, &h->nonempty_waiters);
+  return 0;
+}
+
+ssize_t
+ring_recv(struct ring *r, void *buf, size_t len, int flags)
+{
+  struct ring_header *h = r->hdr;
+
+  u64 pos = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+  struct ring_slot *s;
+  u64 lap;
+  for (;;) {
+    s = slot_at(r, pos);
+    lap = pos / r->nslots;
+    u64 state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    s64 d = (s64)(state - (2 * lap + 1));
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&h->tail, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+      continue;
+    }
+    if (d < 0) {
+      // Nobody has filled this lap's slot yet, so the ring is empty.
+      if (flags & RING_NONBLOCK)
+        return -1;
+      ring_wait(&h->nonempty, &h->nonempty_waiters, &s->state, state);
+    }
+    pos = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+  }
+
+  // The sender wrote len, so don't trust it to stay inside the slot.
+  size_t n = __atomic_load_n(&s->len, __ATOMIC_RELAXED);
+  if (n > r->slotsize)
+    n = r->slotsize;
+  memmove(buf, s + 1, n < len ? n : len);
+  // Free the slot for the next lap's sender.
+  __atomic_store_n(&s->state, 2 * (lap + 1), __ATOMIC_RELEASE);
+  ring_notify(&h->nonfull, &h->nonfull_waiters);
+  return n;
+}
@@ -1,9 +1,55 @@
 #include "types.h"
 #include "user.h"
+#include "amd64.h"
 
 #include <time.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <uk/clockpage.h>
+
+// Read the kernel's uptime from the clock page.  Returns 0 if the
+// clock page is not available, in which case the caller must fall
+// back to a system call.
+static int
+clockpage_uptime(uint64_t *nsec, uint64_t *epoch)
+{
+  const struct clockpage *cp = (const struct clockpage*)UCLOCKPAGE;
+  uint64_t seq, tsc, delta;
+
+  do {
+    seq = cp->seq;
+    barrier();
+    if (!(cp->flags & CLOCKPAGE_VALID))
+      return 0;
+    // Keep rdtsc from executing ahead of the clock page reads
+    __asm volatile("lfence" ::: "memory");
+    tsc = rdtsc();
+    delta = tsc > cp->tsc_base ? tsc - cp->tsc_base : 0;
+    *nsec = cp->nsec_base +
+      (uint64_t)(((unsigned __int128)delta * cp->tsc_mult) >> 32);
+    *epoch = cp->epoch_nsec;
+    barrier();
+  } while ((seq & 1) || seq != cp->seq);
+  return 1;
+}
+
+uint64_t
+uptime(void)
+{
+  uint64_t nsec, epoch;
+  if (clockpage_uptime(&nsec, &epoch))
+    return nsec;
+  return uptime_syscall();
+}
+
+uint64_t
+time_nsec(void)
+{
+  uint64_t nsec, epoch;
+  if (clockpage_uptime(&nsec, &epoch))
+    return epoch + nsec;
+  return time_nsec_syscall();
+}
 
 time_t
 time(time_t *t)
@@ -3,6 +3,7 @@
 #include "amd64.h"
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -30,29 +31,24 @@ gets(char *buf, int max)
 int
 stat(const char *n, struct stat *st)
 {
-  int fd;
-  int r;
-
-  fd = open(n, O_RDONLY | O_ANYFD | O_CLOEXEC);
-  if(fd < 0)
-    return -1;
-  r = fstat(fd, st);
-  close(fd);
-  return r;
+  return fstatat(AT_FDCWD, n, st);
 }
 
+// Open, fstat, and close n in one trap.
 int
 fstatat(int dirfd, const char *n, struct stat *st)
 {
-  int fd;
-  int r;
-
-  fd = openat(dirfd, n, O_RDONLY);
-  if(fd < 0)
+  struct syscall_rec recs[3] = {
+    { SYS_openat, SYSCALLV_STOP,
+      { (unsigned long)dirfd, (unsigned long)n,
+        O_RDONLY | O_ANYFD | O_CLOEXEC } },
+    { SYS_fstatx, SYSCALLV_ARG(0, 1), { 0, (unsigned long)st, 0 } },
+    { SYS_close, SYSCALLV_ARG(0, 2), { 0 } },
+  };
+
+  if(syscallv(recs, 3, 0) < 3)
     return -1;
-  r = fstat(fd, st);
-  close(fd);
-  return r;
+  return recs[1].ret;
 }
 
 pid_t
@@ -32,10 +32,22 @@ cpuid::cpuid() : basic_{}, extended_{}
   features_.mwait = l.c & (1<<3);
   features_.pdcm = l.c & (1<<15);
   features_.x2apic = l.c & (1<<21);
+  features_.xsave = l.c & (1<<26);
+  features_.osxsave = l.c & (1<<27);
+  features_.avx = l.c & (1<<28);
 
   features_.apic = l.d & (1<<9);
   features_.ds = l.d & (1<<21);
 
+  l = get_leaf(leafid::ext_features);
+  features_.avx2 = l.b & (1<<5);
+  features_.erms = l.b & (1<<9);
+  features_.avx512f = l.b & (1<<16);
+
+  l = get_leaf(leafid::ext_state, 1);
+  features_.xsaveopt = l.a & (1<<0);
+  features_.xsaves = l.a & (1<<3);
+
   l = get_leaf(leafid::extended_features);
   features_.page1GB = l.d & (1<<26);
 }
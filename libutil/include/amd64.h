@@ -397,6 +397,64 @@ fxrstor(volatile void *a)
   __asm volatile("fxrstor (%0)" : : "r" (a) : "memory");
 }
 
+static inline uint64_t
+xgetbv(uint32_t xcr)
+{
+  uint32_t lo, hi;
+  __asm volatile("xgetbv" : "=a" (lo), "=d" (hi) : "c" (xcr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void
+xsetbv(uint32_t xcr, uint64_t val)
+{
+  __asm volatile("xsetbv" : : "c" (xcr), "a" ((uint32_t)val),
+                 "d" ((uint32_t)(val >> 32)));
+}
+
+// The XSAVE family saves and restores the state components in mask
+// that are also enabled in XCR0.  The area must be 64-byte aligned.
+
+static inline void
+xsave(volatile void *a, uint64_t mask)
+{
+  __asm volatile("xsave64 (%0)" : : "r" (a), "a" ((uint32_t)mask),
+                 "d" ((uint32_t)(mask >> 32)) : "memory");
+}
+
+static inline void
+xsaveopt(volatile void *a, uint64_t mask)
+{
+  __asm volatile("xsaveopt64 (%0)" : : "r" (a), "a" ((uint32_t)mask),
+                 "d" ((uint32_t)(mask >> 32)) : "memory");
+}
+
+static inline void
+xrstor(volatile void *a, uint64_t mask)
+{
+  __asm volatile("xrstor64 (%0)" : : "r" (a), "a" ((uint32_t)mask),
+                 "d" ((uint32_t)(mask >> 32)) : "memory");
+}
+
+// XSAVES and XRSTORS use the compacted format.  Spelled out in bytes
+// because older assemblers don't know them.
+
+static inline void
+xsaves(volatile void *a, uint64_t mask)
+{
+  __asm volatile(".byte 0x48, 0x0f, 0xc7, 0x2f" // xsaves64 (%rdi)
+                 : : "D" (a), "a" ((uint32_t)mask),
+                   "d" ((uint32_t)(mask >> 32)) : "memory");
+}
+
+static inline void
+xrstors(volatile void *a, uint64_t mask)
+{
+  __asm volatile(".byte 0x48, 0x0f, 0xc7, 0x1f" // xrstors64 (%rdi)
+                 : : "D" (a), "a" ((uint32_t)mask),
+                   "d" ((uint32_t)(mask >> 32)) : "memory");
+}
+
 static inline void
 fninit(void)
 {
@@ -41,6 +41,17 @@
 
 #define CR4_PGE         0x00000080      // Page global enable
 #define CR4_PCE         0x100           // RDPMC at CPL > 0
+#define CR4_OSXSAVE     0x00040000      // XSAVE and XCR0 enable
+
+// XCR0 state components
+#define XFEATURE_X87      0x01
+#define XFEATURE_SSE      0x02
+#define XFEATURE_AVX      0x04          // Upper halves of YMM0-15
+#define XFEATURE_OPMASK   0x20          // AVX-512 k0-7
+#define XFEATURE_ZMM_HI256 0x40         // Upper halves of ZMM0-15
+#define XFEATURE_HI16_ZMM 0x80          // ZMM16-31
+#define XFEATURE_AVX512   (XFEATURE_OPMASK | XFEATURE_ZMM_HI256 | \
+                           XFEATURE_HI16_ZMM)
 
 // FS/GS base registers
 #define MSR_FS_BASE     0xc0000100
@@ -53,6 +64,9 @@
 #define MSR_CSTAR       0xc0000083
 #define MSR_SFMASK      0xc0000084
 
+// Supervisor state components for XSAVES
+#define MSR_IA32_XSS    0x00000da0
+
 #define MSR_INTEL_MISC_ENABLE 0x1a0
 #define MISC_ENABLE_PEBS_UNAVAILABLE (1<<12) // Read-only
 
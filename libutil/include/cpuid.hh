@@ -168,11 +168,23 @@ public:
     bool mwait : 1;
     bool pdcm : 1;              // Perfmon and debug
     bool x2apic : 1;
+    bool xsave : 1;
+    bool osxsave : 1;           // XSAVE enabled by the OS
+    bool avx : 1;
 
     // 1.EDX
     bool apic : 1;              // "APIC on chip"
     bool ds : 1;                // Debug store
 
+    // 7.EBX
+    bool avx2 : 1;
+    bool erms : 1;              // Enhanced REP MOVSB/STOSB
+    bool avx512f : 1;
+
+    // D.1.EAX
+    bool xsaveopt : 1;
+    bool xsaves : 1;            // XSAVES/XRSTORS and IA32_XSS
+
     // 80000001.EDX
     bool page1GB : 1;
   };
@@ -0,0 +1,27 @@
+#pragma once
+
+// Zeroing and copying whole pages, using whichever instructions are
+// fastest on this CPU.  Pages are 4096 bytes and page-aligned.
+
+enum { PAGEOPS_BYTES = 4096 };
+
+// Leave the page in the cache, for callers about to use it.
+void zero_page(void *dst);
+void copy_page(void *dst, const void *src);
+
+// Bypass the cache, for pages nobody will touch soon (e.g.,
+// background zeroing).
+void zero_page_nt(void *dst);
+void copy_page_nt(void *dst, const void *src);
+
+// The individual implementations, so benchmarks can compare them.
+struct pageops_impl
+{
+  const char *name;
+  bool (*supported)(void);
+  void (*zero)(void *dst);
+  void (*copy)(void *dst, const void *src);
+};
+
+extern const pageops_impl pageops_impls[];
+extern const int pageops_nimpls;
@@ -0,0 +1,271 @@
+#include "cpuid.hh"
+#include "amd64.h"
+#include "pageops.hh"
+
+// The kernel is built without SSE and switches user FPU state lazily
+// (see kernel/fpu.cc), so it sticks to the integer implementations.
+// Those include non-temporal stores, via MOVNTI.
+#if !defined(XV6_KERNEL)
+#define PAGEOPS_AVX2 1
+#else
+#define PAGEOPS_AVX2 0
+#endif
+
+static bool
+supported_always(void)
+{
+  return true;
+}
+
+static bool
+supported_erms(void)
+{
+  return cpuid::features().erms;
+}
+
+// Unrolled 8-byte moves, as zpage used to do.
+
+static void
+zero_movq(void *dst)
+{
+  uint64_t n = PAGEOPS_BYTES / 0x40;
+  __asm volatile("1:\n"
+                 "movq %%rax, 0x00(%0)\n"
+                 "movq %%rax, 0x08(%0)\n"
+                 "movq %%rax, 0x10(%0)\n"
+                 "movq %%rax, 0x18(%0)\n"
+                 "movq %%rax, 0x20(%0)\n"
+                 "movq %%rax, 0x28(%0)\n"
+                 "movq %%rax, 0x30(%0)\n"
+                 "movq %%rax, 0x38(%0)\n"
+                 "lea 0x40(%0), %0\n"
+                 "dec %1\n"
+                 "jnz 1b\n"
+                 : "+r" (dst), "+r" (n)
+                 : "a" (0)
+                 : "memory", "cc");
+}
+
+static void
+copy_movq(void *dst, const void *src)
+{
+  uint64_t n = PAGEOPS_BYTES / 0x20;
+  __asm volatile("1:\n"
+                 "movq 0x00(%1), %%rax\n"
+                 "movq 0x08(%1), %%rcx\n"
+                 "movq 0x10(%1), %%rdx\n"
+                 "movq 0x18(%1), %%r8\n"
+                 "movq %%rax, 0x00(%0)\n"
+                 "movq %%rcx, 0x08(%0)\n"
+                 "movq %%rdx, 0x10(%0)\n"
+                 "movq %%r8, 0x18(%0)\n"
+                 "lea 0x20(%0), %0\n"
+                 "lea 0x20(%1), %1\n"
+                 "dec %2\n"
+                 "jnz 1b\n"
+                 : "+r" (dst), "+r" (src), "+r" (n)
+                 :
+                 : "rax", "rcx", "rdx", "r8", "memory", "cc");
+}
+
+// String instructions.  Without ERMS, the quadword forms are the fast
+// ones.
+
+static void
+zero_rep_stosq(void *dst)
+{
+  uint64_t n = PAGEOPS_BYTES / 8;
+  __asm volatile("cld; rep stosq"
+                 : "+D" (dst), "+c" (n) : "a" (0) : "memory", "cc");
+}
+
+static void
+copy_rep_movsq(void *dst, const void *src)
+{
+  uint64_t n = PAGEOPS_BYTES / 8;
+  __asm volatile("cld; rep movsq"
+                 : "+D" (dst), "+S" (src), "+c" (n) : : "memory", "cc");
+}
+
+static void
+zero_rep_stosb(void *dst)
+{
+  uint64_t n = PAGEOPS_BYTES;
+  __asm volatile("cld; rep stosb"
+                 : "+D" (dst), "+c" (n) : "a" (0) : "memory", "cc");
+}
+
+static void
+copy_rep_movsb(void *dst, const void *src)
+{
+  uint64_t n = PAGEOPS_BYTES;
+  __asm volatile("cld; rep movsb"
+                 : "+D" (dst), "+S" (src), "+c" (n) : : "memory", "cc");
+}
+
+// Non-temporal 8-byte stores.  The sfence orders them before whatever
+// publishes the page.
+
+static void
+zero_movnti(void *dst)
+{
+  uint64_t n = PAGEOPS_BYTES / 0x40;
+  __asm volatile("1:\n"
+                 "movnti %%rax, 0x00(%0)\n"
+                 "movnti %%rax, 0x08(%0)\n"
+                 "movnti %%rax, 0x10(%0)\n"
+                 "movnti %%rax, 0x18(%0)\n"
+                 "movnti %%rax, 0x20(%0)\n"
+                 "movnti %%rax, 0x28(%0)\n"
+                 "movnti %%rax, 0x30(%0)\n"
+                 "movnti %%rax, 0x38(%0)\n"
+                 "lea 0x40(%0), %0\n"
+                 "dec %1\n"
+                 "jnz 1b\n"
+                 "sfence\n"
+                 : "+r" (dst), "+r" (n)
+                 : "a" (0)
+                 : "memory", "cc");
+}
+
+static void
+copy_movnti(void *dst, const void *src)
+{
+  uint64_t n = PAGEOPS_BYTES / 0x20;
+  __asm volatile("1:\n"
+                 "prefetchnta 0x100(%1)\n"
+                 "movq 0x00(%1), %%rax\n"
+                 "movq 0x08(%1), %%rcx\n"
+                 "movq 0x10(%1), %%rdx\n"
+                 "movq 0x18(%1), %%r8\n"
+                 "movnti %%rax, 0x00(%0)\n"
+                 "movnti %%rcx, 0x08(%0)\n"
+                 "movnti %%rdx, 0x10(%0)\n"
+                 "movnti %%r8, 0x18(%0)\n"
+                 "lea 0x20(%0), %0\n"
+                 "lea 0x20(%1), %1\n"
+                 "dec %2\n"
+                 "jnz 1b\n"
+                 "sfence\n"
+                 : "+r" (dst), "+r" (src), "+r" (n)
+                 :
+                 : "rax", "rcx", "rdx", "r8", "memory", "cc");
+}
+
+#if PAGEOPS_AVX2
+// Non-temporal 32-byte stores.  User space only; see above.
+
+static bool
+supported_avx2(void)
+{
+  static int usable = -1;
+  if (usable < 0) {
+    // The OS must also have enabled SSE and AVX state in XCR0.
+    auto &f = cpuid::features();
+    usable = f.avx2 && f.osxsave && (xgetbv(0) & 0x6) == 0x6;
+  }
+  return usable;
+}
+
+static void
+zero_avx2_nt(void *dst)
+{
+  uint64_t n = PAGEOPS_BYTES / 0x80;
+  __asm volatile("vpxor %%ymm0, %%ymm0, %%ymm0\n"
+                 "1:\n"
+                 "vmovntdq %%ymm0, 0x00(%0)\n"
+                 "vmovntdq %%ymm0, 0x20(%0)\n"
+                 "vmovntdq %%ymm0, 0x40(%0)\n"
+                 "vmovntdq %%ymm0, 0x60(%0)\n"
+                 "lea 0x80(%0), %0\n"
+                 "dec %1\n"
+                 "jnz 1b\n"
+                 "sfence\n"
+                 "vzeroupper\n"
+                 : "+r" (dst), "+r" (n)
+                 :
+                 : "xmm0", "memory", "cc");
+}
+
+static void
+copy_avx2_nt(void *dst, const void *src)
+{
+  uint64_t n = PAGEOPS_BYTES / 0x80;
+  __asm volatile("1:\n"
+                 "prefetchnta 0x200(%1)\n"
+                 "vmovdqa 0x00(%1), %%ymm0\n"
+                 "vmovdqa 0x20(%1), %%ymm1\n"
+                 "vmovdqa 0x40(%1), %%ymm2\n"
+                 "vmovdqa 0x60(%1), %%ymm3\n"
+                 "vmovntdq %%ymm0, 0x00(%0)\n"
+                 "vmovntdq %%ymm1, 0x20(%0)\n"
+                 "vmovntdq %%ymm2, 0x40(%0)\n"
+                 "vmovntdq %%ymm3, 0x60(%0)\n"
+                 "lea 0x80(%0), %0\n"
+                 "lea 0x80(%1), %1\n"
+                 "dec %2\n"
+                 "jnz 1b\n"
+                 "sfence\n"
+                 "vzeroupper\n"
+                 : "+r" (dst), "+r" (src), "+r" (n)
+                 :
+                 : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+}
+#endif
+
+const pageops_impl pageops_impls[] = {
+  {"movq", supported_always, zero_movq, copy_movq},
+  {"rep-q", supported_always, zero_rep_stosq, copy_rep_movsq},
+  {"rep-b-erms", supported_erms, zero_rep_stosb, copy_rep_movsb},
+  {"movnti", supported_always, zero_movnti, copy_movnti},
+#if PAGEOPS_AVX2
+  {"avx2-nt", supported_avx2, zero_avx2_nt, copy_avx2_nt},
+#endif
+};
+
+const int pageops_nimpls = sizeof(pageops_impls) / sizeof(pageops_impls[0]);
+
+// ERMS makes the byte forms of the string instructions the fastest way
+// to zero or copy a cached page.  Without it, use the quadword forms.
+
+void
+zero_page(void *dst)
+{
+  if (cpuid::features().erms)
+    zero_rep_stosb(dst);
+  else
+    zero_rep_stosq(dst);
+}
+
+void
+copy_page(void *dst, const void *src)
+{
+  if (cpuid::features().erms)
+    copy_rep_movsb(dst, src);
+  else
+    copy_rep_movsq(dst, src);
+}
+
+void
+zero_page_nt(void *dst)
+{
+#if PAGEOPS_AVX2
+  if (supported_avx2()) {
+    zero_avx2_nt(dst);
+    return;
+  }
+#endif
+  zero_movnti(dst);
+}
+
+void
+copy_page_nt(void *dst, const void *src)
+{
+#if PAGEOPS_AVX2
+  if (supported_avx2()) {
+    copy_avx2_nt(dst, src);
+    return;
+  }
+#endif
+  copy_movnti(dst, src);
+}
@@ -51,7 +51,31 @@
 // If 1, create a buddy per CPU.
 #define KALLOC_BUDDY_PER_CPU 1
 // Whether or not to load balance in the scheduler.
-#define SCHED_LOAD_BALANCE 0
+#define SCHED_LOAD_BALANCE 1
+// The maximum number of deferred work items to run inline per
+// context switch.
+#define WORK_SWITCH_BUDGET 8
+// The number of kernel worker threads per CPU for deferred work that
+// may block.
+#define WORK_WORKERS 2
+// The most pages a single O_APPEND write reserves at once.  Longer
+// appends are short writes.
+#define APPEND_MAX_PAGES 16
+// Reclaim cached pages when a buddy allocator's free memory drops
+// below 1/RECLAIM_LOW_DIV of what it started with, until its NUMA
+// node is back above 1/RECLAIM_HIGH_DIV.
+#define RECLAIM_LOW_DIV 32
+#define RECLAIM_HIGH_DIV 16
+// How often (in msec) the reclaim workers check the watermarks on
+// their own.
+#define RECLAIM_INTERVAL 100
+// The most pages reclaim asks each shrinker for at once.
+#define RECLAIM_BATCH 256
+// The smallest and largest readahead windows, in pages.  Sequential
+// reads start at the smallest window and double it with every read.
+// RA_MAX_PAGES is also the most pages read in one batch.
+#define RA_MIN_PAGES 4
+#define RA_MAX_PAGES 32
 // Reference counting scheme for inode's nlink.  One of:
 //  :: for shared reference counters
 //  refcache:: for refcache counters
@@ -8,5 +8,9 @@ BEGIN_DECLS
 
 int open(const char*, int, ...);
 int openat(int, const char *, int, ...);
+int fallocate(int fd, int mode, off_t offset, off_t len);
+int posix_fadvise(int fd, off_t offset, off_t len, int advice);
+ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+               size_t len, unsigned int flags);
 
 END_DECLS
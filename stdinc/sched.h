@@ -1,5 +1,6 @@
 #pragma once
 #include "types.h"
+#include <uk/sched.h>
 
 BEGIN_DECLS
 
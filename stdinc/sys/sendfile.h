@@ -0,0 +1,10 @@
+#pragma once
+
+#include "compiler.h"
+#include <sys/types.h>
+
+BEGIN_DECLS
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+
+END_DECLS
@@ -0,0 +1,42 @@
+// User/kernel shared clock page definitions
+#pragma once
+
+#include <stdint.h>
+
+// The kernel maps a read-only clock page at UCLOCKPAGE in every
+// address space.  User space can combine it with rdtsc to compute
+// uptime and wall-clock time without trapping into the kernel.  This
+// address is well below the user stack at the top of the address
+// space.
+#define UCLOCKPAGE 0x00007ffffff00000ull
+
+// Set in clockpage.flags once the kernel has calibrated the TSC
+// against the system clock.  If this is clear, user space must fall
+// back to the uptime and time_nsec system calls.
+#define CLOCKPAGE_VALID 0x1
+
+struct clockpage {
+  // Seqcount.  Odd while the kernel is updating the fields below.
+  // Readers must retry if this is odd or changes across a read.
+  volatile uint64_t seq;
+
+  uint64_t flags;
+
+  // TSC frequency, as calibrated at boot (the kernel's cpuhz).
+  uint64_t cpuhz;
+
+  // The TSC value and the uptime in nanoseconds at the last
+  // resynchronization.  So that the clock never goes backward,
+  // nsec_base can be a little ahead of the kernel's own uptime.
+  uint64_t tsc_base;
+  uint64_t nsec_base;
+
+  // Nanoseconds per TSC cycle as a 32.32 fixed-point number.  This
+  // is recalibrated against the system clock at every
+  // resynchronization, so it tracks TSC drift more closely than
+  // cpuhz alone.
+  uint64_t tsc_mult;
+
+  // The UNIX epoch time, in nanoseconds, when uptime was 0.
+  uint64_t epoch_nsec;
+};
@@ -13,5 +13,22 @@
 #define O_CLOEXEC 0x2000
 #define O_NONBLOCK 0x4000
 #define O_NDELAY  O_NONBLOCK
+#define O_ANYORDER 0x8000 // (xv6) pipe2: readers may get writes in any order
 
 #define AT_FDCWD  -100
+
+// fallocate flags
+#define FALLOC_FL_KEEP_SIZE 0x01
+
+// posix_fadvise advice
+#define POSIX_FADV_NORMAL     0
+#define POSIX_FADV_RANDOM     1
+#define POSIX_FADV_SEQUENTIAL 2
+#define POSIX_FADV_WILLNEED   3
+#define POSIX_FADV_DONTNEED   4
+#define POSIX_FADV_NOREUSE    5
+
+// splice flags
+#define SPLICE_F_MOVE     0x01
+#define SPLICE_F_NONBLOCK 0x02
+#define SPLICE_F_MORE     0x04
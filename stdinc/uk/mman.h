@@ -13,7 +13,10 @@
 
 #define MAP_FAILED ((void*)-1)
 
-#define MADV_WILLNEED 3
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
 
 // xv6 extension: invalidate all page tables
 #define MADV_INVALIDATE_CACHE 1000
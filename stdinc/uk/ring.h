@@ -0,0 +1,60 @@
+// User/kernel shared memory ring definitions
+#pragma once
+
+#include <stdint.h>
+
+// A shared memory ring is an anonymous shared file laid out as a
+// struct ring_header followed by nslots message slots.  ring_create
+// makes one and returns a file descriptor for it, which the ends
+// share by fork or SCM_RIGHTS and map with mmap(MAP_SHARED).  After
+// that, messages move through the mapping without system calls.  The
+// ends only enter the kernel, through futex, to sleep on an empty or
+// full ring and to wake whoever is sleeping on the other side.
+//
+// The ring is a bounded MPMC queue, so any number of processes may
+// send and receive.  head and tail count messages ever claimed by
+// senders and receivers.  Message pos goes in slot pos % nslots on
+// lap pos / nslots, and the slot's state says whose turn it is:
+// 2*lap means the slot is free for lap's sender and 2*lap+1 means it
+// holds lap's message.  Slots start out zeroed, which makes them all
+// free for lap 0.
+
+#define RING_MAGIC 0x676e6972367678ull      // "xv6ring"
+
+// Limits on ring_create's arguments
+#define RING_MAX_SLOTS    65536
+#define RING_MAX_SLOTSIZE (1 << 20)
+#define RING_MAX_SIZE     (64 << 20)
+
+struct ring_header {
+  uint64_t magic;
+  uint64_t nslots;              // a power of two
+  uint64_t slotsize;            // the largest message
+  uint64_t stride;              // bytes from one slot to the next
+
+  // Senders' and receivers' positions, each on its own cache line.
+  volatile uint64_t head __attribute__((aligned(64)));
+  volatile uint64_t tail __attribute__((aligned(64)));
+
+  // Doorbells.  A receiver that finds the ring empty counts itself in
+  // nonempty_waiters and futex waits on nonempty, and a sender that
+  // fills a slot while anyone is waiting bumps nonempty and wakes
+  // them.  nonfull works the same way the other way around.
+  volatile uint64_t nonempty __attribute__((aligned(64)));
+  volatile uint64_t nonempty_waiters;
+  volatile uint64_t nonfull __attribute__((aligned(64)));
+  volatile uint64_t nonfull_waiters;
+};
+
+struct ring_slot {
+  volatile uint64_t state;
+  uint64_t len;
+  // Followed by slotsize bytes of data
+};
+
+// The distance between slots for messages of up to slotsize bytes
+#define RING_STRIDE(slotsize) \
+  ((sizeof(struct ring_slot) + (slotsize) + 63) & ~(uint64_t)63)
+// The size of a ring
+#define RING_SIZE(slotsize, nslots) \
+  (sizeof(struct ring_header) + (nslots) * RING_STRIDE(slotsize))
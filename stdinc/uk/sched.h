@@ -0,0 +1,14 @@
+// User/kernel shared scheduling definitions
+#pragma once
+
+// Scheduling classes for setscheduler.  Runnable SCHED_FIFO procs
+// run before SCHED_OTHER procs on the same CPU, except that once they
+// have run for 95% of a second, waiting SCHED_OTHER procs get the
+// rest of it.  A process can set its own class or its children's,
+// but only init and SCHED_FIFO processes may set SCHED_FIFO.
+#define SCHED_OTHER 0           // Weighted fair share (the default)
+#define SCHED_FIFO  1           // Real-time, first-in first-out
+
+// Range of nice values for SCHED_OTHER.  Lower is a larger share.
+#define NICE_MIN (-20)
+#define NICE_MAX 19
@@ -47,9 +47,77 @@ struct __attribute__((__aligned__(__BIGGEST_ALIGNMENT__))) sockaddr_storage
 #define PF_UNIX AF_UNIX
 
 #define SOCK_DGRAM_UNORDERED 3
+#ifndef SOCK_SEQPACKET
+#define SOCK_SEQPACKET 5
+#endif
 #ifdef __cplusplus
 static_assert(SOCK_DGRAM_UNORDERED != SOCK_STREAM,
               "SOCK_DGRAM_UNORDERED == SOCK_STREAM");
 static_assert(SOCK_DGRAM_UNORDERED != SOCK_DGRAM,
               "SOCK_DGRAM_UNORDERED == SOCK_DGRAM");
+static_assert(SOCK_SEQPACKET != SOCK_DGRAM_UNORDERED,
+              "SOCK_SEQPACKET == SOCK_DGRAM_UNORDERED");
 #endif
+
+struct iovec
+{
+  void *iov_base;
+  size_t iov_len;
+};
+
+struct msghdr
+{
+  void *msg_name;
+  socklen_t msg_namelen;
+  struct iovec *msg_iov;
+  size_t msg_iovlen;
+  void *msg_control;
+  size_t msg_controllen;
+  int msg_flags;
+};
+
+// For sendmmsg and recvmmsg
+struct mmsghdr
+{
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+
+struct cmsghdr
+{
+  size_t cmsg_len;
+  int cmsg_level;
+  int cmsg_type;
+};
+
+#define CMSG_ALIGN(len) \
+  (((len) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+#define CMSG_SPACE(len) (CMSG_ALIGN(sizeof(struct cmsghdr)) + CMSG_ALIGN(len))
+#define CMSG_LEN(len) (CMSG_ALIGN(sizeof(struct cmsghdr)) + (len))
+#define CMSG_DATA(cmsg) \
+  ((unsigned char*)(cmsg) + CMSG_ALIGN(sizeof(struct cmsghdr)))
+#define CMSG_FIRSTHDR(msg)                                     \
+  ((msg)->msg_controllen >= sizeof(struct cmsghdr) ?           \
+   (struct cmsghdr*)(msg)->msg_control : (struct cmsghdr*)0)
+#define CMSG_NXTHDR(msg, cmsg)                                          \
+  ((char*)(cmsg) + CMSG_ALIGN((cmsg)->cmsg_len) + sizeof(struct cmsghdr) > \
+   (char*)(msg)->msg_control + (msg)->msg_controllen ?                  \
+   (struct cmsghdr*)0 :                                                 \
+   (struct cmsghdr*)((char*)(cmsg) + CMSG_ALIGN((cmsg)->cmsg_len)))
+
+#ifndef SOL_SOCKET
+#define SOL_SOCKET 0xfff
+#endif
+#define SCM_RIGHTS 1
+
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0x08
+#endif
+#define MSG_CTRUNC 0x40         // Ancillary data was truncated
+#define MSG_TRUNC  0x80         // A datagram was truncated
+
+// The most iovecs one message may have
+#define UIO_MAXIOV 16
+// The most files one SCM_RIGHTS message may pass.  UNIX sockets
+// themselves can't be passed.
+#define SCM_MAX_FD 16
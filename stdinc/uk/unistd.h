@@ -15,3 +15,26 @@ enum stat_flags {
 #define SEEK_SET 0
 #define SEEK_CUR 1
 #define SEEK_END 2
+
+// xv6 syscallv records.  Each runs system call num with args and gets
+// its return value in ret.  flags can make the batch stop if this
+// call fails, and can replace arguments with the results of earlier
+// calls in the batch: SYSCALLV_ARG(i, back) replaces args[i] with the
+// ret of the record back records before this one (1 to 15).
+struct syscall_rec
+{
+  unsigned int num;
+  unsigned int flags;
+  unsigned long args[6];
+  long ret;
+};
+
+#define SYSCALLV_STOP          0x1      // Stop the batch if ret < 0
+#define SYSCALLV_ARG_SHIFT     4
+#define SYSCALLV_ARG(i, back)  ((unsigned int)(back) << (SYSCALLV_ARG_SHIFT + 4 * (i)))
+
+// syscallv flags
+#define SYSCALLV_STOP_ON_ERROR 0x1      // SYSCALLV_STOP on every record
+
+// The most records one syscallv runs
+#define SYSCALLV_MAX 64
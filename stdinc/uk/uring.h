@@ -0,0 +1,105 @@
+// User/kernel shared submission and completion ring definitions
+#pragma once
+
+#include <stdint.h>
+
+// A uring lets a process queue file and socket operations in shared
+// memory and collect their results there, so that one uring_enter,
+// or none at all, covers a whole batch of operations.
+//
+// uring_setup(entries, flags) returns a file descriptor for a new
+// uring with entries submission slots (a power of two) and twice as
+// many completion slots.  Map it with mmap(MAP_SHARED) over
+// URING_SIZE(entries) bytes.  The mapping starts with a struct
+// uring_header.
+//
+// To submit, fill the SQE at sq_tail % sq_entries and then advance
+// sq_tail.  The kernel consumes SQEs from sq_head.  For each one, it
+// posts a CQE with the same user_data at cq_tail % cq_entries and
+// advances cq_tail, and the process consumes CQEs by advancing
+// cq_head.  The kernel stops consuming SQEs while the completion
+// ring is full.
+//
+// uring_enter(fd, to_submit, min_complete, flags) runs up to
+// to_submit queued operations in the caller's context.  With
+// URING_ENTER_ASYNC, it instead hands them to a kernel worker thread
+// on the caller's core and returns right away, so the caller can keep
+// computing while they wait on the disk.  Async batches only run NOP,
+// OPENAT, CLOSE, FSTAT, and reads and writes of regular files; any
+// other operation completes with -1, since it could block the shared
+// worker indefinitely.  A batch stops early if the caller is killed
+// or exits.  In both cases uring_enter then waits until at least
+// min_complete CQEs are unconsumed.  It returns the number of SQEs it
+// ran or handed off.
+
+#define URING_MAGIC 0x676e697275367678ull   // "xv6uring"
+
+#define URING_MAX_ENTRIES 4096
+
+// uring_enter flags
+#define URING_ENTER_ASYNC 0x1
+
+// Operations.  Each works like the system call of the same name on
+// fd, and res is what that call would return.
+enum {
+  URING_OP_NOP,
+  URING_OP_READ,       // addr: buffer, len
+  URING_OP_WRITE,      // addr: buffer, len
+  URING_OP_PREAD,      // addr: buffer, len, off
+  URING_OP_PWRITE,     // addr: buffer, len, off
+  URING_OP_OPENAT,     // fd: dirfd, addr: path, op_flags: omode, off: mode
+  URING_OP_CLOSE,
+  URING_OP_FSTAT,      // addr: struct stat, op_flags: stat_flags
+  URING_OP_ACCEPT,     // addr: sockaddr, addr2: socklen_t
+  URING_OP_SEND,       // addr: buffer, len, op_flags: flags
+  URING_OP_RECV,       // addr: buffer, len, op_flags: flags
+  URING_NOPS
+};
+
+struct uring_sqe {
+  uint8_t opcode;
+  uint8_t pad0[3];
+  int32_t fd;
+  uint64_t off;
+  uint64_t addr;
+  uint32_t len;
+  int32_t op_flags;
+  uint64_t addr2;
+  uint64_t user_data;
+  uint64_t pad1[2];
+};
+
+struct uring_cqe {
+  uint64_t user_data;
+  int64_t res;
+};
+
+struct uring_header {
+  uint64_t magic;
+  uint32_t sq_entries;
+  uint32_t cq_entries;
+  // Offsets of the SQE and CQE arrays from the start of the mapping
+  uint64_t sqes_off;
+  uint64_t cqes_off;
+
+  // Each index is written by one side only, and sits on its own
+  // cache line.
+  volatile uint32_t sq_head __attribute__((aligned(64)));  // kernel
+  volatile uint32_t sq_tail __attribute__((aligned(64)));  // process
+  volatile uint32_t cq_head __attribute__((aligned(64)));  // process
+  volatile uint32_t cq_tail __attribute__((aligned(64)));  // kernel
+};
+
+// SQEs start on the second page, and CQEs right after them.
+#define URING_SQES_OFF 4096
+#define URING_CQES_OFF(entries) \
+  (URING_SQES_OFF + (entries) * sizeof(struct uring_sqe))
+#define URING_SIZE(entries) \
+  (URING_CQES_OFF(entries) + 2 * (entries) * sizeof(struct uring_cqe))
+
+#define URING_SQE(hdr, i)                                               \
+  ((struct uring_sqe*)((char*)(hdr) + (hdr)->sqes_off) +                \
+   ((i) & ((hdr)->sq_entries - 1)))
+#define URING_CQE(hdr, i)                                               \
+  ((struct uring_cqe*)((char*)(hdr) + (hdr)->cqes_off) +                \
+   ((i) & ((hdr)->cq_entries - 1)))
@@ -19,6 +19,7 @@ int execv(const char *path, char *const argv[]);
 int dup(int oldfd);
 int dup2(int oldfd, int newfd);
 off_t lseek(int fd, off_t offset, int whence);
+int ftruncate(int fd, off_t length);
 int chdir(const char *path);
 int pipe(int pipefd[2]);
 int pipe2(int pipefd[2], int flags);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "compiler.h"
+#include <sys/types.h>
+#include <uk/ring.h>
+
+BEGIN_DECLS
+
+// One end's mapping of a shared memory ring (see <uk/ring.h>).  The
+// other ends can write the header, so ring_map checks its geometry
+// once and keeps its own copy.
+struct ring {
+  struct ring_header *hdr;
+  char *slots;
+  size_t maplen;
+  u64 nslots;
+  u64 slotsize;
+  u64 stride;
+};
+
+// Don't wait on a full or empty ring; fail instead.
+#define RING_NONBLOCK 0x1
+
+// Map the ring open at fd.  Returns 0 on success.
+int ring_map(struct ring *r, int fd);
+void ring_unmap(struct ring *r);
+
+// Send a message of len bytes, at most the ring's slot size.
+// Returns 0 on success, or -1 if the message is too big or the ring
+// is full and flags has RING_NONBLOCK.
+int ring_send(struct ring *r, const void *buf, size_t len, int flags);
+
+// Receive a message into buf, which holds len bytes.  A message that
+// doesn't fit is truncated.  Returns the message's full length, or -1
+// if the ring is empty and flags has RING_NONBLOCK.
+ssize_t ring_recv(struct ring *r, void *buf, size_t len, int flags);
+
+END_DECLS
@@ -61,6 +61,13 @@ def main():
         print "#include \"traps.h\""
         print
         for syscall in syscalls:
+            # The syscall instruction clobbers %rcx, so the fourth
+            # argument travels in %r10.  Skip the move if there isn't one.
+            nargs = len([a for a in syscall.uargs if a not in ("", "void")])
+            if nargs >= 4 or "..." in syscall.uargs:
+                shuffle = "  movq %rcx, %r10\n"
+            else:
+                shuffle = ""
             print """\
 .globl SYS_%(uname)s
 SYS_%(uname)s = %(num)d
@@ -68,10 +75,9 @@ SYS_%(uname)s = %(num)d
 .globl %(uname)s
 %(uname)s:
   movq $%(num)d, %%rax
-  movq %%rcx, %%r10
-  syscall
+%(shuffle)s  syscall
   ret
-""" % syscall.__dict__
+""" % dict(syscall.__dict__, shuffle=shuffle)
 
     if options.udecls:
         print "#include \"types.h\""
@@ -90,6 +96,10 @@ SYS_%(uname)s = %(num)d
                                     ", ".join(syscall.uargs), extra)
         print
         print "END_DECLS"
+        print
+        # System call numbers, for building syscallv records
+        for syscall in syscalls:
+            print "#define SYS_%s %d" % (syscall.uname, syscall.num)
 
 class Syscall(object):
     def __init__(self, fp, kname, rettype, kargs, flags, num=None):
@@ -99,7 +109,7 @@ class Syscall(object):
         self.basename = kname[4:]
 
         # Construct user space prototype
-        self.uname = self.basename
+        self.uname = flags.get("uname", self.basename)
         if "uargs" in flags:
             self.uargs = flags["uargs"]
         else: